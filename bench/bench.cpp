@@ -0,0 +1,255 @@
+// Measures each stage of reading and writing NBT data on its own, on data generated here: realistic-looking chunks, a level.dat and (when
+// mclevel is available) a whole region file. Reports throughput in MB of uncompressed NBT per second, and allocations per chunk.
+//
+// Usage: bench [chunks] [repetitions]
+
+#include <nbtmodify/core.hpp>
+#include <nbtmodify/query.hpp>
+#include <nbtmodify/packed.hpp>
+#include <nbtmodify/stats.hpp>
+
+#if __has_include(<level.hpp>)
+#include <nbtmodify/region.hpp>
+#define NBT_BENCH_REGION 1
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using namespace nbt;
+
+std::vector<NBTTag> list_of(std::initializer_list<NBTTag> tags) { return std::vector<NBTTag>(tags); }
+
+NBTTag compound(std::string_view name, std::vector<NBTTag> children) { return NBTTag(TAG_COMPOUND, name, children); }
+
+NBTTag string_tag(std::string_view name, std::string value) { return NBTTag(TAG_STRING, name, value); }
+
+// A block state palette entry, with properties on some of them as in real chunks.
+NBTTag block_state(std::mt19937& rng, std::size_t i) {
+    static const char* names[] = {"minecraft:stone", "minecraft:deepslate", "minecraft:dirt", "minecraft:grass_block", "minecraft:water",
+                                  "minecraft:oak_log", "minecraft:iron_ore", "minecraft:andesite", "minecraft:gravel", "minecraft:air"};
+    std::vector<NBTTag> children{string_tag("Name", names[i % std::size(names)])};
+    if (rng() % 3 == 0)
+        children.push_back(compound("Properties", {string_tag("axis", "y"), string_tag("level", std::to_string(rng() % 16))}));
+    return compound("", std::move(children));
+}
+
+// A section with a random palette, packed the way the game packs it.
+NBTTag section(std::mt19937& rng, int y) {
+    std::size_t palette_size = 1 + rng() % 12;
+    std::vector<NBTTag> palette;
+    for (std::size_t i = 0; i < palette_size; ++i)
+        palette.push_back(block_state(rng, i));
+    std::vector<NBTTag> block_states{NBTTag(TAG_ARRAY, "palette", palette)};
+    if (palette_size > 1) {
+        unsigned bits = bits_per_entry(palette_size, 4);
+        std::vector<uint16_t> indices(4096);
+        for (uint16_t& index : indices)
+            index = (uint16_t)(rng() % palette_size);
+        std::vector<long_t> data(packed_length(indices.size(), bits));
+        pack_indices(indices, bits, data);
+        block_states.push_back(NBTTag(TAG_LONGARRAY, "data", data));
+    }
+
+    std::vector<NBTTag> biome_palette{string_tag("", "minecraft:plains"), string_tag("", "minecraft:forest")};
+    std::vector<uint16_t> biome_indices(64);
+    for (uint16_t& index : biome_indices)
+        index = (uint16_t)(rng() % 2);
+    std::vector<long_t> biome_data(packed_length(biome_indices.size(), 1));
+    pack_indices(biome_indices, 1, biome_data);
+
+    return compound("", {NBTTag(TAG_BYTE, "Y", (char)y), compound("block_states", std::move(block_states)),
+                         compound("biomes", {NBTTag(TAG_ARRAY, "palette", biome_palette), NBTTag(TAG_LONGARRAY, "data", biome_data)}),
+                         NBTTag(TAG_BYTEARRAY, "SkyLight", std::vector<byte_t>(2048, (byte_t)0xff))});
+}
+
+// A chunk in the 1.18+ layout: 24 sections, heightmaps, and some block entities.
+NBTTag chunk(std::mt19937& rng, int x, int z) {
+    std::vector<NBTTag> sections;
+    for (int y = -4; y < 20; ++y)
+        sections.push_back(section(rng, y));
+
+    std::vector<long_t> heightmap(37);
+    for (long_t& value : heightmap)
+        value = (long_t)(((std::uint64_t)rng() << 32) | rng());
+
+    std::vector<NBTTag> block_entities;
+    for (std::size_t i = 0, count = rng() % 24; i < count; ++i) {
+        block_entities.push_back(compound("", {string_tag("id", "minecraft:chest"), NBTTag(TAG_INT, "x", (int_t)(x * 16 + (int)(rng() % 16))),
+                                               NBTTag(TAG_INT, "y", (int_t)(rng() % 64)), NBTTag(TAG_INT, "z", (int_t)(z * 16 + (int)(rng() % 16))),
+                                               NBTTag(TAG_ARRAY, "Items", list_of({compound("", {NBTTag(TAG_BYTE, "Slot", (char)0), string_tag("id", "minecraft:torch"),
+                                                                                                NBTTag(TAG_BYTE, "Count", (char)(1 + rng() % 64))})}))}));
+    }
+
+    return compound("", {NBTTag(TAG_INT, "DataVersion", (int_t)3465), NBTTag(TAG_INT, "xPos", (int_t)x), NBTTag(TAG_INT, "yPos", (int_t)-4),
+                         NBTTag(TAG_INT, "zPos", (int_t)z), string_tag("Status", "minecraft:full"), NBTTag(TAG_LONG, "LastUpdate", (long_t)rng()),
+                         NBTTag(TAG_LONG, "InhabitedTime", (long_t)rng()), NBTTag(TAG_ARRAY, "sections", sections),
+                         compound("Heightmaps", {NBTTag(TAG_LONGARRAY, "MOTION_BLOCKING", heightmap), NBTTag(TAG_LONGARRAY, "WORLD_SURFACE", heightmap)}),
+                         NBTTag(TAG_ARRAY, "block_entities", block_entities), compound("structures", {compound("References", {}), compound("starts", {})})});
+}
+
+// A small level.dat, which is mostly scalars and short strings.
+NBTTag level_dat() {
+    std::vector<NBTTag> game_rules;
+    for (const char* rule : {"doDaylightCycle", "doMobSpawning", "keepInventory", "mobGriefing", "doFireTick", "randomTickSpeed", "spawnRadius"})
+        game_rules.push_back(string_tag(rule, "true"));
+    return compound("", {compound("Data", {
+        NBTTag(TAG_INT, "DataVersion", (int_t)3465), string_tag("LevelName", "Benchmark"), NBTTag(TAG_LONG, "Time", (long_t)123456789),
+        NBTTag(TAG_LONG, "DayTime", (long_t)6000), NBTTag(TAG_INT, "SpawnX", (int_t)0), NBTTag(TAG_INT, "SpawnY", (int_t)64), NBTTag(TAG_INT, "SpawnZ", (int_t)0),
+        NBTTag(TAG_FLOAT, "SpawnAngle", 0.0f), NBTTag(TAG_BYTE, "hardcore", (char)0), NBTTag(TAG_BYTE, "raining", (char)0), compound("GameRules", game_rules),
+        compound("Version", {NBTTag(TAG_INT, "Id", (int_t)3465), string_tag("Name", "1.20"), NBTTag(TAG_BYTE, "Snapshot", (char)0)}),
+        compound("WorldGenSettings", {NBTTag(TAG_LONG, "seed", (long_t)-4172144997902289642), NBTTag(TAG_BYTE, "generate_features", (char)1)}),
+        compound("Player", {NBTTag(TAG_ARRAY, "Pos", list_of({NBTTag(TAG_DOUBLE, "", 0.5), NBTTag(TAG_DOUBLE, "", 64.0), NBTTag(TAG_DOUBLE, "", 0.5)})),
+                            NBTTag(TAG_FLOAT, "Health", 20.0f), NBTTag(TAG_INT, "XpLevel", (int_t)30), NBTTag(TAG_ARRAY, "Inventory", std::vector<NBTTag>())})
+    })});
+}
+
+struct Timing {
+    double seconds;
+    std::uint64_t allocations;
+};
+
+// Runs `fn` `repetitions` times, counting the allocations made through `resource` while it does.
+template <typename Fn> Timing measure(int repetitions, stats::CountingResource& resource, Fn&& fn) {
+    std::uint64_t allocations = resource.allocations();
+    std::uint64_t start = internal::current_time_nanos();
+    for (int i = 0; i < repetitions; ++i)
+        fn();
+    return Timing{(double)(internal::current_time_nanos() - start) / 1e9, resource.allocations() - allocations};
+}
+
+void report(const char* stage, std::size_t bytes_per_run, std::size_t chunks_per_run, int repetitions, Timing timing) {
+    double megabytes = (double)bytes_per_run * repetitions / 1e6;
+    double per_chunk = chunks_per_run ? (double)timing.allocations / ((double)chunks_per_run * repetitions) : 0;
+    std::printf("%-24s %10.1f MB/s %12.1f allocs/chunk %10.3f s\n", stage, megabytes / timing.seconds, per_chunk, timing.seconds);
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::size_t chunk_count = argc > 1 ? (std::size_t)std::strtoul(argv[1], nullptr, 10) : 256;
+    int repetitions = argc > 2 ? std::atoi(argv[2]) : 5;
+    if (chunk_count == 0 || chunk_count > 1024 || repetitions <= 0) {
+        std::fprintf(stderr, "usage: %s [chunks (1-1024)] [repetitions]\n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937 rng(12345);
+    std::vector<NBTTag> chunks;
+    for (std::size_t i = 0; i < chunk_count; ++i)
+        chunks.push_back(chunk(rng, (int)(i % 32), (int)(i / 32)));
+    NBTTag level = level_dat();
+
+    stats::CountingResource counting;
+    NBTTag::allocator_type alloc(&counting);
+    std::vector<std::vector<byte_t>> encoded(chunk_count);
+    std::size_t total_bytes = 0;
+    for (std::size_t i = 0; i < chunk_count; ++i) {
+        encoded[i] = chunks[i].to_nbt();
+        total_bytes += encoded[i].size();
+    }
+
+    std::printf("%zu chunks (%.2f MB of NBT), %d repetitions, compression backend: %s\n\n", chunk_count, (double)total_bytes / 1e6, repetitions, codec::backend());
+
+    // serialising counts no allocations through `counting`, since the output buffers come from the default heap
+    report("serialize", total_bytes, chunk_count, repetitions, measure(repetitions, counting, [&]() {
+        for (std::size_t i = 0; i < chunk_count; ++i)
+            encoded[i] = chunks[i].to_nbt();
+    }));
+
+    std::vector<NBTTag> parsed(chunk_count);
+    report("parse", total_bytes, chunk_count, repetitions, measure(repetitions, counting, [&]() {
+        for (std::size_t i = 0; i < chunk_count; ++i)
+            parsed[i] = NBTTag::from_nbt(std::span<const byte_t>(encoded[i]), nullptr, alloc);
+    }));
+
+    report("parse (Bedrock network)", total_bytes, chunk_count, repetitions, [&]() {
+        std::vector<std::vector<byte_t>> network(chunk_count);
+        for (std::size_t i = 0; i < chunk_count; ++i)
+            network[i] = chunks[i].to_nbt(FORMAT_BEDROCK_NETWORK);
+        return measure(repetitions, counting, [&]() {
+            for (std::size_t i = 0; i < chunk_count; ++i)
+                parsed[i] = NBTTag::from_nbt(std::span<const byte_t>(network[i]), FORMAT_BEDROCK_NETWORK, nullptr, alloc);
+        });
+    }());
+
+    // the same lookups that loading a chunk into a level does
+    std::size_t found = 0;
+    report("lookup", total_bytes, chunk_count, repetitions, measure(repetitions, counting, [&]() {
+        for (const NBTTag& tag : parsed) {
+            const NBTTag& sections = tag.at("sections");
+            for (std::size_t s = 0; s < sections.size(); ++s) {
+                const NBTTag& block_states = sections[s].at("block_states");
+                found += block_states.at("palette").size();
+                if (block_states.contains("data"))
+                    found += block_states.at("data").span<long_t>().size();
+            }
+            found += (std::size_t)tag.at("xPos").get<int_t>();
+        }
+    }));
+
+    NBTPath path("sections[].block_states.palette");
+    report("path scan", total_bytes, chunk_count, repetitions, measure(repetitions, counting, [&]() {
+        for (std::size_t i = 0; i < chunk_count; ++i)
+            path.scan(std::span<const byte_t>(encoded[i]), [&](NBTTag&& match) { found += match.size(); }, alloc);
+    }));
+
+    std::vector<std::vector<unsigned char>> compressed(chunk_count);
+    std::size_t compressed_bytes = 0;
+    report("deflate (zlib)", total_bytes, chunk_count, repetitions, measure(repetitions, counting, [&]() {
+        compressed_bytes = 0;
+        for (std::size_t i = 0; i < chunk_count; ++i) {
+            compressed[i].clear();
+            codec::compress(ZLIB, encoded[i], compressed[i]);
+            compressed_bytes += compressed[i].size();
+        }
+    }));
+
+    report("inflate (zlib)", total_bytes, chunk_count, repetitions, measure(repetitions, counting, [&]() {
+        for (std::size_t i = 0; i < chunk_count; ++i)
+            found += codec::Decompressor::local().decompress(ZLIB, compressed[i]).size();
+    }));
+
+    std::vector<byte_t> level_bytes = level.to_nbt();
+    std::vector<unsigned char> level_gzip;
+    report("level.dat round trip", level_bytes.size(), 1, repetitions * 100, measure(repetitions * 100, counting, [&]() {
+        level_gzip.clear();
+        codec::compress(GZIP, level.to_nbt(), level_gzip);
+        std::span<const unsigned char> inflated = codec::Decompressor::local().decompress(GZIP, level_gzip);
+        found += NBTTag::from_nbt(std::span<const byte_t>(inflated.data(), inflated.size()), nullptr, alloc).type;
+    }));
+
+#if defined(NBT_BENCH_REGION)
+    std::array<NBTTag, 1024> region_tags;
+    for (std::size_t i = 0; i < 1024; ++i)
+        region_tags[i] = i < chunk_count ? chunks[i] : NBTTag(TAG_BYTE, "EmptyChunk", (char)0);
+    std::string region_path = (std::filesystem::temp_directory_path() / "nbtmodify-bench.r.0.0.mca").string();
+    report("region write", total_bytes, chunk_count, repetitions, measure(repetitions, counting, [&]() {
+        write_region_file(region_path, region_tags);
+    }));
+    report("region write (parallel)", total_bytes, chunk_count, repetitions, measure(repetitions, counting, [&]() {
+        write_region_file_parallel(region_path, region_tags);
+    }));
+    report("region read", total_bytes, chunk_count, repetitions, measure(repetitions, counting, [&]() {
+        found += read_region_file(region_path, alloc)[0].type;
+    }));
+    report("region read (parallel)", total_bytes, chunk_count, repetitions, measure(repetitions, counting, [&]() {
+        found += read_region_file_parallel(region_path, std::thread::hardware_concurrency(), alloc)[0].type;
+    }));
+    std::filesystem::remove(region_path);
+#else
+    std::printf("%-24s skipped (region.hpp needs mclevel; check out submodules/mclevel)\n", "region round trip");
+#endif
+
+    stats::Stats totals = stats::snapshot();
+    std::printf("\ncompression ratio %.2f, %llu allocations (%.1f MB) counted in total\n", (double)total_bytes / (double)compressed_bytes,
+                (unsigned long long)totals.allocations, (double)totals.allocated_bytes / 1e6);
+    // returned so that the work above can't be optimised away
+    return found == 0 ? 2 : 0;
+}
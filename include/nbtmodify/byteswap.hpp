@@ -0,0 +1,143 @@
+#ifndef BYTESWAP_HPP
+#define BYTESWAP_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NBT_BSWAP_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define NBT_BSWAP_NEON 1
+#endif
+
+// Bulk endianness conversion for int and long arrays.
+// Kernels are picked once, at runtime, from whatever the CPU supports (AVX2, then SSSE3 on x86; NEON on ARM),
+// with a scalar loop as the fallback and for the tail of every array.
+
+namespace nbt {
+namespace internal {
+
+using bswap_kernel = void (*)(unsigned char* dst, const unsigned char* src, std::size_t count);
+
+namespace kernels {
+
+void bswap32_scalar(unsigned char* dst, const unsigned char* src, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+        uint32_t val;
+        std::memcpy(&val, src + i * 4, 4);
+        val = __builtin_bswap32(val);
+        std::memcpy(dst + i * 4, &val, 4);
+    }
+}
+void bswap64_scalar(unsigned char* dst, const unsigned char* src, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+        uint64_t val;
+        std::memcpy(&val, src + i * 8, 8);
+        val = __builtin_bswap64(val);
+        std::memcpy(dst + i * 8, &val, 8);
+    }
+}
+
+#if defined(NBT_BSWAP_X86)
+
+__attribute__((target("ssse3"))) void bswap32_ssse3(unsigned char* dst, const unsigned char* src, std::size_t count) {
+    const __m128i shuffle = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i val = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        _mm_storeu_si128((__m128i*)(dst + i * 4), _mm_shuffle_epi8(val, shuffle));
+    }
+    bswap32_scalar(dst + i * 4, src + i * 4, count - i);
+}
+__attribute__((target("ssse3"))) void bswap64_ssse3(unsigned char* dst, const unsigned char* src, std::size_t count) {
+    const __m128i shuffle = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    std::size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128i val = _mm_loadu_si128((const __m128i*)(src + i * 8));
+        _mm_storeu_si128((__m128i*)(dst + i * 8), _mm_shuffle_epi8(val, shuffle));
+    }
+    bswap64_scalar(dst + i * 8, src + i * 8, count - i);
+}
+
+__attribute__((target("avx2"))) void bswap32_avx2(unsigned char* dst, const unsigned char* src, std::size_t count) {
+    // vpshufb shuffles within each 128-bit lane, so the pattern is repeated for both lanes
+    const __m256i shuffle = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i val = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+        _mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_shuffle_epi8(val, shuffle));
+    }
+    bswap32_scalar(dst + i * 4, src + i * 4, count - i);
+}
+__attribute__((target("avx2"))) void bswap64_avx2(unsigned char* dst, const unsigned char* src, std::size_t count) {
+    const __m256i shuffle = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+        7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i val = _mm256_loadu_si256((const __m256i*)(src + i * 8));
+        _mm256_storeu_si256((__m256i*)(dst + i * 8), _mm256_shuffle_epi8(val, shuffle));
+    }
+    bswap64_scalar(dst + i * 8, src + i * 8, count - i);
+}
+
+#elif defined(NBT_BSWAP_NEON)
+
+void bswap32_neon(unsigned char* dst, const unsigned char* src, std::size_t count) {
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        vst1q_u8(dst + i * 4, vrev32q_u8(vld1q_u8(src + i * 4)));
+    bswap32_scalar(dst + i * 4, src + i * 4, count - i);
+}
+void bswap64_neon(unsigned char* dst, const unsigned char* src, std::size_t count) {
+    std::size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+        vst1q_u8(dst + i * 8, vrev64q_u8(vld1q_u8(src + i * 8)));
+    bswap64_scalar(dst + i * 8, src + i * 8, count - i);
+}
+
+#endif
+
+bswap_kernel select_bswap32() {
+#if defined(NBT_BSWAP_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return bswap32_avx2;
+    if (__builtin_cpu_supports("ssse3")) return bswap32_ssse3;
+#elif defined(NBT_BSWAP_NEON)
+    return bswap32_neon;
+#endif
+    return bswap32_scalar;
+}
+bswap_kernel select_bswap64() {
+#if defined(NBT_BSWAP_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return bswap64_avx2;
+    if (__builtin_cpu_supports("ssse3")) return bswap64_ssse3;
+#elif defined(NBT_BSWAP_NEON)
+    return bswap64_neon;
+#endif
+    return bswap64_scalar;
+}
+
+}
+
+// Byte-swaps `count` 32-bit values from `src` into `dst`.
+// `dst` and `src` may be the same buffer, but must not otherwise overlap. Neither needs to be aligned.
+void bswap32_bulk(void* dst, const void* src, std::size_t count) {
+    static const bswap_kernel kernel = kernels::select_bswap32();
+    kernel((unsigned char*)dst, (const unsigned char*)src, count);
+}
+// Byte-swaps `count` 64-bit values from `src` into `dst`.
+// `dst` and `src` may be the same buffer, but must not otherwise overlap. Neither needs to be aligned.
+void bswap64_bulk(void* dst, const void* src, std::size_t count) {
+    static const bswap_kernel kernel = kernels::select_bswap64();
+    kernel((unsigned char*)dst, (const unsigned char*)src, count);
+}
+
+}
+}
+
+#endif
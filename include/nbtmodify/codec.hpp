@@ -0,0 +1,460 @@
+#ifndef CODEC_HPP
+#define CODEC_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <stdexcept>
+#include <vector>
+
+#include "stats.hpp"
+
+// Whole-buffer compression and decompression for every scheme that NBT data is stored with.
+//
+// Gzip and zlib use zlib by default. Define one of these before including the library to use a faster backend instead
+// (each needs its library to be linked):
+//   NBT_USE_LIBDEFLATE  libdeflate (-ldeflate), which is roughly 2-3x faster on chunk-sized buffers
+//   NBT_USE_ZLIB_NG     zlib-ng's native API (-lz-ng). zlib-ng's zlib-compatible build needs no define, just link it in place of zlib.
+// LZ4 (used by newer servers for chunks) is only available with NBT_USE_LZ4 defined (-llz4).
+
+#if defined(NBT_USE_LIBDEFLATE)
+#include <libdeflate.h>
+#elif defined(NBT_USE_ZLIB_NG)
+#include <zlib-ng.h>
+#define NBT_ZLIB(name) zng_##name
+#else
+#include <zlib.h>
+#define NBT_ZLIB(name) name
+#endif
+
+#if defined(NBT_USE_LZ4)
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+namespace nbt {
+
+/// @brief A compression scheme. The values are those used for chunks in region files.
+enum CompressionScheme {
+    GZIP = 1,
+    ZLIB = 2,
+    NOTHING = 3,
+    LZ4 = 4,
+    CUSTOM = 127,
+};
+
+namespace codec {
+
+/// @brief The compression level that picks each backend's own default.
+constexpr int default_level = -1;
+
+namespace internal {
+
+[[noreturn]] void unsupported(CompressionScheme scheme) {
+    if (scheme == LZ4)
+        throw std::runtime_error("Tried to use LZ4 compression, but the library was built without it (define NBT_USE_LZ4 and link liblz4)");
+    throw std::runtime_error("Unsupported compression type with ordinal " + std::to_string(scheme));
+}
+
+// Decompressors write into `buffer` from `start` onwards, treating its size as their capacity,
+// and return how much they wrote. They may grow the buffer, but never shrink it.
+
+// NBT usually compresses to somewhere around a quarter of its size
+std::size_t guess_output_size(std::size_t compressed_size) {
+    return std::max<std::size_t>(compressed_size * 4, 4096);
+}
+// makes sure that `buffer` reaches at least up to `end`, at least doubling the space after `start` when it has to grow
+void reserve_output(std::vector<unsigned char>& buffer, std::size_t start, std::size_t end) {
+    if (buffer.size() < end)
+        buffer.resize(std::max(end, start + (buffer.size() - start) * 2));
+}
+
+#if !defined(NBT_USE_LIBDEFLATE)
+
+#if defined(NBT_USE_ZLIB_NG)
+using z_stream_type = zng_stream;
+#else
+using z_stream_type = z_stream;
+#endif
+
+// window bits that select the gzip or zlib wrapper
+constexpr int window_bits(CompressionScheme scheme) {
+    return scheme == GZIP ? 15 + 16 : 15;
+}
+
+void zlib_compress(CompressionScheme scheme, std::span<const unsigned char> data, std::vector<unsigned char>& out, int level) {
+    z_stream_type stream{};
+    if (NBT_ZLIB(deflateInit2)(&stream, level < 0 ? Z_DEFAULT_COMPRESSION : level, Z_DEFLATED, window_bits(scheme), 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("Tried to compress data, but the compressor could not be initialised");
+    std::size_t start = out.size();
+    out.resize(start + NBT_ZLIB(deflateBound)(&stream, data.size()));
+    stream.next_in = (unsigned char*)data.data();
+    stream.avail_in = data.size();
+    stream.next_out = out.data() + start;
+    stream.avail_out = out.size() - start;
+    // the output buffer is big enough for the whole stream, so this finishes in one call
+    int result = NBT_ZLIB(deflate)(&stream, Z_FINISH);
+    out.resize(start + stream.total_out);
+    NBT_ZLIB(deflateEnd)(&stream);
+    if (result != Z_STREAM_END)
+        throw std::runtime_error("Tried to compress data, but compression failed (zlib error " + std::to_string(result) + ")");
+}
+
+// `stream` must have been freshly initialised or reset
+std::size_t zlib_decompress(z_stream_type& stream, std::span<const unsigned char> data, std::vector<unsigned char>& buffer, std::size_t start) {
+    reserve_output(buffer, start, start + guess_output_size(data.size()));
+    stream.next_in = (unsigned char*)data.data();
+    stream.avail_in = data.size();
+    int result;
+    for (;;) {
+        stream.next_out = buffer.data() + start + stream.total_out;
+        stream.avail_out = buffer.size() - start - stream.total_out;
+        result = NBT_ZLIB(inflate)(&stream, Z_NO_FLUSH);
+        if (result == Z_STREAM_END || (result != Z_OK && result != Z_BUF_ERROR)) break;
+        if (stream.avail_out > 0) {
+            // out of input before the end of the stream
+            result = Z_DATA_ERROR;
+            break;
+        }
+        reserve_output(buffer, start, buffer.size() + 1);
+    }
+    if (result != Z_STREAM_END)
+        throw std::runtime_error("Tried to decompress data, but it is corrupt or truncated (zlib error " + std::to_string(result) + ")");
+    return stream.total_out;
+}
+
+#else
+
+void libdeflate_compress(CompressionScheme scheme, std::span<const unsigned char> data, std::vector<unsigned char>& out, int level) {
+    libdeflate_compressor* compressor = libdeflate_alloc_compressor(level < 0 ? 6 : level);
+    if (!compressor)
+        throw std::runtime_error("Tried to compress data at level " + std::to_string(level) + ", but libdeflate does not support it");
+    std::size_t start = out.size(), written;
+    if (scheme == GZIP) {
+        out.resize(start + libdeflate_gzip_compress_bound(compressor, data.size()));
+        written = libdeflate_gzip_compress(compressor, data.data(), data.size(), out.data() + start, out.size() - start);
+    } else {
+        out.resize(start + libdeflate_zlib_compress_bound(compressor, data.size()));
+        written = libdeflate_zlib_compress(compressor, data.data(), data.size(), out.data() + start, out.size() - start);
+    }
+    libdeflate_free_compressor(compressor);
+    if (written == 0)
+        throw std::runtime_error("Tried to compress data, but compression failed");
+    out.resize(start + written);
+}
+
+std::size_t libdeflate_decompress(libdeflate_decompressor* decompressor, CompressionScheme scheme, std::span<const unsigned char> data, std::vector<unsigned char>& buffer, std::size_t start) {
+    std::size_t expected = guess_output_size(data.size());
+    // gzip records the (32-bit truncated) uncompressed size in its trailer
+    if (scheme == GZIP && data.size() >= 18) {
+        uint32_t size = data[data.size() - 4] | data[data.size() - 3] << 8 | data[data.size() - 2] << 16 | (uint32_t)data[data.size() - 1] << 24;
+        expected = std::max<std::size_t>(size, 1);
+    }
+    reserve_output(buffer, start, start + expected);
+    libdeflate_result result;
+    std::size_t written = 0;
+    for (;;) {
+        result = scheme == GZIP
+            ? libdeflate_gzip_decompress(decompressor, data.data(), data.size(), buffer.data() + start, buffer.size() - start, &written)
+            : libdeflate_zlib_decompress(decompressor, data.data(), data.size(), buffer.data() + start, buffer.size() - start, &written);
+        if (result != LIBDEFLATE_INSUFFICIENT_SPACE) break;
+        reserve_output(buffer, start, buffer.size() + 1);
+    }
+    if (result != LIBDEFLATE_SUCCESS)
+        throw std::runtime_error("Tried to decompress data, but it is corrupt or truncated (libdeflate error " + std::to_string(result) + ")");
+    return written;
+}
+
+#endif
+
+#if defined(NBT_USE_LZ4)
+
+// LZ4 chunks are stored in lz4-java's block stream format (what `LZ4BlockOutputStream` writes):
+// a series of blocks of up to 64 KiB, each with a 21-byte header, ending with an empty block.
+constexpr unsigned char lz4_magic[8] = {'L', 'Z', '4', 'B', 'l', 'o', 'c', 'k'};
+constexpr std::size_t lz4_header_size = 21;
+constexpr std::size_t lz4_block_size = 1 << 16;
+constexpr unsigned char lz4_method_raw = 0x10, lz4_method_lz4 = 0x20;
+// log2 of the block size, less 10
+constexpr unsigned char lz4_level_bits = 6;
+constexpr uint32_t lz4_checksum_seed = 0x9747b28c;
+
+uint32_t read_le32(const unsigned char* bytes) {
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+void write_le32(unsigned char* bytes, uint32_t value) {
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+    bytes[2] = value >> 16;
+    bytes[3] = value >> 24;
+}
+
+// XXH32, which lz4-java checksums each block with
+uint32_t xxhash32(const unsigned char* data, std::size_t size, uint32_t seed) {
+    constexpr uint32_t prime1 = 2654435761u, prime2 = 2246822519u, prime3 = 3266489917u, prime4 = 668265263u, prime5 = 374761393u;
+    auto rotl = [](uint32_t x, int r) { return (x << r) | (x >> (32 - r)); };
+    const unsigned char* end = data + size;
+    uint32_t hash;
+    if (size >= 16) {
+        uint32_t v1 = seed + prime1 + prime2, v2 = seed + prime2, v3 = seed, v4 = seed - prime1;
+        for (; data + 16 <= end; data += 16) {
+            v1 = rotl(v1 + read_le32(data) * prime2, 13) * prime1;
+            v2 = rotl(v2 + read_le32(data + 4) * prime2, 13) * prime1;
+            v3 = rotl(v3 + read_le32(data + 8) * prime2, 13) * prime1;
+            v4 = rotl(v4 + read_le32(data + 12) * prime2, 13) * prime1;
+        }
+        hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    } else {
+        hash = seed + prime5;
+    }
+    hash += (uint32_t)size;
+    for (; data + 4 <= end; data += 4)
+        hash = rotl(hash + read_le32(data) * prime3, 17) * prime4;
+    for (; data < end; ++data)
+        hash = rotl(hash + *data * prime5, 11) * prime1;
+    hash ^= hash >> 15;
+    hash *= prime2;
+    hash ^= hash >> 13;
+    hash *= prime3;
+    hash ^= hash >> 16;
+    return hash;
+}
+// lz4-java only keeps the low 28 bits of the hash
+uint32_t lz4_checksum(const unsigned char* data, std::size_t size) {
+    return xxhash32(data, size, lz4_checksum_seed) & 0x0fffffff;
+}
+
+void lz4_compress(std::span<const unsigned char> data, std::vector<unsigned char>& out, int level) {
+    auto write_header = [&out](unsigned char method, uint32_t compressed, uint32_t original, uint32_t checksum) {
+        std::size_t at = out.size();
+        out.resize(at + lz4_header_size);
+        std::memcpy(out.data() + at, lz4_magic, 8);
+        out[at + 8] = method | lz4_level_bits;
+        write_le32(out.data() + at + 9, compressed);
+        write_le32(out.data() + at + 13, original);
+        write_le32(out.data() + at + 17, checksum);
+    };
+    for (std::size_t pos = 0; pos < data.size(); pos += lz4_block_size) {
+        int size = (int)std::min(lz4_block_size, data.size() - pos);
+        const char* block = (const char*)data.data() + pos;
+        std::size_t header_at = out.size();
+        write_header(lz4_method_lz4, 0, size, lz4_checksum(data.data() + pos, size));
+        out.resize(header_at + lz4_header_size + LZ4_compressBound(size));
+        char* dst = (char*)out.data() + header_at + lz4_header_size;
+        int compressed = level >= 3
+            ? LZ4_compress_HC(block, dst, size, LZ4_compressBound(size), std::min(level, 12))
+            : LZ4_compress_default(block, dst, size, LZ4_compressBound(size));
+        if (compressed <= 0 || compressed >= size) {
+            // incompressible, so store it as it is
+            out[header_at + 8] = lz4_method_raw | lz4_level_bits;
+            std::memcpy(dst, block, size);
+            compressed = size;
+        }
+        write_le32(out.data() + header_at + 9, compressed);
+        out.resize(header_at + lz4_header_size + compressed);
+    }
+    write_header(lz4_method_raw, 0, 0, 0);
+}
+
+std::size_t lz4_decompress(std::span<const unsigned char> data, std::vector<unsigned char>& buffer, std::size_t start) {
+    std::size_t pos = 0, at = start;
+    while (pos + lz4_header_size <= data.size()) {
+        const unsigned char* header = data.data() + pos;
+        if (std::memcmp(header, lz4_magic, 8) != 0)
+            throw std::runtime_error("Tried to decompress LZ4 data, but a block at offset " + std::to_string(pos) + " has the wrong magic number");
+        unsigned char method = header[8] & 0xf0;
+        uint32_t compressed = read_le32(header + 9), original = read_le32(header + 13), checksum = read_le32(header + 17);
+        pos += lz4_header_size;
+        if (original == 0) return at - start;
+        if (compressed > data.size() - pos || original > lz4_block_size)
+            throw std::runtime_error("Tried to decompress LZ4 data, but the block at offset " + std::to_string(pos - lz4_header_size) + " is corrupt or truncated");
+        reserve_output(buffer, start, at + original);
+        if (method == lz4_method_raw && compressed == original) {
+            std::memcpy(buffer.data() + at, data.data() + pos, original);
+        } else if (method != lz4_method_lz4 || LZ4_decompress_safe((const char*)data.data() + pos, (char*)buffer.data() + at, compressed, original) != (int)original) {
+            throw std::runtime_error("Tried to decompress LZ4 data, but the block at offset " + std::to_string(pos - lz4_header_size) + " is corrupt");
+        }
+        if (lz4_checksum(buffer.data() + at, original) != checksum)
+            throw std::runtime_error("Tried to decompress LZ4 data, but the block at offset " + std::to_string(pos - lz4_header_size) + " fails its checksum");
+        pos += compressed;
+        at += original;
+    }
+    // lz4-java also stops at the end of the input if the closing block is missing
+    if (pos != data.size())
+        throw std::runtime_error("Tried to decompress LZ4 data, but it ends partway through a block header");
+    return at - start;
+}
+
+#endif
+
+}
+
+/// @brief Gets the name of the backend used for gzip and zlib.
+/// @return `"libdeflate"`, `"zlib-ng"` or `"zlib"`.
+const char* backend() {
+#if defined(NBT_USE_LIBDEFLATE)
+    return "libdeflate";
+#elif defined(NBT_USE_ZLIB_NG)
+    return "zlib-ng";
+#else
+    return "zlib";
+#endif
+}
+
+/// @brief Compresses a buffer.
+/// @param scheme The compression scheme to use. `CUSTOM` is not supported, and `LZ4` needs `NBT_USE_LZ4`.
+/// @param data The uncompressed data.
+/// @param out The buffer to append the compressed data to.
+/// @param level The compression level. Gzip and zlib go from 0 (store) to 9 (zlib) or 12 (libdeflate), and LZ4 switches to its high-compression mode from 3 up.
+/// Defaults to each backend's own default.
+/// @exception Throws if the scheme is unsupported or compression fails.
+void compress(CompressionScheme scheme, std::span<const unsigned char> data, std::vector<unsigned char>& out, int level = default_level) {
+    nbt::internal::PhaseTimer timer(stats::PHASE_DEFLATE, data.size());
+    std::size_t start = out.size();
+    switch (scheme) {
+    case GZIP:
+    case ZLIB:
+#if defined(NBT_USE_LIBDEFLATE)
+        internal::libdeflate_compress(scheme, data, out, level);
+#else
+        internal::zlib_compress(scheme, data, out, level);
+#endif
+        break;
+    case NOTHING:
+        out.insert(out.end(), data.begin(), data.end());
+        break;
+#if defined(NBT_USE_LZ4)
+    case LZ4:
+        internal::lz4_compress(data, out, level);
+        break;
+#endif
+    default:
+        internal::unsupported(scheme);
+    }
+    timer.bytes_out = out.size() - start;
+}
+
+/// @brief Reusable state for decompressing many buffers in a row, such as the chunks of a region file.
+/// The backend's decompressor (zlib's inflate state, or libdeflate's decompressor) is reset between buffers rather than reallocated,
+/// and data is decompressed into a buffer that only ever grows, so that once the largest chunk has been seen, decompressing allocates nothing.
+/// @note A decompressor must only be used on one thread at a time. `local()` gives every thread its own.
+class Decompressor {
+public:
+    Decompressor() = default;
+    // the inflate state points back at its stream, so a decompressor cannot be moved either
+    Decompressor(const Decompressor&) = delete;
+    Decompressor& operator=(const Decompressor&) = delete;
+    ~Decompressor();
+
+    /// @brief Decompresses a buffer into this decompressor's own buffer.
+    /// @param scheme The compression scheme the data was compressed with. `CUSTOM` is not supported, and `LZ4` needs `NBT_USE_LZ4`.
+    /// @param data The compressed data. Must hold exactly one compressed stream (anything after a gzip or zlib stream is ignored).
+    /// @return The decompressed data. It is only valid until this decompressor is next used.
+    /// @exception Throws if the scheme is unsupported, or if the data is corrupt or truncated.
+    std::span<const unsigned char> decompress(CompressionScheme scheme, std::span<const unsigned char> data);
+    /// @brief Decompresses a buffer, appending the decompressed data to `out`.
+    /// @param scheme The compression scheme the data was compressed with. See the other overload.
+    /// @param data The compressed data. See the other overload.
+    /// @param out The buffer to append the decompressed data to.
+    /// @exception Throws if the scheme is unsupported, or if the data is corrupt or truncated. `out` is left as it was.
+    void decompress(CompressionScheme scheme, std::span<const unsigned char> data, std::vector<unsigned char>& out);
+
+    /// @brief Gets the calling thread's decompressor. It lives (and keeps its buffer) until the thread exits.
+    static Decompressor& local();
+
+private:
+    // decompresses into `output` from `start` onwards, and returns the decompressed size
+    std::size_t run(CompressionScheme scheme, std::span<const unsigned char> data, std::vector<unsigned char>& output, std::size_t start);
+
+#if defined(NBT_USE_LIBDEFLATE)
+    libdeflate_decompressor* state = nullptr;
+#else
+    internal::z_stream_type stream{};
+    bool stream_initialised = false;
+#endif
+    std::vector<unsigned char> buffer;
+};
+
+Decompressor::~Decompressor() {
+#if defined(NBT_USE_LIBDEFLATE)
+    if (this->state)
+        libdeflate_free_decompressor(this->state);
+#else
+    if (this->stream_initialised)
+        NBT_ZLIB(inflateEnd)(&this->stream);
+#endif
+}
+
+std::span<const unsigned char> Decompressor::decompress(CompressionScheme scheme, std::span<const unsigned char> data) {
+    nbt::internal::PhaseTimer timer(stats::PHASE_INFLATE, data.size());
+    std::size_t size = this->run(scheme, data, this->buffer, 0);
+    timer.bytes_out = size;
+    return std::span<const unsigned char>(this->buffer.data(), size);
+}
+
+void Decompressor::decompress(CompressionScheme scheme, std::span<const unsigned char> data, std::vector<unsigned char>& out) {
+    nbt::internal::PhaseTimer timer(stats::PHASE_INFLATE, data.size());
+    std::size_t start = out.size();
+    try {
+        timer.bytes_out = this->run(scheme, data, out, start);
+        out.resize(start + timer.bytes_out);
+    } catch (...) {
+        out.resize(start);
+        throw;
+    }
+}
+
+Decompressor& Decompressor::local() {
+    thread_local Decompressor decompressor;
+    return decompressor;
+}
+
+std::size_t Decompressor::run(CompressionScheme scheme, std::span<const unsigned char> data, std::vector<unsigned char>& output, std::size_t start) {
+    switch (scheme) {
+    case GZIP:
+    case ZLIB:
+#if defined(NBT_USE_LIBDEFLATE)
+        if (!this->state && !(this->state = libdeflate_alloc_decompressor()))
+            throw std::runtime_error("Tried to decompress data, but the decompressor could not be allocated");
+        return internal::libdeflate_decompress(this->state, scheme, data, output, start);
+#else
+        // gzip and zlib use the same window size, so switching between them doesn't reallocate the window either
+        if (!this->stream_initialised) {
+            if (NBT_ZLIB(inflateInit2)(&this->stream, internal::window_bits(scheme)) != Z_OK)
+                throw std::runtime_error("Tried to decompress data, but the decompressor could not be initialised");
+            this->stream_initialised = true;
+        } else if (NBT_ZLIB(inflateReset2)(&this->stream, internal::window_bits(scheme)) != Z_OK) {
+            throw std::runtime_error("Tried to decompress data, but the decompressor could not be reset");
+        }
+        return internal::zlib_decompress(this->stream, data, output, start);
+#endif
+    case NOTHING:
+        internal::reserve_output(output, start, start + data.size());
+        if (!data.empty())
+            std::memcpy(output.data() + start, data.data(), data.size());
+        return data.size();
+#if defined(NBT_USE_LZ4)
+    case LZ4:
+        return internal::lz4_decompress(data, output, start);
+#endif
+    default:
+        internal::unsupported(scheme);
+    }
+}
+
+/// @brief Decompresses a buffer, using the calling thread's `Decompressor`.
+/// @param scheme The compression scheme the data was compressed with. `CUSTOM` is not supported, and `LZ4` needs `NBT_USE_LZ4`.
+/// @param data The compressed data. Must hold exactly one compressed stream (anything after a gzip or zlib stream is ignored).
+/// @param out The buffer to append the decompressed data to.
+/// @exception Throws if the scheme is unsupported, or if the data is corrupt or truncated.
+void decompress(CompressionScheme scheme, std::span<const unsigned char> data, std::vector<unsigned char>& out) {
+    Decompressor::local().decompress(scheme, data, out);
+}
+
+}
+}
+
+#endif
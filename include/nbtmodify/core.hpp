@@ -12,50 +12,68 @@
 #include <variant>
 #include <bitset>
 #include <optional>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <climits>
+#include <bit>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <concepts>
+#include <type_traits>
+#include <memory_resource>
+#include <algorithm>
 
-#include <boost/iostreams/filtering_streambuf.hpp>
-#include <boost/iostreams/copy.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
-#include <boost/iostreams/filter/zlib.hpp>
+#include "byteswap.hpp"
+#include "codec.hpp"
+#include "symbols.hpp"
 
 /// TODO: convert all `std::runtime_error`s into a custom argument type (maybe `nbt::runtime_error`?)
 
 namespace nbt {
 
 struct NBTTag;
+class Compound;
 
 // If these types won't compile on your machine (for some reason),
 // replace intX_t with int_fastX_t.
 typedef unsigned char byte_t;
-typedef int8_t short_t;
+typedef int16_t short_t;
 typedef uint16_t ushort_t;
 typedef int32_t int_t;
 typedef uint32_t uint_t;
 typedef int64_t long_t;
 typedef uint64_t ulong_t;
 
+// Containers that tag values are stored in.
+// They allocate through a `std::pmr::memory_resource`, so that a whole tree can be parsed into (and freed with) a single arena.
+using string_t = std::pmr::string;
+template <typename T> using array_t = std::pmr::vector<T>;
+
 namespace internal {
 
-// See https://stackoverflow.com/questions/2100331/macro-definition-to-determine-big-endian-or-little-endian-machine.
 #if CHAR_BIT != 8
 #error "unsupported char size"
 #endif
 
-enum {
-    O32_LITTLE_ENDIAN = 0x03020100ul,
-    O32_BIG_ENDIAN = 0x00010203ul,
-    O32_PDP_ENDIAN = 0x01000302ul,      /* DEC PDP-11 (aka ENDIAN_LITTLE_WORD) */
-    O32_HONEYWELL_ENDIAN = 0x02030001ul /* Honeywell 316 (aka ENDIAN_BIG_WORD) */
-};
-
-static constexpr union { unsigned char bytes[4]; uint32_t value; } o32_host_order =
-    { { 0, 1, 2, 3 } };
+static_assert(std::endian::native == std::endian::little || std::endian::native == std::endian::big, "mixed-endian platforms are not supported");
 
-/// TODO: make an `is_little_endian` function
-#define O32_HOST_ORDER o32_host_order.value
+// Known at compile time, so every branch on it is resolved with `if constexpr` and costs nothing at runtime.
+constexpr bool is_little_endian() {
+    return std::endian::native == std::endian::little;
+}
 
-bool is_little_endian() {
-    return is_little_endian();
+// Converts a single integer between host order and `order` (the conversion is its own inverse).
+template <std::endian order, typename T> T reorder(T val) {
+    if constexpr (sizeof(T) == 1 || order == std::endian::native)
+        return val;
+    else if constexpr (sizeof(T) == 2)
+        return (T)__builtin_bswap16((uint16_t)val);
+    else if constexpr (sizeof(T) == 4)
+        return (T)__builtin_bswap32((uint32_t)val);
+    else
+        return (T)__builtin_bswap64((uint64_t)val);
 }
 
 auto current_time_millis() {return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());}
@@ -68,6 +86,23 @@ template <typename T> void print_bytes(std::vector<T> data) {
 
 }
 
+/// @brief Thrown when NBT data is malformed.
+struct parse_error : public std::runtime_error {
+    /// @brief The offset (in bytes from the start of the input) at which the problem was found.
+    std::size_t offset;
+
+    parse_error(const std::string& what, std::size_t offset) : std::runtime_error(what), offset(offset) {}
+};
+
+/// @brief Thrown when NBT data ends before the tag being read does.
+struct truncated_error : public parse_error {
+    using parse_error::parse_error;
+};
+
+/// @brief How deeply compounds and lists may be nested in NBT data, as in Minecraft.
+/// Every parser throws `nbt::parse_error` on data nested deeper than this, rather than recursing until the stack overflows.
+constexpr std::size_t max_nbt_depth = 512;
+
 enum Tag {
     TAG_END = '\x00',
     TAG_BYTE = '\x01',
@@ -102,6 +137,17 @@ static std::string get_tag_type(Tag type) {
     }
 }
 
+/// @brief A binary encoding of NBT data.
+/// Every format lays tags out the same way, and differs only in how numbers (and the lengths of strings, lists and arrays) are written.
+enum NbtFormat {
+    /// @brief Java Edition's format, used in its files and its protocol: big-endian, with fixed-width numbers.
+    FORMAT_JAVA,
+    /// @brief Bedrock Edition's disk format, used in `level.dat` and the values of its world database: Java's layout, but little-endian.
+    FORMAT_BEDROCK,
+    /// @brief Bedrock Edition's network format: little-endian, with ints, longs and lengths written as (zigzag) varints.
+    FORMAT_BEDROCK_NETWORK,
+};
+
 namespace internal {
 
 union Number {
@@ -118,15 +164,15 @@ Number unpack(const byte_t bytes[], Tag code) {
     if (code == TAG_BYTE) {
         return {.b=(char)bytes[0]};
     } else if (code == TAG_SHORT) {
-        if (!is_little_endian())
+        if constexpr (!is_little_endian())
             return {.s=*((short_t*)bytes)};
         return {.s=(short_t)((short_t)bytes[0] << 8 | bytes[1])};
     } else if (code == TAG_INT) {
-        if (!is_little_endian())
+        if constexpr (!is_little_endian())
             return {.i=*((int_t*)bytes)};
         return {.i=(int_t)((int_t)bytes[0] << 24 | (int_t)bytes[1] << 16 | (int_t)bytes[2] << 8 | bytes[3])};
     } else if (code == TAG_LONG) {
-        if (!is_little_endian())
+        if constexpr (!is_little_endian())
             return {.l=*((long_t*)bytes)};
         return {.l=(long_t)((long_t)bytes[0] << 56 | (long_t)bytes[1] << 48 | (long_t)bytes[2] << 40 | (long_t)bytes[3] << 32 | (long_t)bytes[4] << 24 | (long_t)bytes[5] << 16 | (long_t)bytes[6] << 8 | (long_t)bytes[7])};
     } else if (code == TAG_FLOAT) {
@@ -149,26 +195,26 @@ Number read(std::istream& bytes, Tag code) {
         bytes.read(&ret.b, 1);
     } else if (code == TAG_SHORT) {
         bytes.read((char*)&ret.s, 2);
-        if (is_little_endian())
+        if constexpr (is_little_endian())
             ret.s = __builtin_bswap16(ret.s);
     } else if (code == TAG_INT) {
         bytes.read((char*)&ret.i, 4);
-        if (is_little_endian())
+        if constexpr (is_little_endian())
             ret.i = __builtin_bswap32(ret.i);
     } else if (code == TAG_LONG) {
         bytes.read((char*)&ret.l, 8);
-        if (is_little_endian())
+        if constexpr (is_little_endian())
             ret.l = __builtin_bswap64(ret.l);
     } else if (code == TAG_FLOAT) {
         bytes.read((char*)&ret.f, 4);
-        if (is_little_endian())
+        if constexpr (is_little_endian())
             // operate on ret.i instead of ret.f because both have the same number of bits
             // and __builtin_bswap doesn't work on floats
             ret.i = __builtin_bswap32(ret.i);
     } else if (code == TAG_DOUBLE) {
         bytes.read((char*)&ret.d, 8);
-        if (is_little_endian())
-            ret.l == __builtin_bswap64(ret.l);
+        if constexpr (is_little_endian())
+            ret.l = __builtin_bswap64(ret.l);
     } else throw;
     return ret;
 }
@@ -178,26 +224,26 @@ void writeb(std::ostream& bytes, char num) {
 }
 // write short
 void writes(std::ostream& bytes, short_t num) {
-    if (is_little_endian())
+    if constexpr (is_little_endian())
         num = __builtin_bswap16(num);
     bytes.write((char*)&num, 2);
 }
 // write int
 void writei(std::ostream& bytes, int_t num) {
-    if (is_little_endian())
+    if constexpr (is_little_endian())
         num = __builtin_bswap32(num);
     bytes.write((char*)&num, 4);
 }
 // write long
 void writel(std::ostream& bytes, long_t num) {
-    if (is_little_endian())
+    if constexpr (is_little_endian())
         num = __builtin_bswap64(num);
     bytes.write((char*)&num, 8);
 }
 // write float
 void writef(std::ostream& bytes, float num) {
     uint_t num_bytes;
-    if (is_little_endian())
+    if constexpr (is_little_endian())
         num_bytes = __builtin_bswap32(std::bit_cast<uint_t>(num));
     else
         num_bytes = std::bit_cast<uint_t>(num);
@@ -206,14 +252,14 @@ void writef(std::ostream& bytes, float num) {
 // write double
 void writed(std::ostream& bytes, double num) {
     ulong_t num_bytes;
-    if (is_little_endian())
+    if constexpr (is_little_endian())
         num_bytes = __builtin_bswap64(std::bit_cast<ulong_t>(num));
     else
         num_bytes = std::bit_cast<ulong_t>(num);
     bytes.write((char*)&num_bytes, 8);
 }
 // write string
-void writestr(std::ostream& bytes, const std::string& string) {
+void writestr(std::ostream& bytes, std::string_view string) {
     short_t name_length = string.size();
     writes(bytes, name_length);
     /// TODO: does this output any potential null termination characters (\0)?
@@ -221,22 +267,427 @@ void writestr(std::ostream& bytes, const std::string& string) {
     bytes << string;
 }
 
+// Converts `count` integers of type T at `src`, stored in byte order `order`, to host order, storing them at `dst`.
+template <std::endian order, typename T> void load_ordered(T* dst, const void* src, std::size_t count) {
+    if constexpr (sizeof(T) == 1 || order == std::endian::native) {
+        std::memcpy(dst, src, count * sizeof(T));
+    } else if constexpr (sizeof(T) == 2) {
+        // only ever used for single shorts, so not worth a kernel
+        for (std::size_t i = 0; i < count; ++i) {
+            uint16_t val;
+            std::memcpy(&val, (const byte_t*)src + i * 2, 2);
+            val = __builtin_bswap16(val);
+            std::memcpy(dst + i, &val, 2);
+        }
+    } else if constexpr (sizeof(T) == 4) {
+        bswap32_bulk(dst, src, count);
+    } else if constexpr (sizeof(T) == 8) {
+        bswap64_bulk(dst, src, count);
+    }
+}
+// Converts `count` integers of type T at `src` to byte order `order`, storing them at `dst`.
+template <std::endian order, typename T> void store_ordered(void* dst, const T* src, std::size_t count) {
+    // byte swapping is its own inverse
+    load_ordered<order>((T*)dst, src, count);
+}
+// Converts `count` big-endian integers of type T at `src` to host order, storing them at `dst`.
+template <typename T> void load_big_endian(T* dst, const void* src, std::size_t count) {
+    load_ordered<std::endian::big>(dst, src, count);
+}
+// Converts `count` integers of type T at `src` to big-endian order, storing them at `dst`.
+template <typename T> void store_big_endian(void* dst, const T* src, std::size_t count) {
+    store_ordered<std::endian::big>(dst, src, count);
+}
+// write the elements of an int or long array
+template <typename T> void write_array(std::ostream& bytes, std::span<const T> values) {
+    if constexpr (!is_little_endian()) {
+        bytes.write((const char*)values.data(), values.size() * sizeof(T));
+        return;
+    }
+    // convert through a fixed buffer (big enough for any chunk's block state data in one go) rather than copying the whole array
+    constexpr std::size_t buffer_count = 1024;
+    T buffer[buffer_count];
+    for (std::size_t i = 0; i < values.size(); i += buffer_count) {
+        std::size_t count = std::min(buffer_count, values.size() - i);
+        store_big_endian(buffer, values.data() + i, count);
+        bytes.write((const char*)buffer, count * sizeof(T));
+    }
+}
+
 std::string read_string(std::istream& bytes) {
-    std::string ret;
-    short_t len = internal::read(bytes, TAG_SHORT).s;
-    for (short_t i = 0; i < len; ++i)
-        ret.append("\0");
+    ushort_t len = internal::read(bytes, TAG_SHORT).s;
+    std::string ret(len, '\0');
     bytes.read(ret.data(), len);
     return ret;
 }
 
-constexpr ulong_t get_mask(int byte_level) {
-    return 255UL * (ulong_t)(pow(2, byte_level * 8));
+// How a format writes its numbers.
+template <NbtFormat F> struct format_traits {
+    // the byte order of fixed-width numbers (shorts, floats and doubles always, and ints and longs unless they're varints)
+    static constexpr std::endian order = F == FORMAT_JAVA ? std::endian::big : std::endian::little;
+    // whether ints, longs and the lengths of strings, lists and arrays are varints rather than fixed-width
+    static constexpr bool varints = F == FORMAT_BEDROCK_NETWORK;
+};
+
+// Maps signed integers to unsigned ones so that small negative values get short varints too (0, -1, 1, -2... become 0, 1, 2, 3...).
+template <typename T> std::make_unsigned_t<T> zigzag_encode(T val) {
+    using U = std::make_unsigned_t<T>;
+    return ((U)val << 1) ^ (U)(val >> (sizeof(T) * 8 - 1));
+}
+template <typename T> T zigzag_decode(std::make_unsigned_t<T> val) {
+    using U = std::make_unsigned_t<T>;
+    return (T)((val >> 1) ^ (U)-(U)(val & 1));
+}
+
+// Calls `fn` with `format` as a `std::integral_constant`, so that everything it runs is specialized for that format rather than checking it per value.
+template <typename Fn> decltype(auto) with_format(NbtFormat format, Fn&& fn) {
+    switch (format) {
+        case FORMAT_JAVA: return fn(std::integral_constant<NbtFormat, FORMAT_JAVA>{});
+        case FORMAT_BEDROCK: return fn(std::integral_constant<NbtFormat, FORMAT_BEDROCK>{});
+        case FORMAT_BEDROCK_NETWORK: return fn(std::integral_constant<NbtFormat, FORMAT_BEDROCK_NETWORK>{});
+    }
+    throw std::runtime_error("Tried to use unknown NBT format " + std::to_string(format));
+}
+
+// Bounds-checked cursor over a contiguous buffer of NBT data in format F.
+// Every read checks the remaining length once and then copies straight out of the buffer.
+template <NbtFormat F> class BasicByteReader {
+public:
+    using traits = format_traits<F>;
+
+    // The fewest bytes an int or long payload of type T can take up, for checking lengths before allocating.
+    template <typename T> static constexpr std::size_t min_number_size = traits::varints && sizeof(T) >= 4 ? 1 : sizeof(T);
+
+    explicit BasicByteReader(std::span<const byte_t> bytes) : bytes(bytes), pos(0) {}
+
+    // Counts one level of nesting for as long as it lives.
+    class Nesting {
+    public:
+        explicit Nesting(BasicByteReader& reader) : reader(reader) {
+            if (reader.depth >= max_nbt_depth)
+                throw parse_error("NBT data is nested more than " + std::to_string(max_nbt_depth) + " levels deep at offset " + std::to_string(reader.pos), reader.pos);
+            ++reader.depth;
+        }
+        Nesting(const Nesting&) = delete;
+        Nesting& operator=(const Nesting&) = delete;
+        ~Nesting() { --reader.depth; }
+
+    private:
+        BasicByteReader& reader;
+    };
+    // Enters a compound or list, throwing if that nests it too deeply. Every recursive reader holds one of these while it reads the children.
+    [[nodiscard]] Nesting nest() { return Nesting(*this); }
+
+    std::size_t position() const { return pos; }
+    std::size_t remaining() const { return bytes.size() - pos; }
+
+    // Throws if fewer than `count` bytes are left.
+    void require(std::size_t count) const {
+        if (count > remaining())
+            throw truncated_error("Unexpected end of NBT data at offset " + std::to_string(pos) + " (needed " + std::to_string(count) + " bytes, " + std::to_string(remaining()) + " left)", pos);
+    }
+
+    // Returns a pointer to the next `count` bytes and moves past them.
+    const byte_t* take(std::size_t count) {
+        require(count);
+        const byte_t* ret = bytes.data() + pos;
+        pos += count;
+        return ret;
+    }
+
+    byte_t read_byte() {
+        return *take(1);
+    }
+
+    // Reads a fixed-width integer of type T, in the format's byte order.
+    template <typename T> T read_int() {
+        T ret;
+        std::memcpy(&ret, take(sizeof(T)), sizeof(T));
+        return reorder<traits::order>(ret);
+    }
+
+    // Reads an unsigned LEB128 varint of type T (`uint_t` or `ulong_t`).
+    template <typename T> T read_varint() {
+        constexpr std::size_t max_size = (sizeof(T) * 8 + 6) / 7;
+        const byte_t* data = bytes.data() + pos;
+        std::size_t limit = std::min(max_size, remaining());
+        T ret = 0;
+        for (std::size_t i = 0; i < limit; ++i) {
+            ret |= (T)(data[i] & 0x7f) << (7 * i);
+            if (!(data[i] & 0x80)) {
+                pos += i + 1;
+                return ret;
+            }
+        }
+        if (limit < max_size)
+            throw truncated_error("Unexpected end of NBT data at offset " + std::to_string(bytes.size()) + " (in a varint starting at offset " + std::to_string(pos) + ")", bytes.size());
+        throw parse_error("Varint longer than " + std::to_string(max_size) + " bytes at offset " + std::to_string(pos), pos);
+    }
+
+    // Reads the payload of a short, int or long tag: fixed-width, or a zigzag varint for ints and longs in formats that use them.
+    template <typename T> T read_number() {
+        if constexpr (traits::varints && sizeof(T) >= 4)
+            return zigzag_decode<T>(read_varint<std::make_unsigned_t<T>>());
+        else
+            return read_int<T>();
+    }
+
+    float read_float() {
+        return std::bit_cast<float>(read_int<uint_t>());
+    }
+    double read_double() {
+        return std::bit_cast<double>(read_int<ulong_t>());
+    }
+
+    // Reads a string, returning a view into the buffer.
+    std::string_view read_string_view() {
+        std::size_t len;
+        if constexpr (traits::varints)
+            len = read_varint<uint_t>();
+        else
+            len = read_int<ushort_t>();
+        const byte_t* data = take(len);
+        return std::string_view((const char*)data, len);
+    }
+    std::string read_string() {
+        return std::string(read_string_view());
+    }
+
+    // Reads a signed 32-bit array length, rejecting negative values.
+    std::size_t read_length() {
+        std::size_t at = pos;
+        int_t len = read_number<int_t>();
+        if (len < 0)
+            throw parse_error("Negative array length " + std::to_string(len) + " at offset " + std::to_string(at), at);
+        return (std::size_t)len;
+    }
+
+    // Reads `count` int or long payloads of type T into `out`.
+    // Fixed-width ones are converted in bulk; callers should `require(count * min_number_size<T>)` before sizing `out`.
+    template <typename T> void read_ints(T* out, std::size_t count) {
+        if constexpr (traits::varints && sizeof(T) >= 4) {
+            for (std::size_t i = 0; i < count; ++i)
+                out[i] = read_number<T>();
+        } else {
+            require(count * sizeof(T));
+            load_ordered<traits::order>(out, take(count * sizeof(T)), count);
+        }
+    }
+
+private:
+    std::span<const byte_t> bytes;
+    std::size_t pos;
+    std::size_t depth = 0;
+};
+
+// Returns the encoded size of a payload of the given type, or 0 if it is not of a fixed size.
+constexpr std::size_t fixed_payload_size(byte_t type) {
+    switch (type) {
+        case TAG_BYTE: return 1;
+        case TAG_SHORT: return 2;
+        case TAG_INT: return 4;
+        case TAG_LONG: return 8;
+        case TAG_FLOAT: return 4;
+        case TAG_DOUBLE: return 8;
+        default: return 0;
+    }
+}
+// Returns the encoded size of a payload of the given type in format F, or 0 if it is not of a fixed size there.
+template <NbtFormat F> constexpr std::size_t fixed_payload_size(byte_t type) {
+    if (format_traits<F>::varints && (type == TAG_INT || type == TAG_LONG))
+        return 0;
+    return fixed_payload_size(type);
 }
 
-byte_t get_highest_byte(ulong_t byte_data) {
-    for (int i = 7; i >= 0; --i) if ((byte_data >> (i * 8)) != 0) return byte_data >> (i * 8);
-    return 0;
+template <NbtFormat F> void skip_payload(BasicByteReader<F>& reader, byte_t type);
+
+// Moves the reader past `count` list elements of the given type without decoding them.
+template <NbtFormat F> void skip_elements(BasicByteReader<F>& reader, byte_t type, std::size_t count) {
+    if (std::size_t element_size = fixed_payload_size<F>(type)) {
+        reader.take(count * element_size);
+    } else {
+        for (std::size_t i = 0; i < count; ++i)
+            skip_payload(reader, type);
+    }
+}
+
+// Moves the reader past the payload of a tag of the given type without decoding it.
+// Strings and arrays are skipped using their length prefixes.
+template <NbtFormat F> void skip_payload(BasicByteReader<F>& reader, byte_t type) {
+    switch (type) {
+        case TAG_BYTE:
+        case TAG_SHORT:
+        case TAG_FLOAT:
+        case TAG_DOUBLE: {
+            reader.take(fixed_payload_size(type));
+            break;
+        }
+        case TAG_INT: {
+            reader.template read_number<int_t>();
+            break;
+        }
+        case TAG_LONG: {
+            reader.template read_number<long_t>();
+            break;
+        }
+        case TAG_STRING: {
+            reader.read_string_view();
+            break;
+        }
+        case TAG_BYTEARRAY: {
+            reader.take(reader.read_length());
+            break;
+        }
+        case TAG_INTARRAY: {
+            skip_elements(reader, TAG_INT, reader.read_length());
+            break;
+        }
+        case TAG_LONGARRAY: {
+            skip_elements(reader, TAG_LONG, reader.read_length());
+            break;
+        }
+        case TAG_ARRAY: {
+            auto nesting = reader.nest();
+            byte_t element_type = reader.read_byte();
+            std::size_t length = reader.read_length();
+            skip_elements(reader, element_type, length);
+            break;
+        }
+        case TAG_COMPOUND: {
+            auto nesting = reader.nest();
+            byte_t next_type = reader.read_byte();
+            while (next_type != TAG_END) {
+                reader.read_string_view();
+                skip_payload(reader, next_type);
+                next_type = reader.read_byte();
+            }
+            break;
+        }
+        default: {
+            std::size_t at = reader.position();
+            throw parse_error("Found illegal type " + std::to_string(type) + " at offset " + std::to_string(at), at);
+        }
+    }
+}
+
+// Cursor for writing NBT data in format F into a buffer.
+// Does no bounds checking: callers size the buffer with `NBTTag::encoded_size()` first.
+template <NbtFormat F> class BasicByteWriter {
+public:
+    using traits = format_traits<F>;
+
+    explicit BasicByteWriter(byte_t* out) : start(out), out(out) {}
+
+    std::size_t position() const { return out - start; }
+
+    void write_byte(byte_t val) {
+        *out++ = val;
+    }
+    void write_bytes(const void* data, std::size_t count) {
+        std::memcpy(out, data, count);
+        out += count;
+    }
+
+    // Writes a fixed-width integer of type T, in the format's byte order.
+    template <typename T> void write_int(T val) {
+        val = reorder<traits::order>(val);
+        std::memcpy(out, &val, sizeof(T));
+        out += sizeof(T);
+    }
+
+    // Writes an unsigned LEB128 varint.
+    void write_varint(ulong_t val) {
+        while (val >= 0x80) {
+            *out++ = (byte_t)(val | 0x80);
+            val >>= 7;
+        }
+        *out++ = (byte_t)val;
+    }
+
+    // Writes the payload of a short, int or long tag. See `BasicByteReader::read_number()`.
+    template <typename T> void write_number(T val) {
+        if constexpr (traits::varints && sizeof(T) >= 4)
+            write_varint(zigzag_encode(val));
+        else
+            write_int(val);
+    }
+
+    void write_float(float val) {
+        write_int(std::bit_cast<uint_t>(val));
+    }
+    void write_double(double val) {
+        write_int(std::bit_cast<ulong_t>(val));
+    }
+
+    void write_string(std::string_view string) {
+        if constexpr (traits::varints)
+            write_varint(string.size());
+        else
+            write_int((ushort_t)string.size());
+        write_bytes(string.data(), string.size());
+    }
+
+    void write_length(std::size_t length) {
+        write_number((int_t)length);
+    }
+
+    // Writes `count` int or long payloads of type T.
+    template <typename T> void write_ints(const T* values, std::size_t count) {
+        if constexpr (traits::varints && sizeof(T) >= 4) {
+            for (std::size_t i = 0; i < count; ++i)
+                write_number(values[i]);
+        } else {
+            store_ordered<traits::order>(out, values, count);
+            out += count * sizeof(T);
+        }
+    }
+
+    // The sizes that the writes above take up, for `NBTTag::encoded_size()`.
+    static std::size_t varint_size(ulong_t val) {
+        // one byte per 7 bits, and at least one byte for 0
+        return (std::size_t)(std::bit_width(val | 1) + 6) / 7;
+    }
+    template <typename T> static std::size_t number_size(T val) {
+        if constexpr (traits::varints && sizeof(T) >= 4)
+            return varint_size(zigzag_encode(val));
+        else
+            return sizeof(T);
+    }
+    template <typename T> static std::size_t numbers_size(const T* values, std::size_t count) {
+        if constexpr (traits::varints && sizeof(T) >= 4) {
+            std::size_t size = 0;
+            for (std::size_t i = 0; i < count; ++i)
+                size += number_size(values[i]);
+            return size;
+        } else {
+            return count * sizeof(T);
+        }
+    }
+    static std::size_t string_size(std::size_t length) {
+        if constexpr (traits::varints)
+            return varint_size(length) + length;
+        else
+            return 2 + length;
+    }
+    static std::size_t length_size(std::size_t length) {
+        return number_size((int_t)length);
+    }
+
+private:
+    byte_t* start;
+    byte_t* out;
+};
+
+// The cursors for Java's format, which is what everything but `NBTTag`'s own codec reads and writes.
+using ByteReader = BasicByteReader<FORMAT_JAVA>;
+using ByteWriter = BasicByteWriter<FORMAT_JAVA>;
+
+// Reads everything that is left in the stream into a buffer.
+std::vector<byte_t> read_all(std::istream& stream) {
+    PhaseTimer timer(stats::PHASE_READ, 0);
+    std::vector<byte_t> ret(std::istreambuf_iterator<char>(stream), {});
+    timer.bytes_out = ret.size();
+    return ret;
 }
 
 template <typename T> constexpr bool is_nbt_type = false;
@@ -248,34 +699,195 @@ template <> constexpr bool is_nbt_type<float> = true;
 template <> constexpr bool is_nbt_type<double> = true;
 template <> constexpr bool is_nbt_type<std::string> = true;
 template <> constexpr bool is_nbt_type<std::vector<NBTTag>> = true;
+template <> constexpr bool is_nbt_type<Compound> = true;
 template <> constexpr bool is_nbt_type<std::vector<byte_t>> = true;
 template <> constexpr bool is_nbt_type<std::vector<int_t>> = true;
 template <> constexpr bool is_nbt_type<std::vector<long_t>> = true;
+template <> constexpr bool is_nbt_type<string_t> = true;
+template <> constexpr bool is_nbt_type<array_t<NBTTag>> = true;
+template <> constexpr bool is_nbt_type<array_t<byte_t>> = true;
+template <> constexpr bool is_nbt_type<array_t<int_t>> = true;
+template <> constexpr bool is_nbt_type<array_t<long_t>> = true;
 template <> constexpr bool is_nbt_type<NBTTag> = true;
 
 }
 
 template <typename T> concept NbtType = internal::is_nbt_type<T>;
 
+namespace internal {
+
+// Maps an NBT type to the tag type that holds it, the alternative of `NBTTag::DataType` it is stored as, and a name for error messages.
+// The standard (non-`std::pmr`) containers map to their `std::pmr` counterparts, so they can be passed to `NBTTag::get()` but not `NBTTag::get_ref()`.
+template <typename T> struct tag_traits;
+template <> struct tag_traits<byte_t> { static constexpr Tag tag = TAG_BYTE; using stored = char; static constexpr const char* name = "byte"; };
+template <> struct tag_traits<short_t> { static constexpr Tag tag = TAG_SHORT; using stored = short_t; static constexpr const char* name = "short"; };
+template <> struct tag_traits<int_t> { static constexpr Tag tag = TAG_INT; using stored = int_t; static constexpr const char* name = "int"; };
+template <> struct tag_traits<long_t> { static constexpr Tag tag = TAG_LONG; using stored = long_t; static constexpr const char* name = "long"; };
+template <> struct tag_traits<float> { static constexpr Tag tag = TAG_FLOAT; using stored = float; static constexpr const char* name = "float"; };
+template <> struct tag_traits<double> { static constexpr Tag tag = TAG_DOUBLE; using stored = double; static constexpr const char* name = "double"; };
+template <> struct tag_traits<string_t> { static constexpr Tag tag = TAG_STRING; using stored = string_t; static constexpr const char* name = "string"; };
+template <> struct tag_traits<array_t<NBTTag>> { static constexpr Tag tag = TAG_ARRAY; using stored = array_t<NBTTag>; static constexpr const char* name = "array"; };
+template <> struct tag_traits<Compound> { static constexpr Tag tag = TAG_COMPOUND; using stored = Compound; static constexpr const char* name = "compound"; };
+template <> struct tag_traits<array_t<byte_t>> { static constexpr Tag tag = TAG_BYTEARRAY; using stored = array_t<byte_t>; static constexpr const char* name = "byte array"; };
+template <> struct tag_traits<array_t<int_t>> { static constexpr Tag tag = TAG_INTARRAY; using stored = array_t<int_t>; static constexpr const char* name = "int array"; };
+template <> struct tag_traits<array_t<long_t>> { static constexpr Tag tag = TAG_LONGARRAY; using stored = array_t<long_t>; static constexpr const char* name = "long array"; };
+template <> struct tag_traits<std::string> : tag_traits<string_t> {};
+template <> struct tag_traits<std::vector<NBTTag>> : tag_traits<array_t<NBTTag>> {};
+template <> struct tag_traits<std::vector<byte_t>> : tag_traits<array_t<byte_t>> {};
+template <> struct tag_traits<std::vector<int_t>> : tag_traits<array_t<int_t>> {};
+template <> struct tag_traits<std::vector<long_t>> : tag_traits<array_t<long_t>> {};
+
+// Types that are stored as-is, and so can be accessed by reference.
+template <typename T> concept NbtStoredType = NbtType<T> && (std::same_as<T, typename tag_traits<T>::stored> || std::same_as<T, byte_t>);
+
+// The element types that primitive array tags can be viewed as spans of.
+template <typename T> concept NbtArrayElement = std::same_as<T, byte_t> || std::same_as<T, int_t> || std::same_as<T, long_t>;
+
+}
+
+/// @brief The value of a compound tag.
+/// Children are kept in the order they were added (which is the order `NBTTag::to_nbt` writes them in).
+/// Once a compound grows past a handful of children, it also keeps a hash index over their names, so that lookups take constant time on average.
+/// @note The index is keyed on the children's names, so don't rename a child in place. Erase it and add it again instead.
+class Compound {
+public:
+    using iterator = array_t<NBTTag>::iterator;
+    using const_iterator = array_t<NBTTag>::const_iterator;
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    Compound() = default;
+    explicit Compound(const allocator_type& alloc) : tags(alloc), slots(alloc) {}
+    Compound(array_t<NBTTag> tags);
+    Compound(const Compound& other) = default;
+    Compound(Compound&& other) = default;
+    Compound(const Compound& other, const allocator_type& alloc) : tags(other.tags, alloc), slots(other.slots, alloc) {}
+    Compound(Compound&& other, const allocator_type& alloc) : tags(std::move(other.tags), alloc), slots(std::move(other.slots), alloc) {}
+    Compound& operator=(const Compound& other) = default;
+    Compound& operator=(Compound&& other) = default;
+
+    allocator_type get_allocator() const { return this->tags.get_allocator(); }
+
+    iterator begin() { return this->tags.begin(); }
+    iterator end() { return this->tags.end(); }
+    const_iterator begin() const { return this->tags.begin(); }
+    const_iterator end() const { return this->tags.end(); }
+    std::size_t size() const { return this->tags.size(); }
+    bool empty() const { return this->tags.empty(); }
+    void reserve(std::size_t capacity) { this->tags.reserve(capacity); }
+
+    /// @brief Finds a child by name.
+    /// @param name The name of the child.
+    /// @return The child, or `nullptr` if there is no child with that name.
+    NBTTag* find(std::string_view name);
+    const NBTTag* find(std::string_view name) const;
+    /// @brief Finds a child by name. Faster than looking it up by text when both names are interned in the same table.
+    NBTTag* find(const Name& name);
+    const NBTTag* find(const Name& name) const;
+    bool contains(std::string_view name) const { return this->find(name) != nullptr; }
+    bool contains(const Name& name) const { return this->find(name) != nullptr; }
+    /// @brief Adds a child to the end of the compound.
+    /// @param tag The child to add. Nothing stops you from adding two children with the same name, but only the first will be found by name.
+    /// @return A reference to the added child.
+    NBTTag& push_back(NBTTag tag);
+    /// @brief Removes a child by name.
+    /// @param name The name of the child to remove.
+    /// @return Whether there was a child to remove.
+    bool erase(std::string_view name);
+    iterator erase(const_iterator pos);
+
+    /// @brief Gets the children as a vector, in order.
+    const array_t<NBTTag>& as_vector() const { return this->tags; }
+
+private:
+    // compounds up to this size are searched linearly, which is faster than hashing for small sizes
+    static constexpr std::size_t index_threshold = 8;
+    static constexpr uint_t empty_slot = 0xffffffff;
+
+    array_t<NBTTag> tags;
+    // open-addressed table of indices into `tags` (size is a power of two, or zero when there's no index)
+    array_t<uint_t> slots;
+
+    void rebuild_index();
+    void index(std::size_t position);
+};
+
+/// @note `NBTTag` is allocator-aware: its strings and arrays (and those of its children) allocate through the memory resource it was constructed with.
+/// Pass a `std::pmr::monotonic_buffer_resource` (wrapped in an `allocator_type`) to the parsing functions to put a whole tree in one arena.
+/// As with the standard `std::pmr` containers, copies use the default resource unless told otherwise, and the arena must outlive every tag allocated from it.
 struct NBTTag {
-    using DataType = std::variant<std::vector<NBTTag>,
-        std::vector<byte_t>, std::vector<int_t>, std::vector<long_t>,
-        char, short_t, int_t, long_t, float, double, std::string>;
+    using DataType = std::variant<array_t<NBTTag>,
+        array_t<byte_t>, array_t<int_t>, array_t<long_t>,
+        char, short_t, int_t, long_t, float, double, string_t, Compound>;
+    using allocator_type = std::pmr::polymorphic_allocator<>;
 
     Tag type;
-    /// @todo Switch this for a map in the DataType definition
-    /// (that would speed up access dramatically and make some other QOL changes possible)
-    std::string name;
+    Name name;
     DataType value;
 
     NBTTag() :  name(), value() {}
-    NBTTag(Tag type, std::string name, DataType value);
+    explicit NBTTag(const allocator_type& alloc) : type(TAG_END), name(), value(std::in_place_type<array_t<NBTTag>>, alloc) {}
+    NBTTag(Tag type, Name name, DataType value, const allocator_type& alloc = {});
+    NBTTag(Tag type, std::string_view name, DataType value, const allocator_type& alloc = {})
+        : NBTTag(type, Name(name), std::move(value), alloc) {}
+    /// @brief Creates an array tag (or compound tag, if `type` is `TAG_COMPOUND` and `T` is `NBTTag`) from a standard vector.
+    template <typename T> NBTTag(Tag type, std::string_view name, const std::vector<T>& value, const allocator_type& alloc = {})
+        : NBTTag(type, name, array_t<T>(value.begin(), value.end(), alloc), alloc) {}
+    /// @brief Creates a string tag from a standard string.
+    /// (A template so that literal `0` values still go to the `DataType` overload, rather than being read as a null `const char*`.)
+    template <std::same_as<std::string> S> NBTTag(Tag type, std::string_view name, const S& value, const allocator_type& alloc = {})
+        : NBTTag(type, name, string_t(value, alloc), alloc) {}
+    NBTTag(const NBTTag& other) = default;
+    NBTTag(NBTTag&& other) = default;
+    NBTTag(const NBTTag& other, const allocator_type& alloc);
+    NBTTag(NBTTag&& other, const allocator_type& alloc);
+    NBTTag& operator=(const NBTTag& other) = default;
+    NBTTag& operator=(NBTTag&& other) = default;
     ~NBTTag() {}
-    static NBTTag from_nbt(std::vector<byte_t>::iterator& bytes, bool suppress_name = false, std::optional<byte_t> type_override = {});
-    static NBTTag from_nbt(std::istream& bytes, bool suppress_name = false, std::optional<byte_t> type_override = {});
-    std::vector<byte_t> to_nbt() const;
-    void to_nbt(std::ostream& stream) const;
-    /// @brief Pretty-print this tag.
+    /// @brief Parses a tag from part of a vector, moving `bytes` past it.
+    /// @param end The end of the data. The tag must end before it.
+    /// @deprecated Use `NBTTag::from_nbt(std::span<const byte_t>, std::size_t*)` instead, which this forwards to.
+    static NBTTag from_nbt(std::vector<byte_t>::iterator& bytes, std::vector<byte_t>::iterator end, bool suppress_name = false, std::optional<byte_t> type_override = {});
+    /// @brief Parses a tag from a stream.
+    /// @param depth How deeply the tag is nested, for recursive calls. Throws `nbt::parse_error` past `max_nbt_depth`.
+    static NBTTag from_nbt(std::istream& bytes, bool suppress_name = false, std::optional<byte_t> type_override = {}, const allocator_type& alloc = {}, std::size_t depth = 0);
+    /// @brief Parses a tag from a contiguous buffer, without going through a stream.
+    /// @param bytes The buffer to read from. It must start with a complete, named tag, and may continue past it.
+    /// @param consumed If not null, receives the number of bytes that made up the tag.
+    /// @param alloc The allocator to allocate the tag's strings and arrays with.
+    /// @param symbols If not null, the table to intern the names of the tag and its children in. Otherwise, each tag owns its name.
+    /// @return The parsed tag.
+    /// @exception Throws `nbt::truncated_error` if the buffer ends before the tag does, and `nbt::parse_error` if the tag is otherwise malformed.
+    static NBTTag from_nbt(std::span<const byte_t> bytes, std::size_t* consumed = nullptr, const allocator_type& alloc = {}, SymbolTable* symbols = nullptr);
+    /// @brief Parses a tag in the given format from a contiguous buffer. See `from_nbt(std::span<const byte_t>, std::size_t*, const allocator_type&, SymbolTable*)`.
+    /// @param format The format of the data. The decoder is specialized for each format, so this is only looked at once, not per value.
+    /// @note Bedrock's world database often stores several root tags back to back in one value; read them in turn using `consumed`.
+    static NBTTag from_nbt(std::span<const byte_t> bytes, NbtFormat format, std::size_t* consumed = nullptr, const allocator_type& alloc = {}, SymbolTable* symbols = nullptr);
+    template <NbtFormat F> static NBTTag from_nbt(internal::BasicByteReader<F>& reader, bool suppress_name = false, std::optional<byte_t> type_override = {}, const allocator_type& alloc = {}, SymbolTable* symbols = nullptr);
+    /// @brief Encodes this tag.
+    /// @param format The format to encode it in.
+    /// @return The encoded tag. The buffer is allocated once, at exactly the right size.
+    std::vector<byte_t> to_nbt(NbtFormat format = FORMAT_JAVA) const;
+    /// @brief Encodes this tag into a caller-supplied buffer.
+    /// @param out The buffer to write to. Must be at least `encoded_size(format)` bytes long.
+    /// @param format The format to encode it in.
+    /// @return The number of bytes written.
+    /// @exception Throws if `out` is too small.
+    std::size_t to_nbt(std::span<byte_t> out, NbtFormat format = FORMAT_JAVA) const;
+    /// @brief Encodes this tag into a stream.
+    /// @param stream The stream to write to.
+    /// @param suppress_header Whether to leave out the type and name of the tag (as is done for elements of array tags).
+    /// @note Streams are always written in Java's format.
+    void to_nbt(std::ostream& stream, bool suppress_header = false) const;
+    template <NbtFormat F> void to_nbt(internal::BasicByteWriter<F>& writer, bool suppress_header = false) const;
+    /// @brief Computes the number of bytes this tag takes up once encoded, without encoding it.
+    /// @tparam F The format it would be encoded in.
+    /// @param suppress_header Whether to leave out the type and name of the tag (as is done for elements of array tags).
+    /// @return The size of the encoded tag.
+    /// @exception Throws if the tag can't be encoded (e.g. if a string is too long, or an array tag has elements of different types).
+    template <NbtFormat F = FORMAT_JAVA> std::size_t encoded_size(bool suppress_header = false) const;
+    /// @brief Computes the number of bytes this tag takes up once encoded in the given format. See `encoded_size<F>(bool)`.
+    std::size_t encoded_size(NbtFormat format, bool suppress_header = false) const;
+    /// @brief Pretty-print this tag. For output that can be parsed back, see `to_snbt()`.
     /// @param tab_level The number of `\t` characters to insert before every line. Used internally to tabulate lines. When a value is supplied externally, every line will be indented this many times on top of normal tabulation.
     /// @return A string representing this tag.
     std::string to_string(int tab_level = 0) const;
@@ -287,20 +899,44 @@ struct NBTTag {
     /// @brief Compound tag element access. Will throw if `this` is not a compound tag.
     /// @param name The name of the element to access.
     /// @return An element with name `name`. Will throw if no such element exists.
-    NBTTag& at(const std::string& name) const;
+    NBTTag& at(const std::string& name);
+    const NBTTag& at(const std::string& name) const;
+    /// @brief Compound tag element access by a (preferably interned) name. See `NBTTag::at(const std::string&)`.
+    /// Interning hot keys once (e.g. `static const Name key = SymbolTable::global().intern("palette");`) makes lookups in trees parsed with the same table compare handles instead of text.
+    NBTTag& at(const Name& name);
+    const NBTTag& at(const Name& name) const;
     /// @brief Array tag element access. Will throw if `this` is not an array tag.
     /// @param index The index of the element to access.
     /// @return An element with index `index`. Will throw if no such element exists.
-    NBTTag& operator[](std::size_t index) const;
+    NBTTag& operator[](std::size_t index);
+    const NBTTag& operator[](std::size_t index) const;
     /// @brief Gets the value of this tag.
     /// @tparam T The type to get the value of this tag as.
     /// @return The value of this tag.
-    /// @note Implemented using template specialisations that will throw if the tag is not of the correct type.
+    /// @note Will throw if the tag is not of the correct type.
     /// This means that, for example, `get<int_t>` should NOT be called if `this.type` is `TAG_BYTE`.
     /// In that case, call `get<byte_t>` and use a cast instead.
     /// This also means that `get<builtin_int_type>` should not be called. Only use NBT types.
     /// (This will cause a compilation error if violated.)
+    /// Strings and arrays may be requested either as the `std::pmr` containers they are stored in or as `std::string`/`std::vector`.
     template <NbtType T> T get() const;
+    /// @brief Gets a reference to the value of this tag, without copying it.
+    /// @tparam T The type of the value. Must match `this.type` exactly, as with `get()`, and be the type the value is stored as (`string_t` or `array_t`, not `std::string` or `std::vector`).
+    /// @return A reference to the value of this tag. It stays valid until the tag is destroyed or assigned a value of a different type.
+    /// @exception Throws if `T` doesn't match `this.type`.
+    template <NbtType T> T& get_ref();
+    template <NbtType T> const T& get_ref() const;
+    /// @brief Views the elements of this byte, int or long array tag.
+    /// @tparam T The element type (`byte_t`, `int_t` or `long_t`).
+    /// @return A span over the elements. It stays valid until the array is resized or the tag is destroyed.
+    /// @exception Throws if `this.type` is not the array tag type with elements of type `T`.
+    template <internal::NbtArrayElement T> std::span<T> span();
+    template <internal::NbtArrayElement T> std::span<const T> span() const;
+    /// @brief Moves the value out of this tag.
+    /// @tparam T The type of the value. Must match `this.type` exactly, as with `get_ref()`.
+    /// @return The value of this tag. The tag is left with an empty (or zero) value of the same type.
+    /// @exception Throws if `T` doesn't match `this.type`.
+    template <NbtType T> T take();
     /// @brief Gets the size of this array tag.
     /// @return The size of this array tag.
     /// @exception Throws if `this.type` is not one of `TAG_BYTEARRAY`, `TAG_INTARRAY`, `TAG_LONGARRAY`, or `TAG_ARRAY`.
@@ -310,311 +946,477 @@ struct NBTTag {
     /// @return Whether this tag contains the key.
     /// @exception Throws if `this.type` is not `TAG_COMPOUND`.
     bool contains(const std::string& key) const;
+    bool contains(const Name& key) const;
 };
 
-NBTTag::NBTTag(Tag type, std::string name, DataType value) : name(name), value(value), type(type) {}
+namespace internal {
 
-NBTTag NBTTag::from_nbt(std::vector<byte_t>::iterator& bytes, bool suppress_name, std::optional<byte_t> type_override) {
-    /// TODO: update this function (see other overload)
-    std::string name;
-    short_t namelen;
-    DataType value;
-    byte_t type;
-    if (type_override) {
-        type = type_override.value();
-    } else {
-        type = *bytes++;
+// Copies or moves a tag value into the given allocator's memory resource.
+// (Moving only steals the value's storage if it already uses that resource.)
+template <typename Value> NBTTag::DataType rebind_value(Value&& value, const NBTTag::allocator_type& alloc) {
+    return std::visit([&alloc](auto&& val) -> NBTTag::DataType {
+        using T = std::remove_cvref_t<decltype(val)>;
+        if constexpr (std::uses_allocator_v<T, NBTTag::allocator_type>)
+            return NBTTag::DataType(std::in_place_type<T>, std::forward<decltype(val)>(val), alloc);
+        else
+            return NBTTag::DataType(std::in_place_type<T>, val);
+    }, std::forward<Value>(value));
+}
+
+}
+
+NBTTag::NBTTag(Tag type, Name name, DataType value, const allocator_type& alloc) : type(type), name(std::move(name)), value(internal::rebind_value(std::move(value), alloc)) {
+    // compounds may be built from a plain vector of children
+    if (type == TAG_COMPOUND && std::holds_alternative<array_t<NBTTag>>(this->value))
+        this->value = Compound(std::move(std::get<array_t<NBTTag>>(this->value)));
+}
+NBTTag::NBTTag(const NBTTag& other, const allocator_type& alloc) : type(other.type), name(other.name), value(internal::rebind_value(other.value, alloc)) {}
+NBTTag::NBTTag(NBTTag&& other, const allocator_type& alloc) : type(other.type), name(std::move(other.name)), value(internal::rebind_value(std::move(other.value), alloc)) {}
+
+Compound::Compound(array_t<NBTTag> tags) : tags(std::move(tags)), slots(this->tags.get_allocator()) {
+    this->rebuild_index();
+}
+
+NBTTag* Compound::find(std::string_view name) {
+    return const_cast<NBTTag*>(std::as_const(*this).find(name));
+}
+const NBTTag* Compound::find(std::string_view name) const {
+    if (this->slots.empty()) {
+        for (const NBTTag& tag : this->tags)
+            if (tag.name == name) return &tag;
+        return nullptr;
     }
-    if (!suppress_name) {
-        namelen = *bytes++ * 256 + *bytes++;
-        auto name_begin = bytes;
-        auto name_end = name_begin + namelen;
-        name = std::string(name_begin, name_end);
-        bytes += namelen;
-    } else {
-        name = "";
-        namelen = -2;
+    std::size_t mask = this->slots.size() - 1;
+    for (std::size_t slot = internal::hash_name(name) & mask; this->slots[slot] != empty_slot; slot = (slot + 1) & mask)
+        if (this->tags[this->slots[slot]].name == name) return &this->tags[this->slots[slot]];
+    return nullptr;
+}
+
+NBTTag* Compound::find(const Name& name) {
+    return const_cast<NBTTag*>(std::as_const(*this).find(name));
+}
+const NBTTag* Compound::find(const Name& name) const {
+    if (this->slots.empty()) {
+        for (const NBTTag& tag : this->tags)
+            if (tag.name == name) return &tag;
+        return nullptr;
     }
-    switch (type) {
+    std::size_t mask = this->slots.size() - 1;
+    for (std::size_t slot = name.hash() & mask; this->slots[slot] != empty_slot; slot = (slot + 1) & mask)
+        if (this->tags[this->slots[slot]].name == name) return &this->tags[this->slots[slot]];
+    return nullptr;
+}
+
+NBTTag& Compound::push_back(NBTTag tag) {
+    this->tags.push_back(std::move(tag));
+    // keep the table at most half full
+    if (this->tags.size() > index_threshold && this->tags.size() * 2 > this->slots.size())
+        this->rebuild_index();
+    else if (!this->slots.empty())
+        this->index(this->tags.size() - 1);
+    return this->tags.back();
+}
+
+bool Compound::erase(std::string_view name) {
+    const NBTTag* tag = this->find(name);
+    if (!tag) return false;
+    this->erase(this->tags.begin() + (tag - this->tags.data()));
+    return true;
+}
+Compound::iterator Compound::erase(const_iterator pos) {
+    iterator ret = this->tags.erase(pos);
+    // every child after the erased one has moved, so the index is stale
+    this->rebuild_index();
+    return ret;
+}
+
+void Compound::rebuild_index() {
+    this->slots.clear();
+    if (this->tags.size() <= index_threshold) return;
+    this->slots.assign(std::bit_ceil(this->tags.size() * 4), empty_slot);
+    for (std::size_t i = 0; i < this->tags.size(); ++i)
+        this->index(i);
+}
+void Compound::index(std::size_t position) {
+    std::size_t mask = this->slots.size() - 1;
+    std::size_t slot = this->tags[position].name.hash() & mask;
+    while (this->slots[slot] != empty_slot) {
+        // keep the first of several children with the same name
+        if (this->tags[this->slots[slot]].name == this->tags[position].name) return;
+        slot = (slot + 1) & mask;
+    }
+    this->slots[slot] = (uint_t)position;
+}
+
+NBTTag NBTTag::from_nbt(std::vector<byte_t>::iterator& bytes, std::vector<byte_t>::iterator end, bool suppress_name, std::optional<byte_t> type_override) {
+    internal::ByteReader reader(std::span<const byte_t>(std::to_address(bytes), (std::size_t)(end - bytes)));
+    NBTTag ret = NBTTag::from_nbt(reader, suppress_name, type_override);
+    bytes += (std::ptrdiff_t)reader.position();
+    return ret;
+}
+NBTTag NBTTag::from_nbt(std::istream& bytes, bool suppress_name, std::optional<byte_t> type_override, const allocator_type& alloc, std::size_t depth) {
+    NBTTag ret(alloc);
+
+    if (type_override)
+        ret.type = static_cast<Tag>(type_override.value());
+    else
+        ret.type = static_cast<Tag>(internal::read(bytes, TAG_BYTE).b);
+
+    if (!suppress_name)
+        ret.name = internal::read_string(bytes);
+
+    switch (ret.type) {
         case TAG_BYTE: {
-            value = (char)*bytes++;
+            ret.value = internal::read(bytes, TAG_BYTE).b;
             break;
         }
         case TAG_SHORT: {
-            value = internal::unpack(&(*bytes), TAG_SHORT).s;
-            bytes += 2;
+            ret.value = internal::read(bytes, TAG_SHORT).s;
             break;
         }
         case TAG_INT: {
-            value = internal::unpack(&(*bytes), TAG_INT).i;
-            bytes += 4;
+            ret.value = internal::read(bytes, TAG_INT).i;
             break;
         }
         case TAG_LONG: {
-            value = internal::unpack(&(*bytes), TAG_LONG).l;
-            bytes += 8;
+            ret.value = internal::read(bytes, TAG_LONG).l;
             break;
         }
         case TAG_FLOAT: {
-            value = internal::unpack(&(*bytes), TAG_FLOAT).f;
-            bytes += 4;
+            ret.value = internal::read(bytes, TAG_FLOAT).f;
             break;
         }
         case TAG_DOUBLE: {
-            value = internal::unpack(&(*bytes), TAG_DOUBLE).d;
-            bytes += 8;
+            ret.value = internal::read(bytes, TAG_DOUBLE).d;
             break;
         }
         case TAG_STRING: {
-            short_t valuelen = (*bytes++ << 8) + *bytes++;
-            auto value_begin = bytes;
-            auto value_end = value_begin + valuelen;
-            value = std::string(value_begin, value_end);
-            bytes += valuelen;
+            ret.value = string_t(internal::read_string(bytes), alloc);
             break;
         }
         case TAG_BYTEARRAY: {
-            uint_t length = (*bytes++ << 24) + (*bytes++ << 16) + (*bytes++ << 8) + (*bytes++);
-            value = std::vector<byte_t>(bytes, (bytes += length));
+            int_t length = internal::read(bytes, TAG_INT).i;
+            array_t<byte_t> out_values(length, alloc);
+            bytes.read((char*)out_values.data(), length);
+            ret.value = std::move(out_values);
             break;
         }
         case TAG_INTARRAY: {
-            uint_t length = (*bytes++ << 24) + (*bytes++ << 16) + (*bytes++ << 8) + (*bytes++);
-            value = std::vector<int_t>(bytes, (bytes += length));
+            int_t length = internal::read(bytes, TAG_INT).i;
+            array_t<int_t> out_values(length, alloc);
+            bytes.read((char*)out_values.data(), length * sizeof(int_t));
+            internal::load_big_endian(out_values.data(), out_values.data(), length);
+            ret.value = std::move(out_values);
             break;
         }
         case TAG_LONGARRAY: {
-            uint_t length = (*bytes++ << 24) + (*bytes++ << 16) + (*bytes++ << 8) + (*bytes++);
-            value = std::vector<long_t>(bytes, (bytes += length));
+            int_t length = internal::read(bytes, TAG_INT).i;
+            array_t<long_t> out_values(length, alloc);
+            bytes.read((char*)out_values.data(), length * sizeof(long_t));
+            internal::load_big_endian(out_values.data(), out_values.data(), length);
+            ret.value = std::move(out_values);
             break;
         }
         case TAG_ARRAY: {
-            byte_t type = *bytes++;
-            uint_t length = (*bytes++ << 24) + (*bytes++ << 16) + (*bytes++ << 8) + (*bytes++);
-            std::vector<NBTTag> out_values(length);
-            if (length == 0) out_values = {};
-            else for (int i = 0; i < length; ++i) out_values[i] = NBTTag::from_nbt(bytes, true, {type});
-            value = out_values;
+            if (depth >= max_nbt_depth)
+                throw parse_error("NBT data is nested more than " + std::to_string(max_nbt_depth) + " levels deep", 0);
+            byte_t type = internal::read(bytes, TAG_BYTE).b;
+            uint_t length = internal::read(bytes, TAG_INT).i;
+            array_t<NBTTag> out_values(alloc);
+            out_values.reserve(length);
+            for (uint_t i = 0; i < length; ++i) out_values.push_back(NBTTag::from_nbt(bytes, true, {type}, alloc, depth + 1));
+            ret.value = std::move(out_values);
             break;
         }
         case TAG_COMPOUND: {
-            std::vector<NBTTag> out_values;
-            byte_t nextType = *bytes++;
+            if (depth >= max_nbt_depth)
+                throw parse_error("NBT data is nested more than " + std::to_string(max_nbt_depth) + " levels deep", 0);
+            Compound out_values(alloc);
+            byte_t nextType = internal::read(bytes, TAG_BYTE).b;
             while (nextType != TAG_END) {
-                out_values.push_back(NBTTag::from_nbt(bytes, false, {nextType}));
-                nextType = *bytes++;
+                out_values.push_back(NBTTag::from_nbt(bytes, false, {nextType}, alloc, depth + 1));
+                nextType = internal::read(bytes, TAG_BYTE).b;
             }
-            value = out_values;
+            ret.value = std::move(out_values);
             break;
         }
         default: {
-            std::cerr << "found illegal type " << type << std::endl;
-            throw;
+            throw std::runtime_error("Found illegal type " + std::to_string(ret.type));
         }
     }
-    return NBTTag((Tag)type, name, value);
+    return ret;
 }
-NBTTag NBTTag::from_nbt(std::istream& bytes, bool suppress_name, std::optional<byte_t> type_override) {
-    NBTTag ret;
 
+NBTTag NBTTag::from_nbt(std::span<const byte_t> bytes, std::size_t* consumed, const allocator_type& alloc, SymbolTable* symbols) {
+    return NBTTag::from_nbt(bytes, FORMAT_JAVA, consumed, alloc, symbols);
+}
+NBTTag NBTTag::from_nbt(std::span<const byte_t> bytes, NbtFormat format, std::size_t* consumed, const allocator_type& alloc, SymbolTable* symbols) {
+    return internal::with_format(format, [&](auto f) {
+        internal::BasicByteReader<decltype(f)::value> reader(bytes);
+        internal::PhaseTimer timer(stats::PHASE_PARSE, 0);
+        NBTTag ret = NBTTag::from_nbt(reader, false, {}, alloc, symbols);
+        timer.bytes_in = reader.position();
+        if (consumed)
+            *consumed = reader.position();
+        return ret;
+    });
+}
+template <NbtFormat F> NBTTag NBTTag::from_nbt(internal::BasicByteReader<F>& reader, bool suppress_name, std::optional<byte_t> type_override, const allocator_type& alloc, SymbolTable* symbols) {
+    NBTTag ret(alloc);
+
+    std::size_t start = reader.position();
     if (type_override)
         ret.type = static_cast<Tag>(type_override.value());
     else
-        ret.type = static_cast<Tag>(internal::read(bytes, TAG_BYTE).b);
+        ret.type = static_cast<Tag>(reader.read_byte());
 
-    if (!suppress_name)
-        ret.name = internal::read_string(bytes);
+    if (!suppress_name) {
+        std::string_view name = reader.read_string_view();
+        ret.name = symbols ? symbols->intern(name) : Name(name);
+    }
 
     switch (ret.type) {
         case TAG_BYTE: {
-            ret.value = internal::read(bytes, TAG_BYTE).b;
+            ret.value = (char)reader.read_byte();
             break;
         }
         case TAG_SHORT: {
-            ret.value = internal::read(bytes, TAG_SHORT).s;
+            ret.value = reader.template read_number<short_t>();
             break;
         }
         case TAG_INT: {
-            ret.value = internal::read(bytes, TAG_INT).i;
+            ret.value = reader.template read_number<int_t>();
             break;
         }
         case TAG_LONG: {
-            ret.value = internal::read(bytes, TAG_LONG).l;
+            ret.value = reader.template read_number<long_t>();
             break;
         }
         case TAG_FLOAT: {
-            ret.value = internal::read(bytes, TAG_FLOAT).f;
+            ret.value = reader.read_float();
             break;
         }
         case TAG_DOUBLE: {
-            ret.value = internal::read(bytes, TAG_DOUBLE).d;
+            ret.value = reader.read_double();
             break;
         }
         case TAG_STRING: {
-            ret.value = internal::read_string(bytes);
+            ret.value = string_t(reader.read_string_view(), alloc);
             break;
         }
         case TAG_BYTEARRAY: {
-            int_t length = internal::read(bytes, TAG_INT).i;
-            std::vector<byte_t> out_values(length);
-            bytes.read((char*)out_values.data(), length);
+            std::size_t length = reader.read_length();
+            const byte_t* data = reader.take(length);
+            ret.value = array_t<byte_t>(data, data + length, alloc);
             break;
         }
         case TAG_INTARRAY: {
-            int_t length = internal::read(bytes, TAG_INT).i;
-            std::vector<int_t> out_values(length);
-            bytes.read((char*)out_values.data(), length * sizeof(int_t));
-            if (internal::is_little_endian())
-                for (int_t& val : out_values)
-                    val = __builtin_bswap32(val);
+            std::size_t length = reader.read_length();
+            array_t<int_t> out_values(alloc);
+            // check before allocating so that a corrupt length can't make us allocate gigabytes
+            reader.require(length * reader.template min_number_size<int_t>);
+            out_values.resize(length);
+            reader.read_ints(out_values.data(), length);
+            ret.value = std::move(out_values);
             break;
         }
         case TAG_LONGARRAY: {
-            int_t length = internal::read(bytes, TAG_INT).i;
-            std::vector<long_t> out_values(length);
-            bytes.read((char*)out_values.data(), length * sizeof(long_t));
-            if (internal::is_little_endian())
-                for (long_t& val : out_values)
-                    val = __builtin_bswap64(val);
+            std::size_t length = reader.read_length();
+            array_t<long_t> out_values(alloc);
+            reader.require(length * reader.template min_number_size<long_t>);
+            out_values.resize(length);
+            reader.read_ints(out_values.data(), length);
+            ret.value = std::move(out_values);
             break;
         }
         case TAG_ARRAY: {
-            byte_t type = internal::read(bytes, TAG_BYTE).b;
-            uint_t length = internal::read(bytes, TAG_INT).i;
-            std::vector<NBTTag> out_values(length);
-            if (length == 0) out_values = {};
-            if (length > 0) for (int i = 0; i < length; ++i) out_values[i] = NBTTag::from_nbt(bytes, true, {type});
-            ret.value = out_values;
+            auto nesting = reader.nest();
+            byte_t type = reader.read_byte();
+            std::size_t length = reader.read_length();
+            array_t<NBTTag> out_values(alloc);
+            // every element takes up at least a byte (except for TAG_END lists, which must be empty anyway)
+            reader.require(length);
+            out_values.reserve(length);
+            for (std::size_t i = 0; i < length; ++i)
+                out_values.push_back(NBTTag::from_nbt(reader, true, {type}, alloc, symbols));
+            ret.value = std::move(out_values);
             break;
         }
         case TAG_COMPOUND: {
-            std::vector<NBTTag> out_values;
-            byte_t nextType = internal::read(bytes, TAG_BYTE).b;
+            auto nesting = reader.nest();
+            Compound out_values(alloc);
+            byte_t nextType = reader.read_byte();
             while (nextType != TAG_END) {
-                out_values.push_back(NBTTag::from_nbt(bytes, false, {nextType}));
-                nextType = internal::read(bytes, TAG_BYTE).b;
+                out_values.push_back(NBTTag::from_nbt(reader, false, {nextType}, alloc, symbols));
+                nextType = reader.read_byte();
             }
-            ret.value = out_values;
+            ret.value = std::move(out_values);
             break;
         }
         default: {
-            throw std::runtime_error("Found illegal type " + std::to_string(ret.type));
+            throw parse_error("Found illegal type " + std::to_string(ret.type) + " at offset " + std::to_string(start), start);
         }
     }
     return ret;
 }
 
-std::vector<byte_t> NBTTag::to_nbt() const {
-    std::vector<byte_t> nbt;
-    nbt.push_back(type);
-    short_t name_length = (short_t)(name.length());
-    nbt.insert(nbt.end(), {(byte_t)((name_length & internal::get_mask(1)) >> 8), (byte_t)(name_length & internal::get_mask(0))});
-    nbt.insert(nbt.end(), name.begin(), name.end());
-    switch (type) {
+template <NbtFormat F> std::size_t NBTTag::encoded_size(bool suppress_header) const {
+    using Writer = internal::BasicByteWriter<F>;
+    std::size_t size = 0;
+    if (!suppress_header) {
+        if (this->name.size() > 0xffff)
+            throw std::runtime_error("Name of tag " + this->name.str().substr(0, 32) + "... is too long to encode");
+        size += 1 + Writer::string_size(this->name.size());
+    }
+    switch (this->type) {
+        case TAG_BYTE:
+        case TAG_SHORT:
+        case TAG_FLOAT:
+        case TAG_DOUBLE:
+            return size + internal::fixed_payload_size(this->type);
+        case TAG_INT:
+            return size + Writer::number_size(std::get<int_t>(this->value));
+        case TAG_LONG:
+            return size + Writer::number_size(std::get<long_t>(this->value));
+        case TAG_STRING: {
+            const string_t& real_value = std::get<string_t>(this->value);
+            if (real_value.size() > 0xffff)
+                throw std::runtime_error("Value of string tag " + this->name + " is too long to encode");
+            return size + Writer::string_size(real_value.size());
+        }
+        case TAG_BYTEARRAY: {
+            const array_t<byte_t>& real_value = std::get<array_t<byte_t>>(this->value);
+            return size + Writer::length_size(real_value.size()) + real_value.size();
+        }
+        case TAG_INTARRAY: {
+            const array_t<int_t>& real_value = std::get<array_t<int_t>>(this->value);
+            return size + Writer::length_size(real_value.size()) + Writer::numbers_size(real_value.data(), real_value.size());
+        }
+        case TAG_LONGARRAY: {
+            const array_t<long_t>& real_value = std::get<array_t<long_t>>(this->value);
+            return size + Writer::length_size(real_value.size()) + Writer::numbers_size(real_value.data(), real_value.size());
+        }
+        case TAG_ARRAY: {
+            const array_t<NBTTag>& real_value = std::get<array_t<NBTTag>>(this->value);
+            size += 1 + Writer::length_size(real_value.size());
+            for (const NBTTag& tag : real_value) {
+                if (tag.type != real_value[0].type)
+                    throw std::runtime_error("Array tag " + this->name + " has elements of different types");
+                size += tag.encoded_size<F>(true);
+            }
+            return size;
+        }
+        case TAG_COMPOUND: {
+            for (const NBTTag& tag : std::get<Compound>(this->value))
+                size += tag.encoded_size<F>();
+            return size + 1;
+        }
+        default:
+            throw std::runtime_error("Tried to encode tag " + this->name + " of illegal type " + std::to_string(this->type));
+    }
+}
+std::size_t NBTTag::encoded_size(NbtFormat format, bool suppress_header) const {
+    return internal::with_format(format, [&](auto f) { return this->encoded_size<decltype(f)::value>(suppress_header); });
+}
+
+std::vector<byte_t> NBTTag::to_nbt(NbtFormat format) const {
+    return internal::with_format(format, [&](auto f) {
+        internal::PhaseTimer timer(stats::PHASE_SERIALIZE, 0);
+        std::vector<byte_t> nbt(this->encoded_size<decltype(f)::value>());
+        internal::BasicByteWriter<decltype(f)::value> writer(nbt.data());
+        this->to_nbt(writer);
+        timer.bytes_out = nbt.size();
+        return nbt;
+    });
+}
+std::size_t NBTTag::to_nbt(std::span<byte_t> out, NbtFormat format) const {
+    return internal::with_format(format, [&](auto f) {
+        std::size_t size = this->encoded_size<decltype(f)::value>();
+        if (out.size() < size)
+            throw std::runtime_error("Buffer of " + std::to_string(out.size()) + " bytes is too small to encode tag " + this->name + " (" + std::to_string(size) + " bytes)");
+        internal::PhaseTimer timer(stats::PHASE_SERIALIZE, 0);
+        internal::BasicByteWriter<decltype(f)::value> writer(out.data());
+        this->to_nbt(writer);
+        timer.bytes_out = size;
+        return size;
+    });
+}
+template <NbtFormat F> void NBTTag::to_nbt(internal::BasicByteWriter<F>& writer, bool suppress_header) const {
+    if (!suppress_header) {
+        writer.write_byte(this->type);
+        writer.write_string(this->name);
+    }
+    switch (this->type) {
         case TAG_BYTE: {
-            nbt.push_back((byte_t)(std::get<char>(value)));
+            writer.write_byte(std::get<char>(this->value));
             break;
         }
         case TAG_SHORT: {
-            nbt.insert(nbt.end(), {internal::get_highest_byte(std::get<short_t>(value) & internal::get_mask(1)), internal::get_highest_byte(std::get<short_t>(value) & internal::get_mask(0))});
+            writer.write_number(std::get<short_t>(this->value));
             break;
         }
         case TAG_INT: {
-            nbt.insert(nbt.end(), {internal::get_highest_byte(std::get<int_t>(value) & internal::get_mask(3)), internal::get_highest_byte(std::get<int_t>(value) & internal::get_mask(2)), internal::get_highest_byte(std::get<int_t>(value) & internal::get_mask(1)), internal::get_highest_byte(std::get<int_t>(value) & internal::get_mask(0))});
+            writer.write_number(std::get<int_t>(this->value));
             break;
         }
         case TAG_LONG: {
-            nbt.insert(nbt.end(), {internal::get_highest_byte(std::get<long_t>(value) & internal::get_mask(7)), internal::get_highest_byte(std::get<long_t>(value) & internal::get_mask(6)), internal::get_highest_byte(std::get<long_t>(value) & internal::get_mask(5)), internal::get_highest_byte(std::get<long_t>(value) & internal::get_mask(4)), internal::get_highest_byte(std::get<long_t>(value) & internal::get_mask(3)), internal::get_highest_byte(std::get<long_t>(value) & internal::get_mask(2)), internal::get_highest_byte(std::get<long_t>(value) & internal::get_mask(1)), internal::get_highest_byte(std::get<long_t>(value) & internal::get_mask(0))});
+            writer.write_number(std::get<long_t>(this->value));
             break;
         }
         case TAG_FLOAT: {
-            int_t val2;
-            float real_value = std::get<float>(value);
-            std::memcpy(&val2, &real_value, sizeof(real_value));
-            nbt.insert(nbt.end(), {internal::get_highest_byte(val2 & internal::get_mask(3)), internal::get_highest_byte(val2 & internal::get_mask(2)), internal::get_highest_byte(val2 & internal::get_mask(1)), internal::get_highest_byte(val2 & internal::get_mask(0))});
+            writer.write_float(std::get<float>(this->value));
             break;
         }
         case TAG_DOUBLE: {
-            long_t val2;
-            double real_value = std::get<double>(value);
-            std::memcpy(&val2, &real_value, sizeof(real_value));
-            nbt.insert(nbt.end(), {internal::get_highest_byte(val2 & internal::get_mask(7)), internal::get_highest_byte(val2 & internal::get_mask(6)), internal::get_highest_byte(val2 & internal::get_mask(5)), internal::get_highest_byte(val2 & internal::get_mask(4)), internal::get_highest_byte(val2 & internal::get_mask(3)), internal::get_highest_byte(val2 & internal::get_mask(2)), internal::get_highest_byte(val2 & internal::get_mask(1)), internal::get_highest_byte(val2 & internal::get_mask(0))});
+            writer.write_double(std::get<double>(this->value));
             break;
         }
         case TAG_STRING: {
-            short_t value_length = (short_t)(std::get<std::string>(value).length());
-            std::string real_value = std::get<std::string>(value);
-            nbt.insert(nbt.end(), {(byte_t)((value_length & 0xff00) >> 8), (byte_t)(value_length & 0xff)});
-            nbt.insert(nbt.end(), real_value.begin(), real_value.end());
+            writer.write_string(std::get<string_t>(this->value));
             break;
         }
         case TAG_BYTEARRAY: {
-            std::vector<NBTTag> real_value = std::get<std::vector<NBTTag>>(value);
-            int size = real_value.size();
-            nbt.insert(nbt.end(), {internal::get_highest_byte(size & internal::get_mask(3)), internal::get_highest_byte(size & internal::get_mask(2)), internal::get_highest_byte(size & internal::get_mask(1)), internal::get_highest_byte(size & internal::get_mask(0))});
-            for (int i = 0; i < real_value.size(); ++i) {
-                if (real_value[i].type != TAG_BYTE) throw;
-                std::vector<byte_t> inner_nbt = real_value[i].to_nbt();
-                nbt.insert(nbt.end(), inner_nbt.begin() + 3 + real_value[i].name.size(), inner_nbt.end());
-            }
+            const array_t<byte_t>& real_value = std::get<array_t<byte_t>>(this->value);
+            writer.write_length(real_value.size());
+            writer.write_bytes(real_value.data(), real_value.size());
             break;
         }
         case TAG_INTARRAY: {
-            std::vector<NBTTag> real_value = std::get<std::vector<NBTTag>>(value);
-            int size = real_value.size();
-            nbt.insert(nbt.end(), {internal::get_highest_byte(size & internal::get_mask(3)), internal::get_highest_byte(size & internal::get_mask(2)), internal::get_highest_byte(size & internal::get_mask(1)), internal::get_highest_byte(size & internal::get_mask(0))});
-            for (int i = 0; i < real_value.size(); ++i) {
-                if (real_value[i].type != TAG_INT) throw;
-                std::vector<byte_t> inner_nbt = real_value[i].to_nbt();
-                nbt.insert(nbt.end(), inner_nbt.begin() + 3 + real_value[i].name.size(), inner_nbt.end());
-            }
+            const array_t<int_t>& real_value = std::get<array_t<int_t>>(this->value);
+            writer.write_length(real_value.size());
+            writer.write_ints(real_value.data(), real_value.size());
             break;
         }
         case TAG_LONGARRAY: {
-            std::vector<NBTTag> real_value = std::get<std::vector<NBTTag>>(value);
-            int size = real_value.size();
-            nbt.insert(nbt.end(), {internal::get_highest_byte(size & internal::get_mask(3)), internal::get_highest_byte(size & internal::get_mask(2)), internal::get_highest_byte(size & internal::get_mask(1)), internal::get_highest_byte(size & internal::get_mask(0))});
-            for (int i = 0; i < real_value.size(); ++i) {
-                if (real_value[i].type != TAG_LONG) throw;
-                std::vector<byte_t> inner_nbt = real_value[i].to_nbt();
-                nbt.insert(nbt.end(), inner_nbt.begin() + 3 + real_value[i].name.size(), inner_nbt.end());
-            }
+            const array_t<long_t>& real_value = std::get<array_t<long_t>>(this->value);
+            writer.write_length(real_value.size());
+            writer.write_ints(real_value.data(), real_value.size());
             break;
         }
         case TAG_ARRAY: {
-            std::vector<NBTTag> real_value = std::get<std::vector<NBTTag>>(value);
-            byte_t tag_byte;
-            if (real_value.size() > 0) {
-                tag_byte = real_value[0].type;
-            } else {
-                tag_byte = TAG_END;
-            }
-            nbt.push_back(tag_byte);
-            int size = real_value.size();
-            nbt.insert(nbt.end(), {internal::get_highest_byte(size & internal::get_mask(3)), internal::get_highest_byte(size & internal::get_mask(2)), internal::get_highest_byte(size & internal::get_mask(1)), internal::get_highest_byte(size & internal::get_mask(0))});
-            for (int i = 0; i < real_value.size(); ++i) {
-                if (real_value[i].type != tag_byte) throw;
-                std::vector<byte_t> inner_nbt = real_value[i].to_nbt();
-                nbt.insert(nbt.end(), inner_nbt.begin() + 3 + real_value[i].name.size(), inner_nbt.end());
-            }
+            const array_t<NBTTag>& real_value = std::get<array_t<NBTTag>>(this->value);
+            writer.write_byte(real_value.empty() ? TAG_END : real_value[0].type);
+            writer.write_length(real_value.size());
+            // element types were checked by encoded_size()
+            for (const NBTTag& tag : real_value)
+                tag.to_nbt(writer, true);
             break;
         }
         case TAG_COMPOUND: {
-            std::vector<NBTTag> real_value = std::get<std::vector<NBTTag>>(value);
-            for (int i = 0; i < real_value.size(); ++i) {
-                std::vector<byte_t> inner_nbt = real_value[i].to_nbt();
-                nbt.insert(nbt.end(), inner_nbt.begin(), inner_nbt.end());
-            }
-            nbt.push_back(0);
+            for (const NBTTag& tag : std::get<Compound>(this->value))
+                tag.to_nbt(writer);
+            writer.write_byte(TAG_END);
             break;
         }
-        default: throw;
+        default:
+            throw std::runtime_error("Tried to encode tag " + this->name + " of illegal type " + std::to_string(this->type));
     }
-    return nbt;
 }
-void NBTTag::to_nbt(std::ostream& stream) const {
-    internal::writeb(stream, this->type);
-    internal::writestr(stream, this->name);
+void NBTTag::to_nbt(std::ostream& stream, bool suppress_header) const {
+    if (!suppress_header) {
+        internal::writeb(stream, this->type);
+        internal::writestr(stream, this->name);
+    }
     switch (this->type) {
         case TAG_BYTE: {
             internal::writeb(stream, std::get<char>(this->value));
@@ -641,35 +1443,32 @@ void NBTTag::to_nbt(std::ostream& stream) const {
             break;
         }
         case TAG_STRING: {
-            internal::writestr(stream, std::get<std::string>(this->value));
+            internal::writestr(stream, std::get<string_t>(this->value));
             break;
         }
         case TAG_BYTEARRAY: {
-            std::vector<byte_t> real_value = std::get<std::vector<byte_t>>(this->value);
+            const array_t<byte_t>& real_value = std::get<array_t<byte_t>>(this->value);
             uint_t size = real_value.size();
             internal::writei(stream, size);
-            for (byte_t byte : real_value)
-                internal::writeb(stream, byte);
+            stream.write((const char*)real_value.data(), size);
             break;
         }
         case TAG_INTARRAY: {
-            std::vector<int_t> real_value = std::get<std::vector<int_t>>(this->value);
+            const array_t<int_t>& real_value = std::get<array_t<int_t>>(this->value);
             uint_t size = real_value.size();
             internal::writei(stream, size);
-            for (int_t byte : real_value)
-                internal::writei(stream, byte);
+            internal::write_array<int_t>(stream, real_value);
             break;
         }
         case TAG_LONGARRAY: {
-            std::vector<long_t> real_value = std::get<std::vector<long_t>>(this->value);
+            const array_t<long_t>& real_value = std::get<array_t<long_t>>(this->value);
             uint_t size = real_value.size();
             internal::writei(stream, size);
-            for (long_t byte : real_value)
-                internal::writel(stream, byte);
+            internal::write_array<long_t>(stream, real_value);
             break;
         }
         case TAG_ARRAY: {
-            std::vector<NBTTag> real_value = std::get<std::vector<NBTTag>>(value);
+            const array_t<NBTTag>& real_value = std::get<array_t<NBTTag>>(value);
             byte_t tag_byte;
             uint_t size = real_value.size();
             if (size > 0)
@@ -679,14 +1478,14 @@ void NBTTag::to_nbt(std::ostream& stream) const {
             internal::writeb(stream, tag_byte);
             internal::writei(stream, size);
             for (const NBTTag& tag : real_value) {
-                if (tag.type != tag_byte) throw;
-                tag.to_nbt(stream);
+                if (tag.type != tag_byte)
+                    throw std::runtime_error("Array tag " + this->name + " has elements of different types");
+                tag.to_nbt(stream, true);
             }
             break;
         }
         case TAG_COMPOUND: {
-            std::vector<NBTTag> real_value = std::get<std::vector<NBTTag>>(value);
-            for (const NBTTag& tag : real_value)
+            for (const NBTTag& tag : std::get<Compound>(value))
                 tag.to_nbt(stream);
             internal::writeb(stream, TAG_END);
             break;
@@ -695,70 +1494,110 @@ void NBTTag::to_nbt(std::ostream& stream) const {
     }
 }
 
-std::string NBTTag::to_string(int tab_level) const {
-    std::string out;
-    for (int i = 0; i < tab_level; ++i) out += "\t";
-    switch (this->type) {
-        case TAG_BYTE: out += std::to_string(std::get<char>(this->value)) + "b"; break;
-        case TAG_SHORT: out += std::to_string(std::get<short>(this->value)) + "s"; break;
-        case TAG_INT: out += std::to_string(std::get<int_t>(this->value)) + "i"; break;
-        case TAG_LONG: out += std::to_string(std::get<long_t>(this->value)) + "l"; break;
-        case TAG_FLOAT: out += std::to_string(std::get<float>(this->value)) + "f"; break;
-        case TAG_DOUBLE: out += std::to_string(std::get<double>(this->value)) + "d"; break;
-        case TAG_STRING: out += "\"" + std::get<std::string>(this->value) + "\""; break;
-        case TAG_BYTEARRAY:
-        case TAG_INTARRAY:
-        case TAG_LONGARRAY:
+namespace internal {
+
+template <typename T> void append_elements(std::string& out, const array_t<T>& elements, const char* suffix, int tab_level) {
+    out += "[\n";
+    for (T element : elements) {
+        out.append(tab_level + 1, '\t');
+        // byte arrays are stored unsigned, but printed signed like byte tags
+        if constexpr (std::is_same_v<T, byte_t>)
+            out += std::to_string((signed char)element);
+        else
+            out += std::to_string(element);
+        out += suffix;
+        out += ",\n";
+    }
+    out += "]";
+}
+
+// Appends `tag.to_string(tab_level)` to `out`, so that a whole tree is printed into one string rather than into a temporary per tag.
+void append_string(std::string& out, const NBTTag& tag, int tab_level) {
+    out.append(tab_level, '\t');
+    switch (tag.type) {
+        case TAG_BYTE: out += std::to_string((signed char)std::get<char>(tag.value)); out += "b"; break;
+        case TAG_SHORT: out += std::to_string(std::get<short_t>(tag.value)); out += "s"; break;
+        case TAG_INT: out += std::to_string(std::get<int_t>(tag.value)); out += "i"; break;
+        case TAG_LONG: out += std::to_string(std::get<long_t>(tag.value)); out += "l"; break;
+        case TAG_FLOAT: out += std::to_string(std::get<float>(tag.value)); out += "f"; break;
+        case TAG_DOUBLE: out += std::to_string(std::get<double>(tag.value)); out += "d"; break;
+        case TAG_STRING: out += "\""; out += std::get<string_t>(tag.value); out += "\""; break;
+        case TAG_BYTEARRAY: append_elements(out, std::get<array_t<byte_t>>(tag.value), "b", tab_level); break;
+        case TAG_INTARRAY: append_elements(out, std::get<array_t<int_t>>(tag.value), "i", tab_level); break;
+        case TAG_LONGARRAY: append_elements(out, std::get<array_t<long_t>>(tag.value), "l", tab_level); break;
         case TAG_ARRAY: {
             out += "[\n";
-            for (int i = 0; i < std::get<std::vector<NBTTag>>(this->value).size(); ++i) {
-                out += std::get<std::vector<NBTTag>>(this->value)[i].to_string(tab_level + 1) + ",\n";
+            for (const NBTTag& element : std::get<array_t<NBTTag>>(tag.value)) {
+                append_string(out, element, tab_level + 1);
+                out += ",\n";
             }
             out += "]";
             break;
         }
         case TAG_COMPOUND: {
             out += "{\n";
-            for (int i = 0; i < std::get<std::vector<NBTTag>>(this->value).size(); ++i) {
-                out += std::get<std::vector<NBTTag>>(this->value)[i].name + ": " +  std::get<std::vector<NBTTag>>(this->value)[i].to_string(tab_level + 1) + ",\n";
+            for (const NBTTag& child : std::get<Compound>(tag.value)) {
+                out += child.name.str();
+                out += ": ";
+                append_string(out, child, tab_level + 1);
+                out += ",\n";
             }
             out += "}";
             break;
         }
-        default: throw;
+        default:
+            throw std::runtime_error("Tried to print tag " + tag.name + " of illegal type " + std::to_string(tag.type));
     }
+}
+
+}
+
+std::string NBTTag::to_string(int tab_level) const {
+    std::string out;
+    internal::append_string(out, *this, tab_level);
     return out;
 }
 
 NBTTag& NBTTag::operator[](const std::string& name) {
     switch (this->type) {
     case TAG_COMPOUND: {
-        std::vector<NBTTag> val = std::get<std::vector<NBTTag>>(this->value);
-        for (int i = 0; i < val.size(); ++i) if (val[i].name == name) return val[i];
-        std::get<std::vector<NBTTag>>(this->value).emplace_back(TAG_BYTE, name, 0);
+        Compound& val = std::get<Compound>(this->value);
+        if (NBTTag* tag = val.find(name)) return *tag;
+        return val.push_back(NBTTag(TAG_BYTE, name, (char)0));
     }
     default:
         throw std::runtime_error("Tried to get value by name " + name + " from tag " + this->name + ", but that tag is not a compound");
     }
 }
-NBTTag& NBTTag::at(const std::string& name) const {
+NBTTag& NBTTag::at(const Name& name) {
+    return const_cast<NBTTag&>(std::as_const(*this).at(name));
+}
+const NBTTag& NBTTag::at(const Name& name) const {
+    if (this->type != TAG_COMPOUND)
+        throw std::runtime_error("Tried to get value by name " + name + " from tag " + this->name + ", but that tag is not a compound");
+    if (const NBTTag* tag = std::get<Compound>(this->value).find(name)) return *tag;
+    throw std::runtime_error("Tried to get value by name " + name + " from tag " + this->name + ", but that value does not exist in the compound");
+}
+NBTTag& NBTTag::at(const std::string& name) {
+    return const_cast<NBTTag&>(std::as_const(*this).at(name));
+}
+const NBTTag& NBTTag::at(const std::string& name) const {
     switch (this->type) {
     case TAG_COMPOUND: {
-        std::vector<NBTTag> val = std::get<std::vector<NBTTag>>(this->value);
-        for (int i = 0; i < val.size(); ++i) if (val[i].name == name) return val[i];
+        if (const NBTTag* tag = std::get<Compound>(this->value).find(name)) return *tag;
         throw std::runtime_error("Tried to get value by name" + name + " from tag " + this->name + ", but that value does not exist in the compound");
     }
     default:
         throw std::runtime_error("Tried to get value by name " + name + " from tag " + this->name + ", but that tag is not a compound");
     }
 }
-NBTTag& NBTTag::operator[](std::size_t index) const {
+NBTTag& NBTTag::operator[](std::size_t index) {
+    return const_cast<NBTTag&>(std::as_const(*this)[index]);
+}
+const NBTTag& NBTTag::operator[](std::size_t index) const {
     switch (this->type) {
-        case TAG_BYTEARRAY:
-        case TAG_INTARRAY:
-        case TAG_LONGARRAY:
         case TAG_ARRAY: {
-            std::vector<NBTTag> val = std::get<std::vector<NBTTag>>(this->value);
+            const array_t<NBTTag>& val = std::get<array_t<NBTTag>>(this->value);
             if (val.size() <= index) {
                 throw std::runtime_error("Tried to get value by index " + std::to_string(index) + " from tag " + this->name + " which does not exist");
             }
@@ -770,122 +1609,130 @@ NBTTag& NBTTag::operator[](std::size_t index) const {
     }
 }
 
-template <> byte_t NBTTag::get<byte_t>() const {
-    if (this->type == TAG_BYTE) return std::get<byte_t>(this->value);
-    throw std::runtime_error("Tried to extract byte from non-byte tag " + this->name);
+template <NbtType T> T NBTTag::get() const {
+    using traits = internal::tag_traits<T>;
+    if (this->type != traits::tag)
+        throw std::runtime_error(std::string("Tried to extract ") + traits::name + " from non-" + traits::name + " tag " + this->name);
+    const typename traits::stored& val = std::get<typename traits::stored>(this->value);
+    if constexpr (std::is_same_v<T, typename traits::stored>)
+        return val;
+    else if constexpr (std::is_same_v<T, byte_t>)
+        return (byte_t)val;
+    else
+        // a standard container: copy out of the `std::pmr` one
+        return T(val.begin(), val.end());
 }
-template <> short_t NBTTag::get<short_t>() const {
-    if (this->type == TAG_SHORT) return std::get<short_t>(this->value);
-    throw std::runtime_error("Tried to extract short from non-short tag " + this->name);
+
+template <NbtType T> T& NBTTag::get_ref() {
+    return const_cast<T&>(std::as_const(*this).get_ref<T>());
 }
-template <> int_t NBTTag::get<int_t>() const {
-    if (this->type == TAG_INT) return std::get<int_t>(this->value);
-    throw std::runtime_error("Tried to extract int from non-int tag " + this->name);
+template <NbtType T> const T& NBTTag::get_ref() const {
+    static_assert(internal::NbtStoredType<T>, "get_ref() needs the type values are stored as (e.g. string_t rather than std::string)");
+    using traits = internal::tag_traits<T>;
+    if (this->type != traits::tag)
+        throw std::runtime_error(std::string("Tried to extract ") + traits::name + " from non-" + traits::name + " tag " + this->name);
+    // bytes are stored as `char`, which may be aliased as `byte_t`
+    return reinterpret_cast<const T&>(std::get<typename traits::stored>(this->value));
 }
-template <> long_t NBTTag::get<long_t>() const {
-    if (this->type == TAG_LONG) return std::get<long_t>(this->value);
-    throw std::runtime_error("Tried to extract long from non-long tag " + this->name);
+
+template <internal::NbtArrayElement T> std::span<T> NBTTag::span() {
+    return std::span<T>(this->get_ref<array_t<T>>());
 }
-template <> float NBTTag::get<float>() const {
-    if (this->type == TAG_FLOAT) return std::get<float>(this->value);
-    throw std::runtime_error("Tried to extract float from non-float tag " + this->name);
+template <internal::NbtArrayElement T> std::span<const T> NBTTag::span() const {
+    return std::span<const T>(this->get_ref<array_t<T>>());
 }
-template <> double NBTTag::get<double>() const {
-    if (this->type == TAG_DOUBLE) return std::get<double>(this->value);
-    throw std::runtime_error("Tried to extract double from non-double tag " + this->name);
+
+template <NbtType T> T NBTTag::take() {
+    return std::exchange(this->get_ref<T>(), T());
 }
-template <> std::string NBTTag::get<std::string>() const {
-    if (this->type == TAG_STRING) return std::get<std::string>(this->value);
-    throw std::runtime_error("Tried to extract string from non-string tag " + this->name);
+
+std::size_t NBTTag::size() const {
+    switch (this->type) {
+        case TAG_BYTEARRAY: return std::get<array_t<byte_t>>(this->value).size();
+        case TAG_INTARRAY: return std::get<array_t<int_t>>(this->value).size();
+        case TAG_LONGARRAY: return std::get<array_t<long_t>>(this->value).size();
+        case TAG_ARRAY: return std::get<array_t<NBTTag>>(this->value).size();
+        default:
+            throw std::runtime_error("Tried to use size() on non-array tag " + this->name);
+    }
 }
-template <> std::vector<byte_t> NBTTag::get<std::vector<byte_t>>() const {
-    if (this->type == TAG_BYTEARRAY) return std::get<std::vector<byte_t>>(this->value);
-    throw std::runtime_error("Tried to extract byte array from non-byte-array tag " + this->name);
+
+bool NBTTag::contains(const std::string& key) const {
+    if (this->type != TAG_COMPOUND)
+        throw std::runtime_error("Tried to use contains() on non-compound tag " + this->name);
+    return std::get<Compound>(this->value).contains(key);
 }
-template <> std::vector<int_t> NBTTag::get<std::vector<int_t>>() const {
-    if (this->type == TAG_INTARRAY) return std::get<std::vector<int_t>>(this->value);
-    throw std::runtime_error("Tried to extract int array from non-int-array tag " + this->name);
+bool NBTTag::contains(const Name& key) const {
+    if (this->type != TAG_COMPOUND)
+        throw std::runtime_error("Tried to use contains() on non-compound tag " + this->name);
+    return std::get<Compound>(this->value).contains(key);
 }
-template <> std::vector<long_t> NBTTag::get<std::vector<long_t>>() const {
-    if (this->type == TAG_LONGARRAY) return std::get<std::vector<long_t>>(this->value);
-    throw std::runtime_error("Tried to extract long array from non-long-array tag " + this->name);
+
+namespace internal {
+
+NBTTag read_nbt_compressed(CompressionScheme scheme, std::span<const byte_t> data, const NBTTag::allocator_type& alloc, SymbolTable* symbols, codec::Decompressor& decompressor) {
+    return NBTTag::from_nbt(decompressor.decompress(scheme, data), nullptr, alloc, symbols);
 }
-template <> std::vector<NBTTag> NBTTag::get<std::vector<NBTTag>>() const {
-    if (this->type == TAG_ARRAY) return std::get<std::vector<NBTTag>>(this->value);
-    throw std::runtime_error("Tried to extract array from non-array tag " + this->name);
+
+void write_nbt_compressed(CompressionScheme scheme, std::ostream& stream, const NBTTag& tag, int level) {
+    std::vector<byte_t> compressed;
+    codec::compress(scheme, tag.to_nbt(), compressed, level);
+    PhaseTimer timer(stats::PHASE_WRITE, compressed.size());
+    stream.write((const char*)compressed.data(), compressed.size());
 }
 
-std::size_t NBTTag::size() const {}
+}
 
-bool NBTTag::contains(const std::string& key) const {
-    if (this->type != TAG_COMPOUND)
-        throw std::runtime_error("Tried to use contains() on non-compound tag " + this->name);
-    return std::any_of(std::get<std::vector<NBTTag>>(this->value).begin(), std::get<std::vector<NBTTag>>(this->value).end(),
-        [key](const NBTTag& tag) { return tag.name == key; });
+/// @brief Parses gzip-compressed NBT data that is already in memory.
+/// @param data The compressed data.
+/// @param alloc The allocator to allocate the tag's strings and arrays with.
+/// @param symbols If not null, the table to intern tag names in.
+/// @param decompressor The decompressor to decompress the data with. Defaults to the calling thread's, which is reused across calls.
+/// @return The parsed tag.
+NBTTag read_nbt_gzip(std::span<const byte_t> data, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr, codec::Decompressor& decompressor = codec::Decompressor::local()) {
+    return internal::read_nbt_compressed(GZIP, data, alloc, symbols, decompressor);
+}
+/// @brief Parses gzip-compressed NBT data from the rest of a stream.
+NBTTag read_nbt_gzip(std::istream& stream, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr, codec::Decompressor& decompressor = codec::Decompressor::local()) {
+    return read_nbt_gzip(internal::read_all(stream), alloc, symbols, decompressor);
+}
+NBTTag read_nbt_gzip(const std::string& path, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr, codec::Decompressor& decompressor = codec::Decompressor::local()) {
+    std::ifstream input(path, std::ios::binary);
+    return read_nbt_gzip(input, alloc, symbols, decompressor);
 }
 
-NBTTag read_nbt_gzip(const std::string& path) {
+/// @brief Parses zlib-compressed NBT data that is already in memory. See `read_nbt_gzip(std::span<const byte_t>, const NBTTag::allocator_type&, SymbolTable*, codec::Decompressor&)`.
+NBTTag read_nbt_zlib(std::span<const byte_t> data, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr, codec::Decompressor& decompressor = codec::Decompressor::local()) {
+    return internal::read_nbt_compressed(ZLIB, data, alloc, symbols, decompressor);
+}
+/// @brief Parses zlib-compressed NBT data from the rest of a stream.
+NBTTag read_nbt_zlib(std::istream& stream, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr, codec::Decompressor& decompressor = codec::Decompressor::local()) {
+    return read_nbt_zlib(internal::read_all(stream), alloc, symbols, decompressor);
+}
+NBTTag read_nbt_zlib(const std::string& path, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr, codec::Decompressor& decompressor = codec::Decompressor::local()) {
     std::ifstream input(path, std::ios::binary);
-    boost::iostreams::filtering_istreambuf buf;
-    buf.push(boost::iostreams::gzip_decompressor());
-    buf.push(input);
-    std::istream gzstream(&buf);
-    return NBTTag::from_nbt(gzstream);
+    return read_nbt_zlib(input, alloc, symbols, decompressor);
+}
+
+/// @brief Writes a tag as gzip-compressed NBT data.
+/// @param path The file to write to.
+/// @param tag The tag to write.
+/// @param level The compression level. See `codec::compress()`.
+void write_nbt_gzip(const std::string& path, const NBTTag& tag, int level = codec::default_level) {
+    std::ofstream output(path, std::ios::binary);
+    internal::write_nbt_compressed(GZIP, output, tag, level);
 }
-NBTTag read_nbt_gzip(std::istream& stream) {
-    boost::iostreams::filtering_istreambuf buf;
-    buf.push(boost::iostreams::gzip_decompressor());
-    buf.push(stream);
-    std::istream gzstream(&buf);
-    return NBTTag::from_nbt(gzstream);
+void write_nbt_gzip(std::ostream& stream, const NBTTag& tag, int level = codec::default_level) {
+    internal::write_nbt_compressed(GZIP, stream, tag, level);
 }
 
-NBTTag read_nbt_zlib(const std::string& path) {
-    std::ifstream input(path, std::ios::binary);
-    boost::iostreams::filtering_istreambuf buf;
-    buf.push(boost::iostreams::zlib_decompressor());
-    buf.push(input);
-    std::istream gzstream(&buf);
-    return NBTTag::from_nbt(gzstream);
-}
-NBTTag read_nbt_zlib(std::istream& stream) {
-    boost::iostreams::filtering_istreambuf buf;
-    buf.push(boost::iostreams::zlib_decompressor());
-    buf.push(stream);
-    std::istream gzstream(&buf);
-    return NBTTag::from_nbt(gzstream);
-}
-
-void write_nbt_gzip(const std::string& path, const NBTTag& tag) {
-    std::ofstream input(path, std::ios::binary);
-    boost::iostreams::filtering_ostreambuf buf;
-    buf.push(boost::iostreams::gzip_compressor());
-    buf.push(input);
-    std::ostream gzstream(&buf);
-    tag.to_nbt(gzstream);
-}
-void write_nbt_gzip(std::ostream& stream, const NBTTag& tag) {
-    boost::iostreams::filtering_ostreambuf buf;
-    buf.push(boost::iostreams::gzip_compressor());
-    buf.push(stream);
-    std::ostream gzstream(&buf);
-    tag.to_nbt(gzstream);
-}
-
-void write_nbt_zlib(const std::string& path, const NBTTag& tag) {
-    std::ofstream input(path, std::ios::binary);
-    boost::iostreams::filtering_ostreambuf buf;
-    buf.push(boost::iostreams::zlib_compressor());
-    buf.push(input);
-    std::ostream zstream(&buf);
-    tag.to_nbt(zstream);
-}
-void write_nbt_zlib(std::ostream& stream, const NBTTag& tag) {
-    boost::iostreams::filtering_ostreambuf buf;
-    buf.push(boost::iostreams::zlib_compressor());
-    buf.push(stream);
-    std::ostream zstream(&buf);
-    tag.to_nbt(zstream);
+/// @brief Writes a tag as zlib-compressed NBT data. See `write_nbt_gzip()`.
+void write_nbt_zlib(const std::string& path, const NBTTag& tag, int level = codec::default_level) {
+    std::ofstream output(path, std::ios::binary);
+    internal::write_nbt_compressed(ZLIB, output, tag, level);
+}
+void write_nbt_zlib(std::ostream& stream, const NBTTag& tag, int level = codec::default_level) {
+    internal::write_nbt_compressed(ZLIB, stream, tag, level);
 }
 
 
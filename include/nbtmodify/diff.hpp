@@ -0,0 +1,402 @@
+#ifndef DIFF_HPP
+#define DIFF_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "core.hpp"
+
+// Hashing and diffing trees: telling cheaply whether a tree has changed, and describing how, so that only the changes need to be written or sent.
+
+namespace nbt {
+
+/// @brief How `hash_tag()` treats the order of the children of compounds.
+enum HashMode {
+    /// @brief Compounds whose children are in different orders hash differently. Two trees with the same ordered hash encode to the same bytes.
+    HASH_ORDERED,
+    /// @brief Compounds hash the same whatever order their children are in, as Minecraft treats them. Lists are always ordered.
+    HASH_UNORDERED
+};
+
+namespace internal {
+
+// The finaliser of SplitMix64: every bit of the input affects every bit of the output.
+constexpr std::uint64_t mix_hash(std::uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ull;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+
+// Order-sensitive: combining a then b differs from b then a.
+constexpr std::uint64_t combine_hash(std::uint64_t seed, std::uint64_t value) {
+    return mix_hash(seed ^ (value + 0x9e3779b97f4a7c15ull));
+}
+
+// Hashes a word at a time, which is what makes hashing large arrays cheap.
+std::uint64_t hash_bytes(std::uint64_t seed, const void* data, std::size_t size) {
+    const byte_t* bytes = static_cast<const byte_t*>(data);
+    std::uint64_t hash = combine_hash(seed, size);
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        hash = combine_hash(hash, word);
+    }
+    if (i < size) {
+        std::uint64_t word = 0;
+        std::memcpy(&word, bytes + i, size - i);
+        hash = combine_hash(hash, word);
+    }
+    return hash;
+}
+
+std::uint64_t hash_tag(const NBTTag& tag, HashMode mode, bool with_name) {
+    std::uint64_t hash = combine_hash(0, tag.type);
+    if (with_name) {
+        const std::string& name = tag.name.str();
+        hash = hash_bytes(hash, name.data(), name.size());
+    }
+    switch (tag.type) {
+        case TAG_BYTE: return combine_hash(hash, (byte_t)std::get<char>(tag.value));
+        case TAG_SHORT: return combine_hash(hash, (ushort_t)std::get<short_t>(tag.value));
+        case TAG_INT: return combine_hash(hash, (uint_t)std::get<int_t>(tag.value));
+        case TAG_LONG: return combine_hash(hash, (ulong_t)std::get<long_t>(tag.value));
+        // by their bits, so that a NaN hashes the same as itself
+        case TAG_FLOAT: return combine_hash(hash, std::bit_cast<uint_t>(std::get<float>(tag.value)));
+        case TAG_DOUBLE: return combine_hash(hash, std::bit_cast<ulong_t>(std::get<double>(tag.value)));
+        case TAG_STRING: {
+            const string_t& value = std::get<string_t>(tag.value);
+            return hash_bytes(hash, value.data(), value.size());
+        }
+        case TAG_BYTEARRAY: {
+            const array_t<byte_t>& value = std::get<array_t<byte_t>>(tag.value);
+            return hash_bytes(hash, value.data(), value.size());
+        }
+        case TAG_INTARRAY: {
+            const array_t<int_t>& value = std::get<array_t<int_t>>(tag.value);
+            return hash_bytes(hash, value.data(), value.size() * sizeof(int_t));
+        }
+        case TAG_LONGARRAY: {
+            const array_t<long_t>& value = std::get<array_t<long_t>>(tag.value);
+            return hash_bytes(hash, value.data(), value.size() * sizeof(long_t));
+        }
+        case TAG_ARRAY: {
+            const array_t<NBTTag>& value = std::get<array_t<NBTTag>>(tag.value);
+            hash = combine_hash(hash, value.size());
+            for (const NBTTag& element : value)
+                hash = combine_hash(hash, hash_tag(element, mode, false));
+            return hash;
+        }
+        case TAG_COMPOUND: {
+            const Compound& value = std::get<Compound>(tag.value);
+            if (mode == HASH_ORDERED) {
+                for (const NBTTag& child : value)
+                    hash = combine_hash(hash, hash_tag(child, mode, true));
+                return combine_hash(hash, value.size());
+            }
+            // a sum doesn't depend on the order it is taken in, and every child's hash is already well mixed
+            std::uint64_t sum = 0;
+            for (const NBTTag& child : value)
+                sum += hash_tag(child, mode, true);
+            return combine_hash(combine_hash(hash, sum), value.size());
+        }
+        default:
+            throw std::runtime_error("Tried to hash tag " + tag.name + " of illegal type " + std::to_string(tag.type));
+    }
+}
+
+}
+
+/// @brief Computes a 64-bit hash of a tree: its types, names and values.
+/// Meant for telling whether a tree has changed (such as a chunk since it was read) without keeping a copy to compare with.
+/// @param tag The root of the tree. Its own name is included.
+/// @param mode Whether the order of the children of compounds matters. See `HashMode`.
+/// @return The hash. Different trees hash the same only by (very unlikely) accident.
+/// @note Floating-point values are hashed by their bits, so `0.0` and `-0.0` hash differently, and a NaN hashes the same as itself.
+/// @note Hashes are the same from one run to the next, but may change between versions of the library, and arrays are hashed in the machine's byte order.
+/// Don't store them, or compare them between machines, unless that is known to be the same.
+/// @exception Throws if a tag in the tree is of an illegal type.
+std::uint64_t hash_tag(const NBTTag& tag, HashMode mode = HASH_ORDERED) {
+    return internal::hash_tag(tag, mode, true);
+}
+
+/// @brief A step along the path to a tag: the name of a child of a compound, or the index of an element of a list.
+using PatchStep = std::variant<std::string, std::size_t>;
+
+/// @brief What a `PatchEntry` does.
+enum PatchOp {
+    /// @brief Sets the tag at the path to the entry's value. If the last step is the name of a child that doesn't exist, the child is added to the end of the compound,
+    /// and if it is the index just past the end of a list, the value is appended.
+    PATCH_SET,
+    /// @brief Removes the tag at the path from its compound or list. Elements after it in a list move down.
+    PATCH_REMOVE
+};
+
+/// @brief A single change to a tree.
+struct PatchEntry {
+    PatchOp op;
+    /// @brief The path to the changed tag, from the root. Empty to replace the root itself.
+    std::vector<PatchStep> path;
+    /// @brief The new value, for `PATCH_SET`. Its name is ignored: the tag keeps the name it is set at.
+    NBTTag value;
+};
+
+/// @brief A list of changes that turns one tree into another, applied in order. See `diff_tags()`.
+using Patch = std::vector<PatchEntry>;
+
+namespace internal {
+
+// Compares the values of two tags that have no children.
+bool same_leaf(const NBTTag& lhs, const NBTTag& rhs) {
+    switch (lhs.type) {
+        case TAG_BYTE: return std::get<char>(lhs.value) == std::get<char>(rhs.value);
+        case TAG_SHORT: return std::get<short_t>(lhs.value) == std::get<short_t>(rhs.value);
+        case TAG_INT: return std::get<int_t>(lhs.value) == std::get<int_t>(rhs.value);
+        case TAG_LONG: return std::get<long_t>(lhs.value) == std::get<long_t>(rhs.value);
+        // by their bits, as in hash_tag()
+        case TAG_FLOAT: return std::bit_cast<uint_t>(std::get<float>(lhs.value)) == std::bit_cast<uint_t>(std::get<float>(rhs.value));
+        case TAG_DOUBLE: return std::bit_cast<ulong_t>(std::get<double>(lhs.value)) == std::bit_cast<ulong_t>(std::get<double>(rhs.value));
+        case TAG_STRING: return std::get<string_t>(lhs.value) == std::get<string_t>(rhs.value);
+        case TAG_BYTEARRAY: return std::get<array_t<byte_t>>(lhs.value) == std::get<array_t<byte_t>>(rhs.value);
+        case TAG_INTARRAY: return std::get<array_t<int_t>>(lhs.value) == std::get<array_t<int_t>>(rhs.value);
+        case TAG_LONGARRAY: return std::get<array_t<long_t>>(lhs.value) == std::get<array_t<long_t>>(rhs.value);
+        default: return false;
+    }
+}
+
+Tag list_element_type(const array_t<NBTTag>& elements) {
+    return elements.empty() ? TAG_END : elements[0].type;
+}
+
+void diff_tags(const NBTTag& from, const NBTTag& to, std::vector<PatchStep>& path, Patch& out) {
+    auto set = [&] { out.push_back(PatchEntry{PATCH_SET, path, to}); };
+    if (from.type != to.type) return set();
+    switch (from.type) {
+        case TAG_COMPOUND: {
+            const Compound& from_children = std::get<Compound>(from.value);
+            const Compound& to_children = std::get<Compound>(to.value);
+            for (const NBTTag& child : from_children) {
+                if (!to_children.find(std::string_view(child.name))) {
+                    path.push_back(child.name.str());
+                    out.push_back(PatchEntry{PATCH_REMOVE, path, NBTTag()});
+                    path.pop_back();
+                }
+            }
+            for (const NBTTag& child : to_children) {
+                path.push_back(child.name.str());
+                if (const NBTTag* old_child = from_children.find(std::string_view(child.name)))
+                    diff_tags(*old_child, child, path, out);
+                else
+                    out.push_back(PatchEntry{PATCH_SET, path, child});
+                path.pop_back();
+            }
+            return;
+        }
+        case TAG_ARRAY: {
+            const array_t<NBTTag>& from_elements = std::get<array_t<NBTTag>>(from.value);
+            const array_t<NBTTag>& to_elements = std::get<array_t<NBTTag>>(to.value);
+            // a list can't hold elements of two types, even for a moment, so one whose type changes is replaced whole
+            if (!from_elements.empty() && !to_elements.empty() && list_element_type(from_elements) != list_element_type(to_elements)) return set();
+            if (from_elements.empty() != to_elements.empty()) return set();
+            std::size_t common = std::min(from_elements.size(), to_elements.size());
+            for (std::size_t i = 0; i < common; ++i) {
+                path.push_back(i);
+                diff_tags(from_elements[i], to_elements[i], path, out);
+                path.pop_back();
+            }
+            for (std::size_t i = common; i < to_elements.size(); ++i) {
+                path.push_back(i);
+                out.push_back(PatchEntry{PATCH_SET, path, to_elements[i]});
+                path.pop_back();
+            }
+            // removed from the end, so that no element has to move
+            for (std::size_t i = from_elements.size(); i > common; --i) {
+                path.push_back(i - 1);
+                out.push_back(PatchEntry{PATCH_REMOVE, path, NBTTag()});
+                path.pop_back();
+            }
+            return;
+        }
+        default:
+            if (!same_leaf(from, to)) set();
+    }
+}
+
+std::string describe_path(const std::vector<PatchStep>& path, std::size_t length) {
+    std::string ret;
+    for (std::size_t i = 0; i < length; ++i) {
+        if (const std::string* key = std::get_if<std::string>(&path[i]))
+            ret += (ret.empty() ? "" : ".") + *key;
+        else
+            ret += "[" + std::to_string(std::get<std::size_t>(path[i])) + "]";
+    }
+    return ret.empty() ? "the root" : ret;
+}
+
+}
+
+/// @brief Finds the changes that turn one tree into another.
+/// Compounds are compared child by child, and lists element by element, so a change deep inside a chunk becomes one small entry rather than a copy of the chunk.
+/// Leaves (and lists whose element type changes) that differ are replaced whole.
+/// @param from The tree to start from.
+/// @param to The tree to end up with.
+/// @return The changes, which `apply_patch()` applies to `from` to make it equal to `to`. Empty if the trees are the same.
+/// @note Children of compounds are matched by name, so children that have only moved are not counted as changed, and children that are added go on the end.
+/// The patched tree is equal to `to` (as far as `hash_tag(tag, HASH_UNORDERED)` is concerned), but its compounds may list their children in a different order.
+/// Elements of lists are matched by position, so an element inserted at the start of a list changes every element after it.
+Patch diff_tags(const NBTTag& from, const NBTTag& to) {
+    Patch ret;
+    std::vector<PatchStep> path;
+    internal::diff_tags(from, to, path, ret);
+    return ret;
+}
+
+/// @brief Applies changes to a tree, in order.
+/// @param tag The root of the tree to change.
+/// @param patch The changes. See `diff_tags()`.
+/// @exception Throws if a path doesn't lead to a tag (e.g. it names a child of a tag that isn't a compound, or a list index is out of range),
+/// or if a value doesn't fit the list it is set in. Entries before the one that failed stay applied.
+void apply_patch(NBTTag& tag, const Patch& patch) {
+    for (const PatchEntry& entry : patch) {
+        if (entry.path.empty()) {
+            if (entry.op == PATCH_REMOVE)
+                throw std::runtime_error("Tried to apply a patch that removes the root tag");
+            // the root keeps its name, as every other tag does
+            tag.type = entry.value.type;
+            tag.value = entry.value.value;
+            continue;
+        }
+        NBTTag* parent = &tag;
+        for (std::size_t i = 0; i + 1 < entry.path.size(); ++i) {
+            const PatchStep& step = entry.path[i];
+            if (const std::string* key = std::get_if<std::string>(&step)) {
+                NBTTag* child = parent->type == TAG_COMPOUND ? parent->get_ref<Compound>().find(std::string_view(*key)) : nullptr;
+                if (!child)
+                    throw std::runtime_error("Tried to apply a patch at " + internal::describe_path(entry.path, entry.path.size()) + ", but " + internal::describe_path(entry.path, i + 1) + " does not exist");
+                parent = child;
+            } else {
+                std::size_t index = std::get<std::size_t>(step);
+                if (parent->type != TAG_ARRAY || index >= parent->size())
+                    throw std::runtime_error("Tried to apply a patch at " + internal::describe_path(entry.path, entry.path.size()) + ", but " + internal::describe_path(entry.path, i + 1) + " does not exist");
+                parent = &(*parent)[index];
+            }
+        }
+
+        const PatchStep& last = entry.path.back();
+        std::string where = internal::describe_path(entry.path, entry.path.size());
+        if (const std::string* key = std::get_if<std::string>(&last)) {
+            if (parent->type != TAG_COMPOUND)
+                throw std::runtime_error("Tried to apply a patch at " + where + ", but its parent is not a compound");
+            Compound& children = parent->get_ref<Compound>();
+            if (entry.op == PATCH_REMOVE) {
+                if (!children.erase(std::string_view(*key)))
+                    throw std::runtime_error("Tried to apply a patch that removes " + where + ", but it does not exist");
+            } else if (NBTTag* child = children.find(std::string_view(*key))) {
+                child->type = entry.value.type;
+                child->value = NBTTag(entry.value, children.get_allocator()).value;
+            } else {
+                NBTTag& added = children.push_back(NBTTag(entry.value, children.get_allocator()));
+                added.name = Name(*key);
+            }
+        } else {
+            std::size_t index = std::get<std::size_t>(last);
+            if (parent->type != TAG_ARRAY)
+                throw std::runtime_error("Tried to apply a patch at " + where + ", but its parent is not a list");
+            array_t<NBTTag>& elements = parent->get_ref<array_t<NBTTag>>();
+            if (entry.op == PATCH_REMOVE) {
+                if (index >= elements.size())
+                    throw std::runtime_error("Tried to apply a patch that removes " + where + ", but it does not exist");
+                elements.erase(elements.begin() + (std::ptrdiff_t)index);
+                continue;
+            }
+            if (index > elements.size())
+                throw std::runtime_error("Tried to apply a patch at " + where + ", but the list only has " + std::to_string(elements.size()) + " elements");
+            // the list may only change type while it is empty, or while this is its only element
+            if (!elements.empty() && !(elements.size() == 1 && index == 0) && elements[0].type != entry.value.type)
+                throw std::runtime_error("Tried to apply a patch that sets " + where + " to a " + get_tag_type(entry.value.type) + " tag, but the list holds " + get_tag_type(elements[0].type) + " tags");
+            NBTTag element(entry.value, elements.get_allocator());
+            element.name = Name();
+            if (index == elements.size())
+                elements.push_back(std::move(element));
+            else
+                elements[index] = std::move(element);
+        }
+    }
+}
+
+/// @brief Stores a patch as a tree, so that it can be encoded (e.g. with `NBTTag::to_nbt()`) and sent or saved.
+/// The patch becomes a list of compounds, one per entry, each holding `op` (`"set"` or `"remove"`), the path as `keys` (strings, empty for list indices) and `indices` (an int array, -1 for keys),
+/// and, for `"set"`, the `value`.
+/// @param patch The patch.
+/// @param name The name of the root tag.
+/// @return The tree.
+NBTTag patch_to_tag(const Patch& patch, std::string_view name = "") {
+    std::vector<NBTTag> entries;
+    entries.reserve(patch.size());
+    for (const PatchEntry& entry : patch) {
+        std::vector<NBTTag> keys;
+        std::vector<int_t> indices;
+        for (const PatchStep& step : entry.path) {
+            if (const std::string* key = std::get_if<std::string>(&step)) {
+                keys.push_back(NBTTag(TAG_STRING, "", *key));
+                indices.push_back(-1);
+            } else {
+                keys.push_back(NBTTag(TAG_STRING, "", std::string()));
+                indices.push_back((int_t)std::get<std::size_t>(step));
+            }
+        }
+        Compound fields;
+        fields.push_back(NBTTag(TAG_STRING, "op", std::string(entry.op == PATCH_SET ? "set" : "remove")));
+        fields.push_back(NBTTag(TAG_ARRAY, "keys", keys));
+        fields.push_back(NBTTag(TAG_INTARRAY, "indices", indices));
+        if (entry.op == PATCH_SET) {
+            NBTTag& value = fields.push_back(entry.value);
+            value.name = Name("value");
+        }
+        entries.push_back(NBTTag(TAG_COMPOUND, "", std::move(fields)));
+    }
+    return NBTTag(TAG_ARRAY, name, entries);
+}
+
+/// @brief Reads back a patch stored with `patch_to_tag()`.
+/// @param tag The tree.
+/// @return The patch.
+/// @exception Throws if the tree is not a patch.
+Patch patch_from_tag(const NBTTag& tag) {
+    Patch ret;
+    const array_t<NBTTag>& entries = tag.get_ref<array_t<NBTTag>>();
+    ret.reserve(entries.size());
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        const NBTTag& entry = entries[i];
+        std::string op = entry.at("op").get<std::string>();
+        const array_t<NBTTag>& keys = entry.at("keys").get_ref<array_t<NBTTag>>();
+        std::span<const int_t> indices = entry.at("indices").span<int_t>();
+        if (op != "set" && op != "remove")
+            throw std::runtime_error("Tried to read patch entry " + std::to_string(i) + ", but its op " + op + " is not \"set\" or \"remove\"");
+        if (keys.size() != indices.size())
+            throw std::runtime_error("Tried to read patch entry " + std::to_string(i) + ", but it has " + std::to_string(keys.size()) + " keys and " + std::to_string(indices.size()) + " indices");
+        PatchEntry out{op == "set" ? PATCH_SET : PATCH_REMOVE, {}, NBTTag()};
+        out.path.reserve(keys.size());
+        for (std::size_t j = 0; j < keys.size(); ++j) {
+            if (indices[j] < 0)
+                out.path.push_back(keys[j].get<std::string>());
+            else
+                out.path.push_back((std::size_t)indices[j]);
+        }
+        if (out.op == PATCH_SET)
+            out.value = entry.at("value");
+        ret.push_back(std::move(out));
+    }
+    return ret;
+}
+
+}
+
+#endif
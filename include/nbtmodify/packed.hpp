@@ -0,0 +1,131 @@
+#ifndef PACKED_HPP
+#define PACKED_HPP
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "core.hpp"
+
+// Packed palette indices, as stored in the `data` arrays of chunk sections' `block_states` and `biomes`.
+// Since 1.16, each long holds as many whole indices as fit (64 / bits), starting from its least significant bits, and no index spans two longs.
+// There is a kernel for every bit width, each of which has a constant number of indices per long, so its inner loop is unrolled
+// into straight-line shifts and masks (which the compiler is also free to vectorise).
+
+namespace nbt {
+
+/// @brief The widest indices that can be packed or unpacked.
+constexpr unsigned max_bits_per_entry = 16;
+
+namespace internal {
+
+using unpack_kernel = void (*)(const long_t* data, std::size_t count, uint16_t* out);
+using pack_kernel = void (*)(const uint16_t* indices, std::size_t count, long_t* out);
+
+namespace kernels {
+
+template <unsigned Bits> void unpack_fixed(const long_t* data, std::size_t count, uint16_t* out) {
+    constexpr unsigned per_long = 64 / Bits;
+    constexpr uint64_t mask = (uint64_t(1) << Bits) - 1;
+    std::size_t full = count / per_long;
+    for (std::size_t w = 0; w < full; ++w) {
+        uint64_t word = (uint64_t)data[w];
+        for (unsigned j = 0; j < per_long; ++j)
+            out[w * per_long + j] = (uint16_t)((word >> (j * Bits)) & mask);
+    }
+    uint64_t word = full * per_long < count ? (uint64_t)data[full] : 0;
+    for (std::size_t i = full * per_long, j = 0; i < count; ++i, ++j)
+        out[i] = (uint16_t)((word >> (j * Bits)) & mask);
+}
+
+template <unsigned Bits> void pack_fixed(const uint16_t* indices, std::size_t count, long_t* out) {
+    constexpr unsigned per_long = 64 / Bits;
+    constexpr uint64_t mask = (uint64_t(1) << Bits) - 1;
+    std::size_t full = count / per_long;
+    for (std::size_t w = 0; w < full; ++w) {
+        uint64_t word = 0;
+        for (unsigned j = 0; j < per_long; ++j)
+            word |= (indices[w * per_long + j] & mask) << (j * Bits);
+        out[w] = (long_t)word;
+    }
+    if (full * per_long < count) {
+        uint64_t word = 0;
+        for (std::size_t i = full * per_long, j = 0; i < count; ++i, ++j)
+            word |= (indices[i] & mask) << (j * Bits);
+        out[full] = (long_t)word;
+    }
+}
+
+template <std::size_t... Widths> constexpr std::array<unpack_kernel, sizeof...(Widths)> make_unpack_kernels(std::index_sequence<Widths...>) {
+    return {unpack_fixed<Widths + 1>...};
+}
+template <std::size_t... Widths> constexpr std::array<pack_kernel, sizeof...(Widths)> make_pack_kernels(std::index_sequence<Widths...>) {
+    return {pack_fixed<Widths + 1>...};
+}
+
+// indexed by bits per entry - 1
+constexpr std::array<unpack_kernel, max_bits_per_entry> unpack_kernels = make_unpack_kernels(std::make_index_sequence<max_bits_per_entry>());
+constexpr std::array<pack_kernel, max_bits_per_entry> pack_kernels = make_pack_kernels(std::make_index_sequence<max_bits_per_entry>());
+
+}
+
+void check_bits_per_entry(unsigned bits) {
+    if (bits == 0 || bits > max_bits_per_entry)
+        throw std::runtime_error("Tried to pack or unpack indices of " + std::to_string(bits) + " bits, but only 1 to " + std::to_string(max_bits_per_entry) + " bits are supported");
+}
+
+}
+
+/// @brief Gets the number of longs that a number of packed indices take up.
+/// @param count The number of indices.
+/// @param bits The number of bits per index (1 to 16).
+/// @return The number of longs.
+std::size_t packed_length(std::size_t count, unsigned bits) {
+    internal::check_bits_per_entry(bits);
+    std::size_t per_long = 64 / bits;
+    return (count + per_long - 1) / per_long;
+}
+
+/// @brief Gets the number of bits per index that Minecraft uses for a palette.
+/// @param palette_size The number of entries in the palette.
+/// @param min_bits The fewest bits that are ever used: 4 for block states, and 1 for biomes.
+/// @return The number of bits per index.
+/// @note A palette with one entry needs no indices at all, and its `data` array is left out of the section. This still returns `min_bits` for it.
+unsigned bits_per_entry(std::size_t palette_size, unsigned min_bits) {
+    unsigned bits = palette_size > 1 ? (unsigned)std::bit_width(palette_size - 1) : 0;
+    return bits > min_bits ? bits : min_bits;
+}
+
+/// @brief Expands packed indices into one `uint16_t` each.
+/// @param data The packed indices.
+/// @param bits The number of bits per index (1 to 16).
+/// @param out Receives the indices. Its size is the number of indices to unpack (4096 for a section's blocks, or 64 for its biomes).
+/// @exception Throws if `bits` is out of range, or if `data` is too short to hold `out.size()` indices.
+void unpack_indices(std::span<const long_t> data, unsigned bits, std::span<uint16_t> out) {
+    std::size_t needed = packed_length(out.size(), bits);
+    if (data.size() < needed)
+        throw std::runtime_error("Tried to unpack " + std::to_string(out.size()) + " indices of " + std::to_string(bits) + " bits, which take up " + std::to_string(needed) + " longs, but there are only " + std::to_string(data.size()));
+    internal::kernels::unpack_kernels[bits - 1](data.data(), out.size(), out.data());
+}
+
+/// @brief Packs indices into longs. The reverse of `unpack_indices()`.
+/// @param indices The indices. Only their lowest `bits` bits are used.
+/// @param bits The number of bits per index (1 to 16).
+/// @param out Receives the packed indices. Must hold at least `packed_length(indices.size(), bits)` longs; any past that are left untouched.
+/// Unused bits at the top of each long are zeroed.
+/// @exception Throws if `bits` is out of range, or if `out` is too short.
+void pack_indices(std::span<const uint16_t> indices, unsigned bits, std::span<long_t> out) {
+    std::size_t needed = packed_length(indices.size(), bits);
+    if (out.size() < needed)
+        throw std::runtime_error("Tried to pack " + std::to_string(indices.size()) + " indices of " + std::to_string(bits) + " bits, which take up " + std::to_string(needed) + " longs, into " + std::to_string(out.size()));
+    internal::kernels::pack_kernels[bits - 1](indices.data(), indices.size(), out.data());
+}
+
+}
+
+#endif
@@ -0,0 +1,235 @@
+#ifndef QUERY_HPP
+#define QUERY_HPP
+
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <span>
+#include <vector>
+
+#include "core.hpp"
+
+namespace nbt {
+
+/// @brief A compiled path to tags inside a tree, such as `sections[].block_states.palette[].Name`.
+/// Paths use the subset of Minecraft's NBT path syntax (as in `/data get`) that selects by position:
+/// - `key` or `"quoted key"` selects the element of a compound with that name. Quoted keys may use `\"` and `\\`; bare keys may not contain `.`, `[`, `]`, `{`, `}` or `"`.
+/// - `[]` selects every element of a list, and `[index]` a single one. Negative indices count back from the end of the list.
+/// - Steps are separated by `.`, except before `[`.
+///
+/// Paths are relative to the root tag (whose own name is ignored), and the empty path selects the root itself.
+/// A path can either be evaluated against a tree that has already been parsed, or pushed down into parsing with `scan()`,
+/// which only decodes the tags that match, and steps over everything else using length prefixes.
+/// @note Unlike in Minecraft, elements of byte, int and long arrays cannot be selected, and compound filters (`{...}`) are not supported.
+class NBTPath {
+public:
+    /// @brief Creates the empty path, which selects the root tag.
+    NBTPath() = default;
+    /// @brief Compiles a path.
+    /// @param expression The path. See `NBTPath`.
+    /// @exception Throws if the path is malformed.
+    explicit NBTPath(std::string_view expression);
+
+    /// @brief Finds every tag in a tree that matches this path.
+    /// @param root The root of the tree.
+    /// @return The matching tags, in the order they appear in the tree. Keys or indices that don't exist, and steps that don't fit the type of tag they reach, simply match nothing.
+    std::vector<const NBTTag*> find_all(const NBTTag& root) const;
+    /// @brief Finds every tag in a tree that matches this path. See `find_all(const NBTTag&)`.
+    std::vector<NBTTag*> find_all(NBTTag& root) const;
+
+    /// @brief Finds every tag matching this path in a buffer of NBT data, decoding only the matches.
+    /// @param bytes The data to search. It must start with a complete, named tag.
+    /// @param func Called with each match (as an `NBTTag&&`), in the order they appear in the data.
+    /// @param alloc The allocator to allocate the matches' strings and arrays with.
+    /// @param symbols If not null, the table to intern the matches' tag names in.
+    /// @exception Throws `nbt::truncated_error` or `nbt::parse_error` if the data is malformed. Scanning stops as soon as nothing further on can match,
+    /// so data after the last part of the tree the path can reach is not looked at (and errors in it aren't reported).
+    template <typename Func> void scan(std::span<const byte_t> bytes, Func&& func, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr) const;
+    /// @brief Finds every tag matching this path in a buffer of NBT data, decoding only the matches. See `scan()`.
+    /// @return The matching tags, in the order they appear in the data.
+    std::vector<NBTTag> extract(std::span<const byte_t> bytes, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr) const;
+
+    /// @brief Gets the number of steps in this path.
+    std::size_t size() const { return this->steps.size(); }
+    bool empty() const { return this->steps.empty(); }
+
+private:
+    struct Step {
+        enum Kind { KEY, ALL_ELEMENTS, ELEMENT } kind;
+        std::string key;
+        long index = 0;
+    };
+
+    template <typename TagT> void collect(TagT& tag, std::size_t step, std::vector<TagT*>& out) const;
+    template <typename Func> void scan_payload(internal::ByteReader& reader, byte_t type, std::string_view name, std::size_t step, bool to_end, Func& func, const NBTTag::allocator_type& alloc, SymbolTable* symbols) const;
+
+    std::vector<Step> steps;
+};
+
+NBTPath::NBTPath(std::string_view expression) {
+    auto fail = [&](const std::string& reason, std::size_t at) {
+        throw std::runtime_error("Tried to compile NBT path \"" + std::string(expression) + "\", but " + reason + " at position " + std::to_string(at));
+    };
+    std::size_t i = 0;
+    // whether the last thing read was a '.', in which case a key has to come next
+    bool after_dot = false;
+    while (i < expression.size()) {
+        char c = expression[i];
+        if (c == '.') {
+            if (this->steps.empty() || after_dot)
+                fail("there is an unexpected '.'", i);
+            after_dot = true;
+            ++i;
+        } else if (c == '[') {
+            if (after_dot)
+                fail("a '[' follows a '.'", i);
+            std::size_t close = expression.find(']', i);
+            if (close == std::string_view::npos)
+                fail("a '[' is never closed", i);
+            std::string_view inside = expression.substr(i + 1, close - i - 1);
+            if (inside.empty()) {
+                this->steps.push_back({Step::ALL_ELEMENTS, {}});
+            } else {
+                long index;
+                auto [end, error] = std::from_chars(inside.data(), inside.data() + inside.size(), index);
+                if (error != std::errc() || end != inside.data() + inside.size())
+                    fail("\"" + std::string(inside) + "\" is not a list index", i + 1);
+                this->steps.push_back({Step::ELEMENT, {}, index});
+            }
+            i = close + 1;
+        } else if (c == ']' || c == '{' || c == '}') {
+            fail("there is an unexpected '" + std::string(1, c) + "'", i);
+        } else {
+            if (!this->steps.empty() && !after_dot)
+                fail("a key follows another step without a '.'", i);
+            std::string key;
+            if (c == '"') {
+                for (++i; i < expression.size() && expression[i] != '"'; ++i) {
+                    if (expression[i] == '\\' && i + 1 < expression.size())
+                        ++i;
+                    key += expression[i];
+                }
+                if (i == expression.size())
+                    fail("a quoted key is never closed", i);
+                ++i;
+            } else {
+                std::size_t end = expression.find_first_of(".[]{}\"", i);
+                if (end == std::string_view::npos) end = expression.size();
+                key = expression.substr(i, end - i);
+                i = end;
+            }
+            this->steps.push_back({Step::KEY, std::move(key)});
+            after_dot = false;
+        }
+    }
+    if (after_dot)
+        fail("it ends with a '.'", expression.size());
+}
+
+template <typename TagT> void NBTPath::collect(TagT& tag, std::size_t step, std::vector<TagT*>& out) const {
+    if (step == this->steps.size()) {
+        out.push_back(&tag);
+        return;
+    }
+    const Step& next = this->steps[step];
+    if (next.kind == Step::KEY) {
+        if (tag.type != TAG_COMPOUND) return;
+        if (TagT* child = tag.template get_ref<Compound>().find(std::string_view(next.key)))
+            this->collect(*child, step + 1, out);
+        return;
+    }
+    if (tag.type != TAG_ARRAY) return;
+    auto& elements = tag.template get_ref<array_t<NBTTag>>();
+    if (next.kind == Step::ALL_ELEMENTS) {
+        for (TagT& element : elements)
+            this->collect(element, step + 1, out);
+        return;
+    }
+    long index = next.index < 0 ? (long)elements.size() + next.index : next.index;
+    if (index >= 0 && (std::size_t)index < elements.size())
+        this->collect(elements[index], step + 1, out);
+}
+
+std::vector<const NBTTag*> NBTPath::find_all(const NBTTag& root) const {
+    std::vector<const NBTTag*> ret;
+    this->collect(root, 0, ret);
+    return ret;
+}
+std::vector<NBTTag*> NBTPath::find_all(NBTTag& root) const {
+    std::vector<NBTTag*> ret;
+    this->collect(root, 0, ret);
+    return ret;
+}
+
+template <typename Func> void NBTPath::scan(std::span<const byte_t> bytes, Func&& func, const NBTTag::allocator_type& alloc, SymbolTable* symbols) const {
+    internal::ByteReader reader(bytes);
+    byte_t type = reader.read_byte();
+    std::string_view name = reader.read_string_view();
+    // nothing comes after the root, so there's no need to find where it ends
+    this->scan_payload(reader, type, name, 0, false, func, alloc, symbols);
+}
+
+// If `to_end` is set, leaves the reader at the end of the payload, whether or not anything in it matched (a `[]` step needs that to go on to the next element).
+// Otherwise it stops as soon as nothing more in the payload can match, wherever that is.
+template <typename Func> void NBTPath::scan_payload(internal::ByteReader& reader, byte_t type, std::string_view name, std::size_t step, bool to_end, Func& func, const NBTTag::allocator_type& alloc, SymbolTable* symbols) const {
+    if (step == this->steps.size()) {
+        NBTTag match = NBTTag::from_nbt(reader, true, {type}, alloc, symbols);
+        match.name = symbols ? symbols->intern(name) : Name(name);
+        func(std::move(match));
+        return;
+    }
+    const Step& next = this->steps[step];
+    if (next.kind == Step::KEY && type == TAG_COMPOUND) {
+        {
+            auto nesting = reader.nest();
+            byte_t next_type = reader.read_byte();
+            while (next_type != TAG_END) {
+                std::string_view child_name = reader.read_string_view();
+                if (child_name == next.key) {
+                    this->scan_payload(reader, next_type, child_name, step + 1, to_end, func, alloc, symbols);
+                    break;
+                }
+                internal::skip_payload(reader, next_type);
+                next_type = reader.read_byte();
+            }
+            if (next_type == TAG_END || !to_end)
+                return;
+        }
+        // a compound only holds one tag with each name, so the rest can be skipped (which counts this level of nesting again)
+        internal::skip_payload(reader, TAG_COMPOUND);
+        return;
+    }
+    if (next.kind != Step::KEY && type == TAG_ARRAY) {
+        auto nesting = reader.nest();
+        byte_t element_type = reader.read_byte();
+        std::size_t length = reader.read_length();
+        if (next.kind == Step::ALL_ELEMENTS) {
+            for (std::size_t i = 0; i < length; ++i)
+                this->scan_payload(reader, element_type, std::string_view(), step + 1, to_end || i + 1 < length, func, alloc, symbols);
+            return;
+        }
+        long index = next.index < 0 ? (long)length + next.index : next.index;
+        if (index < 0 || (std::size_t)index >= length) {
+            if (to_end)
+                internal::skip_elements(reader, element_type, length);
+            return;
+        }
+        internal::skip_elements(reader, element_type, index);
+        this->scan_payload(reader, element_type, std::string_view(), step + 1, to_end, func, alloc, symbols);
+        if (to_end)
+            internal::skip_elements(reader, element_type, length - index - 1);
+        return;
+    }
+    if (to_end)
+        internal::skip_payload(reader, type);
+}
+
+std::vector<NBTTag> NBTPath::extract(std::span<const byte_t> bytes, const NBTTag::allocator_type& alloc, SymbolTable* symbols) const {
+    std::vector<NBTTag> ret;
+    this->scan(bytes, [&](NBTTag&& match) { ret.push_back(std::move(match)); }, alloc, symbols);
+    return ret;
+}
+
+}
+
+#endif
@@ -10,253 +10,1649 @@
 #include <chrono>
 #include <utility>
 #include <cmath>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <charconv>
+#include <string_view>
+#include <thread>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <concepts>
+#include <map>
+#include <span>
+#include <unordered_map>
+
+#if __has_include(<sys/mman.h>)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define NBT_HAS_MMAP 1
+#endif
 
 #include "core.hpp"
+#include "visitor.hpp"
+#include "query.hpp"
+#include "packed.hpp"
+#include "schema.hpp"
+#include "diff.hpp"
 #include <level.hpp>
 
 namespace nbt {
 
-/// @brief A compression scheme used for individual chunks.
-enum CompressionScheme {
-    GZIP = 1,
-    ZLIB = 2,
-    NOTHING = 3,
-    LZ4 = 4,
-    CUSTOM = 127,
+/// @brief A chunk as it was stored in a region file, kept so that it can be written back as it was if it hasn't changed.
+/// Filled in by the `read_region_file()` and `read_region_file_parallel()` overloads that take them, and used by the matching overloads of
+/// `write_region_file()` and `write_region_file_parallel()`, and by `RegionWriter::set_chunk()`.
+struct StoredChunk {
+    /// @brief The `hash_tag()` (ordered) of the chunk's tag, as it was read.
+    std::uint64_t hash = 0;
+    /// @brief When the chunk was last saved, in seconds since the Unix epoch.
+    uint_t timestamp = 0;
+    /// @brief The chunk's record in the file: its length, its compression scheme and its compressed data. Empty if the chunk was not present.
+    std::vector<byte_t> record;
+
+    /// @brief Returns whether a chunk's tag is the same as when it was read (or, if it was not present, whether it still isn't).
+    bool unchanged(const NBTTag& chunk_tag) const {
+        if (this->record.empty())
+            return chunk_tag.type != TAG_COMPOUND;
+        return chunk_tag.type == TAG_COMPOUND && hash_tag(chunk_tag) == this->hash;
+    }
 };
 
 namespace internal {
 
-// pad the stream to the nearest 4096-byte sector end
-void pad(std::ostream& stream) {
-    std::size_t pos = stream.tellp();
-    // offset from beginning of sector
-    std::size_t offset = pos & 0xfff;
-    std::size_t bytes_left = 0x1000 - offset;
-    if (bytes_left == 0) return;
-    for (; bytes_left > 0; --bytes_left)
-        stream.put(0);
-}
-
+// rebuilds every tag in `tags` empty with `alloc`, so that tags assigned into them later can keep their memory
+template <std::size_t N> void rebind_tags(std::array<NBTTag, N>& tags, const NBTTag::allocator_type& alloc) {
+    for (NBTTag& tag : tags) {
+        std::destroy_at(&tag);
+        std::construct_at(&tag, alloc);
+    }
 }
 
-/// @brief Gets individual chunk NBT tags from the region file.
-/// @param path The path of the region file to read.
-/// @return All chunks stored in the region file, with no guarantee as to order. If a chunk is not present, its tag will be `{"EmptyChunk":0b}` (`NBTTag(TAG_BYTE, "EmptyChunk", 0)`).
-std::array<NBTTag, 1024> read_region_file(const std::string& path) {
-    std::ifstream file(path, std::ios::binary);
-
+// The header of a region file: where each chunk's sectors start (in sectors), how many there are, and when each chunk was last saved.
+struct RegionHeader {
     std::array<uint_t, 1024> offsets, timestamps;
     std::array<byte_t, 1024> sizes;
+};
+
+RegionHeader parse_region_header(std::span<const byte_t> bytes) {
+    ByteReader reader(bytes);
+    RegionHeader ret;
+    std::array<uint_t, 1024> locations;
+    reader.read_ints(locations.data(), 1024);
     for (std::size_t i = 0; i < 1024; ++i) {
-        uint_t location = internal::read(file, TAG_INT).i;
-        offsets[i] = location >> 8;
-        sizes[i] = (byte_t)(location & 0xFF);
+        ret.offsets[i] = locations[i] >> 8;
+        ret.sizes[i] = (byte_t)(locations[i] & 0xFF);
     }
-    for (std::size_t i = 0; i < 1024; ++i)
-        // not a batch read for endianness reasons
-        // (why do little-endian machines have to exist)
-        timestamps[i] = internal::read(file, TAG_INT).i;
-    
+    reader.read_ints(ret.timestamps.data(), 1024);
+    return ret;
+}
+
+std::vector<byte_t> read_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        throw std::runtime_error("Tried to read file " + path + ", but it could not be opened");
+    std::vector<byte_t> ret((std::size_t)file.tellg());
+    file.seekg(0);
+    file.read((char*)ret.data(), ret.size());
+    return ret;
+}
+
+// Gets the sectors of chunk `index` out of a whole region file, or an empty span if the chunk is not present.
+std::span<const byte_t> chunk_sectors(std::span<const byte_t> file, const RegionHeader& header, std::size_t index) {
+    if (header.offsets[index] == 0 || header.sizes[index] == 0) return {};
+    std::size_t start = (std::size_t)header.offsets[index] * 4096;
+    if (start >= file.size())
+        throw parse_error("Chunk " + std::to_string(index) + " starts at sector " + std::to_string(header.offsets[index]) + ", past the end of the region file", start);
+    // the last chunk in a file isn't always padded out to a whole sector
+    return file.subspan(start, std::min<std::size_t>(header.sizes[index] * 4096, file.size() - start));
+}
+
+// The (still compressed) data of a chunk, as stored at the start of its sectors.
+struct ChunkData {
+    CompressionScheme scheme;
+    std::span<const byte_t> data;
+};
+
+ChunkData chunk_data(std::span<const byte_t> sectors) {
+    ByteReader reader(sectors);
+    uint_t length = reader.read_int<uint_t>();
+    if (length == 0)
+        throw parse_error("Chunk has a length of 0, so it has no compression type", 0);
+    CompressionScheme scheme = (CompressionScheme)reader.read_byte();
+    return {scheme, std::span<const byte_t>(reader.take(length - 1), length - 1)};
+}
+
+// Decodes the chunk stored at the start of its sectors.
+NBTTag decode_chunk(std::span<const byte_t> sectors, const NBTTag::allocator_type& alloc, SymbolTable* symbols, codec::Decompressor& decompressor) {
+    ChunkData chunk = chunk_data(sectors);
+    add_count(stats_counters().chunks_read, 1);
+    // uncompressed chunks can be parsed straight out of the file
+    if (chunk.scheme == NOTHING)
+        return NBTTag::from_nbt(chunk.data, nullptr, alloc, symbols);
+    return read_nbt_compressed(chunk.scheme, chunk.data, alloc, symbols, decompressor);
+}
+
+// Finds the tags matching a path in the chunk stored at the start of its sectors.
+std::vector<NBTTag> query_chunk(std::span<const byte_t> sectors, const NBTPath& query, const NBTTag::allocator_type& alloc, SymbolTable* symbols, codec::Decompressor& decompressor) {
+    ChunkData chunk = chunk_data(sectors);
+    if (chunk.scheme == NOTHING)
+        return query.extract(chunk.data, alloc, symbols);
+    return query.extract(decompressor.decompress(chunk.scheme, chunk.data), alloc, symbols);
+}
+
+uint_t current_timestamp() {
+    return (uint_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Encodes a chunk the way it is stored in a region file: its length, its compression scheme, and then its (compressed) data.
+std::vector<byte_t> encode_chunk(const NBTTag& chunk_tag, CompressionScheme scheme, int level) {
+    std::vector<byte_t> ret(5);
+    codec::compress(scheme, chunk_tag.to_nbt(), ret, level);
+    add_count(stats_counters().chunks_written, 1);
+    uint_t length = ret.size() - 4;
+    store_big_endian(ret.data(), &length, 1);
+    ret[4] = (byte_t)scheme;
+    return ret;
+}
+
+// Tracks which 4096-byte sectors of a region file are in use.
+class SectorMap {
+public:
+    // Marks the header and every chunk in it as used.
+    explicit SectorMap(const RegionHeader& header) : used(2, true) {
+        for (std::size_t i = 0; i < 1024; ++i)
+            if (header.offsets[i] != 0)
+                this->mark(header.offsets[i], header.sizes[i]);
+    }
+
+    void mark(std::size_t start, std::size_t count) {
+        if (this->used.size() < start + count)
+            this->used.resize(start + count, false);
+        std::fill(this->used.begin() + start, this->used.begin() + start + count, true);
+    }
+
+    // Finds the first run of `count` free sectors. Everything past the end of the map is free, so this always succeeds.
+    std::size_t first_fit(std::size_t count) const {
+        std::size_t run_start = 0, run_length = 0;
+        for (std::size_t i = 0; i < this->used.size(); ++i) {
+            if (this->used[i]) {
+                run_length = 0;
+                continue;
+            }
+            if (run_length++ == 0) run_start = i;
+            if (run_length == count) return run_start;
+        }
+        return run_length > 0 ? run_start : this->used.size();
+    }
+
+private:
+    std::vector<bool> used;
+};
+
+// Calls `func(i)` for every `i` in `[0, count)`, spread over `threads` threads (including this one).
+// Indices are handed out one at a time, since chunks vary a lot in how long they take.
+// If any call throws, no more are started, and the first exception is rethrown once every thread has stopped.
+template <typename Func> void parallel_for(std::size_t count, unsigned threads, Func&& func) {
+    if (threads <= 1) {
+        for (std::size_t i = 0; i < count; ++i)
+            func(i);
+        return;
+    }
+
+    std::atomic<std::size_t> next = 0;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto work = [&] {
+        for (std::size_t i = next++; i < count; i = next++) {
+            try {
+                func(i);
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+                if (!error) error = std::current_exception();
+                next = count;
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (unsigned i = 1; i < threads; ++i)
+        workers.emplace_back(work);
+    work();
+    for (std::thread& worker : workers)
+        worker.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// Decodes every chunk of a region file that has been read into memory, spread over `threads` threads (including this one).
+// Each thread decompresses with its own decompressor, except that a single-threaded decode can be given one.
+// If `stored` is given, each chunk's record is copied into it and hashed while its tree is still in the cache.
+std::array<NBTTag, 1024> decode_region(std::span<const byte_t> file, const RegionHeader& header, unsigned threads, const NBTTag::allocator_type& alloc, SymbolTable* symbols,
+                                       codec::Decompressor* decompressor = nullptr, std::array<StoredChunk, 1024>* stored = nullptr) {
     std::array<NBTTag, 1024> ret;
-    for (std::size_t i = 0; i < 1024; ++i) {
-        if (offsets[i] == 0) {
+    rebind_tags(ret, alloc);
+    parallel_for(1024, threads, [&](std::size_t i) {
+        std::span<const byte_t> sectors = chunk_sectors(file, header, i);
+        if (stored)
+            (*stored)[i] = StoredChunk();
+        if (sectors.empty()) {
             // Empty chunk marker
-            ret[i] = NBTTag(TAG_BYTE, "EmptyChunk", 0);
-            continue;
+            ret[i] = NBTTag(TAG_BYTE, "EmptyChunk", (char)0, alloc);
+            return;
         }
-        file.seekg(offsets[i] * 4096);
-        uint_t byte_length = internal::read(file, TAG_INT).i;
-        CompressionScheme scheme = (CompressionScheme)internal::read(file, TAG_BYTE).b;
-        switch (scheme) {
-        case NOTHING:
-            ret[i] = NBTTag::from_nbt(file);
-            break;
-        case GZIP:
-            ret[i] = read_nbt_gzip(file);
-            break;
-        case ZLIB:
-            ret[i] = read_nbt_zlib(file);
-            break;
-        case LZ4:
-        case CUSTOM:
-        default:
-            throw std::runtime_error("Unsupported compression type with ordinal " + std::to_string(scheme));
+        ret[i] = decode_chunk(sectors, alloc, symbols, decompressor && threads <= 1 ? *decompressor : codec::Decompressor::local());
+        if (stored) {
+            std::size_t length = 5 + chunk_data(sectors).data.size();
+            (*stored)[i] = StoredChunk{hash_tag(ret[i]), header.timestamps[i], std::vector<byte_t>(sectors.begin(), sectors.begin() + (std::ptrdiff_t)length)};
         }
-    }
-
+    });
     return ret;
 }
 
-/// @brief Writes individual chunk NBT tags to the region file.
-/// @param path The path to the region file. Overwrites it if it exists, and creates it if it does not.
-/// @param chunk_tags The chunk NBT tags to write to the file (see https://minecraft.wiki/w/Chunk_format). If a chunk does not exist, its corresponding tag must not be of type `TAG_COMPOUND`.
-/// @param chunk_compression The compression format to use for chunks. Defaults to `ZLIB` (which is also Minecraft's default). `LZ4` and `CUSTOM` are not currently supported.
-/// @note All chunks will have their timestamps set, even if they don't exist or weren't modified. This behaviour is subject to change in a later version of the library.
-void write_region_file(const std::string& path, const std::array<NBTTag, 1024>& chunk_tags, CompressionScheme chunk_compression = ZLIB) {
-    std::ofstream file(path, std::ios::binary);
+using ChunkOrderTable = std::array<std::uint16_t, 1024>;
 
-    // pre-write locations to reserve space
-    std::array<uint_t, 1024> locations;
-    file.write((char*)locations.data(), 4096);
+// The order chunks are stored in by Minecraft and by `write_region_file()`: by index, so rows of the same z follow one another.
+const ChunkOrderTable& row_major_order() {
+    static const ChunkOrderTable order = [] {
+        ChunkOrderTable ret;
+        for (std::size_t i = 0; i < 1024; ++i)
+            ret[i] = (std::uint16_t)i;
+        return ret;
+    }();
+    return order;
+}
 
-    std::array<uint_t, 1024> timestamps;
-    for (std::size_t i = 0; i < 1024; ++i) {
-        /// TODO: this is suboptimal behaviour and should be modified to at least allow the user to set the timestamps
-        // I could just use std::time(nullptr), but that's less fun
-        timestamps[i] = std::chrono::sys_seconds().time_since_epoch().count();
-        // bswap if on little-endian
-        if (internal::is_little_endian())
-            timestamps[i] = __builtin_bswap32(timestamps[i]);
+// Z-order: the bits of x and z interleaved, so each 2x2, 4x4, ... 32x32 block of chunks is stored in one run.
+const ChunkOrderTable& morton_order() {
+    static const ChunkOrderTable order = [] {
+        ChunkOrderTable ret;
+        for (std::size_t code = 0; code < 1024; ++code) {
+            std::size_t x = 0, z = 0;
+            for (std::size_t bit = 0; bit < 5; ++bit) {
+                x |= ((code >> (2 * bit)) & 1) << bit;
+                z |= ((code >> (2 * bit + 1)) & 1) << bit;
+            }
+            ret[code] = (std::uint16_t)(x + z * 32);
+        }
+        return ret;
+    }();
+    return order;
+}
+
+// Writes a whole region file front to back, header first, from the chunks' records (as `encode_chunk()` makes them, empty for chunks that aren't present).
+// Chunks are laid out one after another, each padded to a whole number of sectors, in the order of the indices in `order`.
+void write_records(const std::string& path, const std::array<std::span<const byte_t>, 1024>& records, const std::array<uint_t, 1024>& timestamps, const ChunkOrderTable& order) {
+    // locations, then timestamps
+    std::array<uint_t, 2048> header{};
+    std::size_t offset = 2;
+    for (std::uint16_t i : order) {
+        if (records[i].empty()) continue;
+        std::size_t sectors = (records[i].size() + 4095) / 4096;
+        if (sectors > 255)
+            throw std::runtime_error("Tried to write chunk " + std::to_string(i) + " to region file " + path + ", but it takes up " + std::to_string(sectors) + " sectors, and region files can only hold chunks of up to 255 sectors");
+        header[i] = (uint_t)(offset << 8 | sectors);
+        header[1024 + i] = timestamps[i];
+        offset += sectors;
     }
+    if (offset > 0xffffff)
+        throw std::runtime_error("Tried to write region file " + path + ", but it is too large to address its sectors");
+    store_big_endian(header.data(), header.data(), header.size());
 
-    for (std::size_t i = 0; i < 1024; ++i) {
-        if (chunk_tags[i].type != TAG_COMPOUND) {
-            locations[i] = 0;
-            continue;
-        }
+    PhaseTimer timer(stats::PHASE_WRITE, offset * 4096);
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char*)header.data(), 8192);
+    static const char padding[4096] = {};
+    for (std::uint16_t i : order) {
+        if (records[i].empty()) continue;
+        file.write((const char*)records[i].data(), records[i].size());
+        file.write(padding, (4096 - records[i].size() % 4096) % 4096);
+    }
+    if (!file)
+        throw std::runtime_error("Tried to write region file " + path + ", but writing failed");
+}
 
-        // write offset
-        std::size_t pos = file.tellp();
-        locations[i] = ((pos >> 12) << 8) & 0xffffff00;
-
-        // init space for tag size
-        uint_t bytes = 0;
-        internal::writei(file, bytes);
-        file.put(chunk_compression);
-
-        switch (chunk_compression) {
-        case GZIP:
-            write_nbt_gzip(file, chunk_tags[i]);
-            break;
-        case ZLIB:
-            write_nbt_zlib(file, chunk_tags[i]);
-            break;
-        case NOTHING:
-            chunk_tags[i].to_nbt(file);
-            break;
-        case LZ4:
-        case CUSTOM:
-        default:
-            throw std::runtime_error("Unsupported compression type with ordinal " + std::to_string(chunk_compression));
+// Writes a whole region file, compressing its chunks on `threads` threads (including this one).
+// Every chunk is compressed into its own buffer first, so that the layout (and so the header) is known before anything is written,
+// and the file can then be written front to back.
+// If `stored` is given, chunks that haven't changed since they were read are written back from their records, keeping their timestamps.
+// Chunks are stamped with `timestamps` if given, and otherwise with the current time. Chunks that aren't present get 0, as Minecraft gives them.
+void encode_region(const std::string& path, const std::array<NBTTag, 1024>& chunk_tags, CompressionScheme scheme, unsigned threads, int level,
+                   const std::array<StoredChunk, 1024>* stored = nullptr, const std::array<uint_t, 1024>* timestamps = nullptr) {
+    std::array<std::vector<byte_t>, 1024> chunks;
+    std::array<uint_t, 1024> chunk_timestamps{};
+    uint_t now = current_timestamp();
+    parallel_for(1024, threads, [&](std::size_t i) {
+        if (chunk_tags[i].type != TAG_COMPOUND) return;
+        chunk_timestamps[i] = timestamps ? (*timestamps)[i] : now;
+        if (stored && !(*stored)[i].record.empty() && (*stored)[i].unchanged(chunk_tags[i])) {
+            chunks[i] = (*stored)[i].record;
+            if (!timestamps) chunk_timestamps[i] = (*stored)[i].timestamp;
+        } else {
+            chunks[i] = encode_chunk(chunk_tags[i], scheme, level);
         }
+    });
+
+    std::array<std::span<const byte_t>, 1024> records;
+    for (std::size_t i = 0; i < 1024; ++i)
+        records[i] = chunks[i];
+    write_records(path, records, chunk_timestamps, row_major_order());
+}
+
+}
+
+/// @brief Where and how a chunk is stored in a region file.
+struct ChunkInfo {
+    /// @brief When the chunk was last saved, in seconds since the Unix epoch.
+    uint_t timestamp;
+    /// @brief The first 4096-byte sector the chunk is stored in, counting the two sectors of the header.
+    std::size_t sector_offset;
+    /// @brief The number of sectors set aside for the chunk.
+    std::size_t sector_count;
+    /// @brief The number of bytes of (compressed) data the chunk actually takes up, not counting its 5-byte length and compression scheme.
+    std::size_t length;
+    /// @brief How the chunk is compressed.
+    CompressionScheme scheme;
+};
+
+/// @brief A region file opened for reading individual chunks.
+/// The file is memory-mapped (where the platform supports it, and read into memory otherwise), and its header is parsed once, when it is opened.
+/// Chunks are then inflated straight out of the mapped sectors, so reading one chunk only touches that chunk's pages.
+/// @note Reading chunks does not modify the `RegionFile`, so it may be done from several threads at once.
+class RegionFile {
+public:
+    /// @brief Opens a region file.
+    /// @param path The path of the region file.
+    /// @exception Throws if the file can't be opened, and `nbt::truncated_error` if it is too short to hold a header.
+    explicit RegionFile(const std::string& path);
+    RegionFile(const RegionFile&) = delete;
+    RegionFile(RegionFile&& other) noexcept;
+    RegionFile& operator=(const RegionFile&) = delete;
+    RegionFile& operator=(RegionFile&& other) noexcept;
+    ~RegionFile();
+
+    /// @brief Returns whether a chunk is present in the file.
+    /// @param local_x The chunk's x position within the region (0 to 31).
+    /// @param local_z The chunk's z position within the region (0 to 31).
+    bool has_chunk(int local_x, int local_z) const;
+    /// @brief Reads a single chunk.
+    /// @param local_x The chunk's x position within the region (0 to 31).
+    /// @param local_z The chunk's z position within the region (0 to 31).
+    /// @param alloc The allocator to allocate the chunk's strings and arrays with.
+    /// @param symbols If not null, the table to intern tag names in.
+    /// @param decompressor The decompressor to decompress the chunk with. Defaults to the calling thread's.
+    /// @return The chunk's tag, or nothing if the chunk is not present.
+    /// @exception Throws if the position is out of range, or if the chunk's data is malformed or uses an unsupported compression type.
+    std::optional<NBTTag> read_chunk(int local_x, int local_z, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr, codec::Decompressor& decompressor = codec::Decompressor::local()) const;
+    /// @brief Parses a single chunk with `visit_nbt()`, without building its tree.
+    /// @param local_x The chunk's x position within the region (0 to 31).
+    /// @param local_z The chunk's z position within the region (0 to 31).
+    /// @param visitor The visitor to report the chunk's tags to. See `NBTVisitor`.
+    /// @param decompressor The decompressor to decompress the chunk with. Defaults to the calling thread's. The visitor must not use it.
+    /// @return False if the visitor stopped the parse, and true otherwise. If the chunk is not present, the visitor is not called, and true is returned.
+    /// @exception Throws if the position is out of range, or if the chunk's data is malformed or uses an unsupported compression type.
+    template <typename Visitor> bool visit_chunk(int local_x, int local_z, Visitor&& visitor, codec::Decompressor& decompressor = codec::Decompressor::local()) const;
+    /// @brief Finds the tags in a single chunk that match a path, decoding only the matches. See `NBTPath::scan()`.
+    /// @param local_x The chunk's x position within the region (0 to 31).
+    /// @param local_z The chunk's z position within the region (0 to 31).
+    /// @param query The path to match, relative to the chunk's root tag.
+    /// @param alloc The allocator to allocate the matches' strings and arrays with.
+    /// @param symbols If not null, the table to intern tag names in.
+    /// @param decompressor The decompressor to decompress the chunk with. Defaults to the calling thread's.
+    /// @return The matching tags. Empty if the chunk is not present.
+    /// @exception Throws if the position is out of range, or if the chunk's data is malformed or uses an unsupported compression type.
+    std::vector<NBTTag> query_chunk(int local_x, int local_z, const NBTPath& query, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr, codec::Decompressor& decompressor = codec::Decompressor::local()) const;
+    /// @brief Gets when a chunk was last saved.
+    /// @return The time the chunk was last saved, in seconds since the Unix epoch.
+    uint_t timestamp(int local_x, int local_z) const;
+    /// @brief Gets when every chunk was last saved (0 for chunks that are not present), indexed the same way as the chunks (`x + z * 32`).
+    const std::array<uint_t, 1024>& timestamps() const { return this->region_header.timestamps; }
+    /// @brief Gets where and how a chunk is stored, without decompressing it.
+    /// @param local_x The chunk's x position within the region (0 to 31).
+    /// @param local_z The chunk's z position within the region (0 to 31).
+    /// @return The chunk's details, or nothing if the chunk is not present.
+    /// @exception Throws if the position is out of range, or if the chunk's sectors or length are malformed.
+    std::optional<ChunkInfo> chunk_info(int local_x, int local_z) const;
 
-        // write tag size
-        std::size_t end_pos = file.tellp();
-        bytes = end_pos - pos;
-        file.seekp(pos);
-        internal::writei(file, bytes);
-        file.seekp(end_pos);
+    /// @brief Gets the raw contents of the file.
+    std::span<const byte_t> bytes() const { return this->data; }
+    /// @brief Gets the parsed header of the file.
+    const internal::RegionHeader& header() const { return this->region_header; }
 
-        internal::pad(file);
-        // write sector size to header
-        std::size_t new_pos = file.tellp();
-        locations[i] |= ((new_pos - pos) >> 12) & 0xff;
+private:
+    static std::size_t index(int local_x, int local_z);
+    void unmap();
 
-        // use bswap if on little-endian
-        if (internal::is_little_endian())
-            locations[i] = __builtin_bswap32(locations[i]);
+    std::span<const byte_t> data;
+#if defined(NBT_HAS_MMAP)
+    void* mapping = nullptr;
+#else
+    std::vector<byte_t> buffer;
+#endif
+    internal::RegionHeader region_header;
+};
+
+RegionFile::RegionFile(const std::string& path) {
+    internal::PhaseTimer timer(stats::PHASE_READ, 0);
+#if defined(NBT_HAS_MMAP)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Tried to read file " + path + ", but it could not be opened");
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Tried to read file " + path + ", but its size could not be read");
+    }
+    std::size_t size = (std::size_t)info.st_size;
+    if (size > 0) {
+        void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Tried to read file " + path + ", but it could not be mapped into memory");
+        }
+        // single chunks are read from all over the file, so readahead would mostly be wasted
+        ::madvise(mapped, size, MADV_RANDOM);
+        this->mapping = mapped;
+        this->data = std::span<const byte_t>((const byte_t*)mapped, size);
+    }
+    // the mapping stays valid after the file is closed
+    ::close(fd);
+#else
+    this->buffer = internal::read_file(path);
+    this->data = this->buffer;
+#endif
+    timer.bytes_out = this->data.size();
+    try {
+        this->region_header = internal::parse_region_header(this->data.first(std::min<std::size_t>(this->data.size(), 8192)));
+    } catch (...) {
+        this->unmap();
+        throw;
     }
+}
+RegionFile::RegionFile(RegionFile&& other) noexcept : data(std::exchange(other.data, {})),
+#if defined(NBT_HAS_MMAP)
+    mapping(std::exchange(other.mapping, nullptr)),
+#else
+    buffer(std::move(other.buffer)),
+#endif
+    region_header(other.region_header) {}
+RegionFile& RegionFile::operator=(RegionFile&& other) noexcept {
+    if (this != &other) {
+        this->unmap();
+        this->data = std::exchange(other.data, {});
+#if defined(NBT_HAS_MMAP)
+        this->mapping = std::exchange(other.mapping, nullptr);
+#else
+        this->buffer = std::move(other.buffer);
+#endif
+        this->region_header = other.region_header;
+    }
+    return *this;
+}
+RegionFile::~RegionFile() {
+    this->unmap();
+}
 
-    file.seekp(0);
-    file.write((char*)locations.data(), 4096);
+void RegionFile::unmap() {
+#if defined(NBT_HAS_MMAP)
+    if (this->mapping)
+        ::munmap(this->mapping, this->data.size());
+    this->mapping = nullptr;
+#else
+    this->buffer.clear();
+#endif
+    this->data = {};
+}
+
+std::size_t RegionFile::index(int local_x, int local_z) {
+    if (local_x < 0 || local_x >= 32 || local_z < 0 || local_z >= 32)
+        throw std::runtime_error("Tried to access chunk (" + std::to_string(local_x) + ", " + std::to_string(local_z) + ") of a region file, but chunk positions within a region go from 0 to 31");
+    return (std::size_t)local_x + (std::size_t)local_z * 32;
+}
+
+bool RegionFile::has_chunk(int local_x, int local_z) const {
+    std::size_t i = index(local_x, local_z);
+    return this->region_header.offsets[i] != 0 && this->region_header.sizes[i] != 0;
+}
+
+std::optional<NBTTag> RegionFile::read_chunk(int local_x, int local_z, const NBTTag::allocator_type& alloc, SymbolTable* symbols, codec::Decompressor& decompressor) const {
+    std::span<const byte_t> sectors = internal::chunk_sectors(this->data, this->region_header, index(local_x, local_z));
+    if (sectors.empty()) return std::nullopt;
+    return internal::decode_chunk(sectors, alloc, symbols, decompressor);
+}
+
+template <typename Visitor> bool RegionFile::visit_chunk(int local_x, int local_z, Visitor&& visitor, codec::Decompressor& decompressor) const {
+    std::span<const byte_t> sectors = internal::chunk_sectors(this->data, this->region_header, index(local_x, local_z));
+    if (sectors.empty()) return true;
+    internal::ChunkData chunk = internal::chunk_data(sectors);
+    if (chunk.scheme == NOTHING)
+        return visit_nbt(chunk.data, visitor);
+    return visit_nbt(decompressor.decompress(chunk.scheme, chunk.data), visitor);
+}
+
+std::vector<NBTTag> RegionFile::query_chunk(int local_x, int local_z, const NBTPath& query, const NBTTag::allocator_type& alloc, SymbolTable* symbols, codec::Decompressor& decompressor) const {
+    std::span<const byte_t> sectors = internal::chunk_sectors(this->data, this->region_header, index(local_x, local_z));
+    if (sectors.empty()) return {};
+    return internal::query_chunk(sectors, query, alloc, symbols, decompressor);
+}
+
+uint_t RegionFile::timestamp(int local_x, int local_z) const {
+    return this->region_header.timestamps[index(local_x, local_z)];
+}
+
+std::optional<ChunkInfo> RegionFile::chunk_info(int local_x, int local_z) const {
+    std::size_t i = index(local_x, local_z);
+    std::span<const byte_t> sectors = internal::chunk_sectors(this->data, this->region_header, i);
+    if (sectors.empty()) return std::nullopt;
+    internal::ChunkData chunk = internal::chunk_data(sectors);
+    return ChunkInfo{this->region_header.timestamps[i], this->region_header.offsets[i], this->region_header.sizes[i], chunk.data.size(), chunk.scheme};
+}
+
+/// @brief Gets individual chunk NBT tags from the region file.
+/// @param path The path of the region file to read.
+/// @param alloc The allocator to allocate the chunks' strings and arrays with.
+/// Passing one backed by a `std::pmr::monotonic_buffer_resource` lets a whole region be freed at once.
+/// @param symbols If not null, the table to intern tag names in (typically `SymbolTable::global()`). Chunks share nearly all of their keys, so this saves an allocation per named tag.
+/// @param decompressor The decompressor to decompress the chunks with. Defaults to the calling thread's, whose state and buffer are reused from chunk to chunk (and from one call to the next).
+/// @return All chunks stored in the region file, with no guarantee as to order. If a chunk is not present, its tag will be `{"EmptyChunk":0b}` (`NBTTag(TAG_BYTE, "EmptyChunk", 0)`).
+std::array<NBTTag, 1024> read_region_file(const std::string& path, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr, codec::Decompressor& decompressor = codec::Decompressor::local()) {
+    RegionFile region(path);
+    return internal::decode_region(region.bytes(), region.header(), 1, alloc, symbols, &decompressor);
+}
+
+/// @brief Gets individual chunk NBT tags from the region file, and keeps what is needed to write back the ones that don't change without re-encoding them.
+/// @param path The path of the region file to read.
+/// @param stored Receives each chunk's hash and compressed record. Pass it to `write_region_file()` along with the edited chunks.
+/// @param alloc The allocator to allocate the chunks' strings and arrays with.
+/// @param symbols If not null, the table to intern tag names in.
+/// @param decompressor The decompressor to decompress the chunks with. See `read_region_file()`.
+/// @return The same as `read_region_file()`.
+/// @note Keeping the records costs a copy of the compressed file in memory, and hashing the chunks a walk over each one's tree.
+std::array<NBTTag, 1024> read_region_file(const std::string& path, std::array<StoredChunk, 1024>& stored, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr, codec::Decompressor& decompressor = codec::Decompressor::local()) {
+    RegionFile region(path);
+    return internal::decode_region(region.bytes(), region.header(), 1, alloc, symbols, &decompressor, &stored);
+}
+
+/// @brief Gets individual chunk NBT tags from the region file, decompressing and parsing them on several threads.
+/// The file is mapped on the calling thread, and its chunks are then shared out between the workers.
+/// @param path The path of the region file to read.
+/// @param threads The number of threads to decode on, including the calling thread. Defaults to one per hardware thread.
+/// @param alloc The allocator to allocate the chunks' strings and arrays with.
+/// It is used from every worker at once, so its memory resource must be thread-safe (e.g. `std::pmr::synchronized_pool_resource`, but not `std::pmr::monotonic_buffer_resource`).
+/// @param symbols If not null, the table to intern tag names in.
+/// @return The same as `read_region_file()`.
+/// @note Every worker decompresses with its own thread's `codec::Decompressor`, so each one sets up its decompression state once rather than once per chunk.
+/// @exception If decoding any chunk throws, the first such exception is rethrown once every worker has stopped.
+std::array<NBTTag, 1024> read_region_file_parallel(const std::string& path, unsigned threads = std::thread::hardware_concurrency(), const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr) {
+    RegionFile region(path);
+    return internal::decode_region(region.bytes(), region.header(), threads, alloc, symbols);
+}
+/// @brief Gets individual chunk NBT tags from the region file on several threads, keeping what is needed to write back the ones that don't change.
+/// See `read_region_file(const std::string&, std::array<StoredChunk, 1024>&, const NBTTag::allocator_type&, SymbolTable*, codec::Decompressor&)`.
+std::array<NBTTag, 1024> read_region_file_parallel(const std::string& path, std::array<StoredChunk, 1024>& stored, unsigned threads = std::thread::hardware_concurrency(),
+                                                   const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr) {
+    RegionFile region(path);
+    return internal::decode_region(region.bytes(), region.header(), threads, alloc, symbols, nullptr, &stored);
+}
+
+/// @brief Gets the chunks of a region file that have been saved since a given time, decompressing and parsing only those.
+/// Which chunks those are is read from the file's header, so the others cost nothing to skip.
+/// @param path The path of the region file to read.
+/// @param modified_after The time to read changes since, in seconds since the Unix epoch. Chunks whose timestamps are later than this are read.
+/// @param threads The number of threads to decode on, including the calling thread. Defaults to one per hardware thread.
+/// @param alloc The allocator to allocate the chunks' strings and arrays with. If `threads` is more than 1, its memory resource must be thread-safe (see `read_region_file_parallel()`).
+/// @param symbols If not null, the table to intern tag names in.
+/// @return The chunks that were read, indexed the same way as the chunks in a region file (`x + z * 32`). Nothing for chunks that are not present or have not been saved since.
+/// @exception If decoding any chunk throws, the first such exception is rethrown once every worker has stopped.
+std::array<std::optional<NBTTag>, 1024> read_region_file_since(const std::string& path, uint_t modified_after, unsigned threads = std::thread::hardware_concurrency(),
+                                                               const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr) {
+    RegionFile region(path);
+    std::array<std::optional<NBTTag>, 1024> ret;
+    internal::parallel_for(1024, threads, [&](std::size_t i) {
+        if (region.header().timestamps[i] <= modified_after) return;
+        std::span<const byte_t> sectors = internal::chunk_sectors(region.bytes(), region.header(), i);
+        if (!sectors.empty())
+            ret[i] = internal::decode_chunk(sectors, alloc, symbols, codec::Decompressor::local());
+    });
+    return ret;
+}
+
+/// @brief Finds the tags matching a path in every chunk of a region file, decoding only the matches.
+/// Chunks are decompressed on several threads, and each is then searched with `NBTPath::scan()`, so this costs little more than decompressing the region.
+/// @param path The path of the region file to search.
+/// @param query The path to match, relative to each chunk's root tag.
+/// @param threads The number of threads to search on, including the calling thread. Defaults to one per hardware thread.
+/// @param alloc The allocator to allocate the matches' strings and arrays with. If `threads` is more than 1, its memory resource must be thread-safe (see `read_region_file_parallel()`).
+/// @param symbols If not null, the table to intern tag names in.
+/// @return The matches in each chunk, indexed the same way as the chunks in a region file (`x + z * 32`). Chunks that are not present have no matches.
+/// @exception If searching any chunk throws, the first such exception is rethrown once every worker has stopped.
+std::array<std::vector<NBTTag>, 1024> query_region_file(const std::string& path, const NBTPath& query, unsigned threads = std::thread::hardware_concurrency(), const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr) {
+    RegionFile region(path);
+    std::array<std::vector<NBTTag>, 1024> ret;
+    internal::parallel_for(1024, threads, [&](std::size_t i) {
+        std::span<const byte_t> sectors = internal::chunk_sectors(region.bytes(), region.header(), i);
+        if (!sectors.empty())
+            ret[i] = internal::query_chunk(sectors, query, alloc, symbols, codec::Decompressor::local());
+    });
+    return ret;
+}
+
+/// @brief Writes individual chunk NBT tags to the region file.
+/// @param path The path to the region file. Overwrites it if it exists, and creates it if it does not.
+/// @param chunk_tags The chunk NBT tags to write to the file (see https://minecraft.wiki/w/Chunk_format). If a chunk does not exist, its corresponding tag must not be of type `TAG_COMPOUND`.
+/// @param chunk_compression The compression format to use for chunks. Defaults to `ZLIB` (which is also Minecraft's default). `LZ4` needs the library to be built with `NBT_USE_LZ4`, and `CUSTOM` is not currently supported.
+/// @param level The compression level, from 1 (fastest) to 9 (smallest), or `codec::default_level` for the backend's default. Ignored for `NOTHING`.
+/// @note Every chunk is stamped with the current time, and chunks that don't exist with 0. To keep the timestamps of chunks that weren't modified,
+/// pass them in (see the overload that takes timestamps), or write with the chunks as they were read (see the overload that takes `StoredChunk`s).
+void write_region_file(const std::string& path, const std::array<NBTTag, 1024>& chunk_tags, CompressionScheme chunk_compression = ZLIB, int level = codec::default_level) {
+    internal::encode_region(path, chunk_tags, chunk_compression, 1, level);
+}
+/// @brief Writes individual chunk NBT tags to the region file, with the given timestamps.
+/// @param path The path to the region file. Overwrites it if it exists, and creates it if it does not.
+/// @param chunk_tags The chunk NBT tags to write to the file. See `write_region_file()`.
+/// @param timestamps The time each chunk was last saved, in seconds since the Unix epoch, indexed the same way as the chunks (`x + z * 32`).
+/// Those of chunks that don't exist are ignored (and written as 0). `RegionFile::timestamps()` gets them back out of a file.
+/// @param chunk_compression The compression format to use for chunks. See `write_region_file()`.
+/// @param level The compression level. See `write_region_file()`.
+void write_region_file(const std::string& path, const std::array<NBTTag, 1024>& chunk_tags, const std::array<uint_t, 1024>& timestamps, CompressionScheme chunk_compression = ZLIB, int level = codec::default_level) {
+    internal::encode_region(path, chunk_tags, chunk_compression, 1, level, nullptr, &timestamps);
+}
+/// @brief Writes individual chunk NBT tags to the region file, copying the chunks that haven't changed since they were read instead of re-encoding them.
+/// A chunk counts as unchanged if its tag hashes the same as when it was read (see `StoredChunk::unchanged()`). Unchanged chunks keep their timestamps and their
+/// original compression, so they may not use `chunk_compression`.
+/// @param path The path to the region file. Overwrites it if it exists, and creates it if it does not.
+/// @param chunk_tags The chunk NBT tags to write to the file. See `write_region_file()`.
+/// @param stored The chunks as they were read, from `read_region_file()` or `read_region_file_parallel()`.
+/// @param chunk_compression The compression format to use for chunks that have changed.
+/// @param level The compression level. See `write_region_file()`.
+void write_region_file(const std::string& path, const std::array<NBTTag, 1024>& chunk_tags, const std::array<StoredChunk, 1024>& stored, CompressionScheme chunk_compression = ZLIB, int level = codec::default_level) {
+    internal::encode_region(path, chunk_tags, chunk_compression, 1, level, &stored);
+}
+
+/// @brief Writes individual chunk NBT tags to the region file, serialising and compressing them on several threads.
+/// Once every chunk has been compressed, the calling thread writes the whole file in order, header first.
+/// @param path The path to the region file. Overwrites it if it exists, and creates it if it does not.
+/// @param chunk_tags The chunk NBT tags to write to the file. See `write_region_file()`.
+/// @param chunk_compression The compression format to use for chunks. See `write_region_file()`.
+/// @param threads The number of threads to compress on, including the calling thread. Defaults to one per hardware thread.
+/// @param level The compression level. See `write_region_file()`.
+/// @exception If compressing any chunk throws, the first such exception is rethrown once every worker has stopped, and the file is left untouched.
+void write_region_file_parallel(const std::string& path, const std::array<NBTTag, 1024>& chunk_tags, CompressionScheme chunk_compression = ZLIB, unsigned threads = std::thread::hardware_concurrency(), int level = codec::default_level) {
+    internal::encode_region(path, chunk_tags, chunk_compression, threads, level);
+}
+/// @brief Writes individual chunk NBT tags to the region file on several threads, with the given timestamps.
+/// See `write_region_file(const std::string&, const std::array<NBTTag, 1024>&, const std::array<uint_t, 1024>&, CompressionScheme, int)`.
+void write_region_file_parallel(const std::string& path, const std::array<NBTTag, 1024>& chunk_tags, const std::array<uint_t, 1024>& timestamps, CompressionScheme chunk_compression = ZLIB,
+                                unsigned threads = std::thread::hardware_concurrency(), int level = codec::default_level) {
+    internal::encode_region(path, chunk_tags, chunk_compression, threads, level, nullptr, &timestamps);
+}
+/// @brief Writes individual chunk NBT tags to the region file on several threads, copying the chunks that haven't changed since they were read.
+/// See `write_region_file(const std::string&, const std::array<NBTTag, 1024>&, const std::array<StoredChunk, 1024>&, CompressionScheme, int)`.
+void write_region_file_parallel(const std::string& path, const std::array<NBTTag, 1024>& chunk_tags, const std::array<StoredChunk, 1024>& stored, CompressionScheme chunk_compression = ZLIB,
+                                unsigned threads = std::thread::hardware_concurrency(), int level = codec::default_level) {
+    internal::encode_region(path, chunk_tags, chunk_compression, threads, level, &stored);
 }
 
 namespace internal {
 
+// Keys looked up in chunk tags, interned in the global table so that lookups in chunks read with it compare handles.
+struct ChunkKeys {
+    Name palette, data, name, properties;
+};
+const ChunkKeys& chunk_keys() {
+    static const ChunkKeys keys = [] {
+        SymbolTable& symbols = SymbolTable::global();
+        return ChunkKeys{symbols.intern("palette"), symbols.intern("data"), symbols.intern("Name"), symbols.intern("Properties")};
+    }();
+    return keys;
+}
+
+// The parts of a chunk that loading it into a level uses, decoded straight from its NBT data (see schema.hpp). Everything else in the chunk is skipped.
+struct BlockStatesFields {
+    // block states are kept as tags, which BlockStateCache matches up
+    std::vector<NBTTag> palette;
+    std::optional<std::vector<uint64_t>> data;
+};
+NBT_FIELDS(BlockStatesFields, palette, data)
+
+struct BiomesFields {
+    // unlike block states, biomes are stored as just their names
+    std::vector<std::string> palette;
+    std::optional<std::vector<uint64_t>> data;
+};
+NBT_FIELDS(BiomesFields, palette, data)
+
+struct SectionFields {
+    signed char Y = 0;
+    std::optional<BlockStatesFields> block_states;
+    std::optional<BiomesFields> biomes;
+};
+NBT_FIELDS(SectionFields, Y, block_states, biomes)
+
+struct ChunkFields {
+    std::vector<SectionFields> sections;
+};
+NBT_FIELDS(ChunkFields, sections)
+
 std::unordered_map<std::string, std::string> get_properties(const NBTTag& properties_tag) {
-    std::vector<NBTTag> subtags = properties_tag.get<std::vector<NBTTag>>();
+    const Compound& subtags = properties_tag.get_ref<Compound>();
     std::unordered_map<std::string, std::string> ret;
     ret.reserve(subtags.size());
     for (const NBTTag& tag : subtags)
-        ret[tag.name] = tag.get<std::string>();
+        ret[tag.name.str()] = tag.get<std::string>();
+    return ret;
+}
+
+// Builds each distinct block state once, however many of the palettes it is used with it appears in.
+// Palette entries are matched on their name and properties (in order, which Minecraft always writes them in).
+class BlockStateCache {
+public:
+    const BlockState& get(const NBTTag& entry);
+
+private:
+    struct Entry {
+        NBTTag tag;
+        BlockState state;
+    };
+
+    static std::size_t hash(const NBTTag& entry);
+    static bool same_state(const NBTTag& lhs, const NBTTag& rhs);
+
+    std::unordered_multimap<std::size_t, Entry> states;
+};
+
+std::size_t BlockStateCache::hash(const NBTTag& entry) {
+    const ChunkKeys& keys = chunk_keys();
+    std::size_t ret = hash_name(entry.at(keys.name).get_ref<string_t>());
+    if (const NBTTag* properties = entry.get_ref<Compound>().find(keys.properties))
+        for (const NBTTag& property : properties->get_ref<Compound>())
+            ret = ret * 31 + (property.name.hash() ^ hash_name(property.get_ref<string_t>()));
     return ret;
 }
 
-PalettedContainer<BlockState> load_block_states(const NBTTag& block_states_tag) {
-    NBTTag raw_palette = block_states_tag.at("palette");
+bool BlockStateCache::same_state(const NBTTag& lhs, const NBTTag& rhs) {
+    const ChunkKeys& keys = chunk_keys();
+    if (lhs.at(keys.name).get_ref<string_t>() != rhs.at(keys.name).get_ref<string_t>())
+        return false;
+    const NBTTag* lhs_properties = lhs.get_ref<Compound>().find(keys.properties);
+    const NBTTag* rhs_properties = rhs.get_ref<Compound>().find(keys.properties);
+    if (!lhs_properties || !rhs_properties)
+        return !lhs_properties == !rhs_properties;
+    const array_t<NBTTag>& lhs_values = lhs_properties->get_ref<Compound>().as_vector();
+    const array_t<NBTTag>& rhs_values = rhs_properties->get_ref<Compound>().as_vector();
+    return std::equal(lhs_values.begin(), lhs_values.end(), rhs_values.begin(), rhs_values.end(), [](const NBTTag& a, const NBTTag& b) {
+        return a.name == b.name && a.get_ref<string_t>() == b.get_ref<string_t>();
+    });
+}
+
+const BlockState& BlockStateCache::get(const NBTTag& entry) {
+    const ChunkKeys& keys = chunk_keys();
+    std::size_t entry_hash = hash(entry);
+    auto [first, last] = this->states.equal_range(entry_hash);
+    for (auto it = first; it != last; ++it)
+        if (same_state(it->second.tag, entry))
+            return it->second.state;
+    // blocks without any block states (stone, dirt, ...) have no properties at all
+    const NBTTag* properties = entry.get_ref<Compound>().find(keys.properties);
+    BlockState state(entry.at(keys.name).get<std::string>(), properties ? get_properties(*properties) : std::unordered_map<std::string, std::string>());
+    return this->states.emplace(entry_hash, Entry{entry, std::move(state)})->second.state;
+}
+
+PalettedContainer<BlockState> load_block_states(BlockStatesFields&& block_states, BlockStateCache& cache) {
     std::vector<BlockState> palette;
-    palette.reserve(raw_palette.size());
-    for (std::size_t i = 0; i < raw_palette.size(); ++i) {
-        palette.push_back(BlockState(raw_palette[i].at("Name").get<std::string>(), get_properties(raw_palette[i].at("Properties"))));
+    palette.reserve(block_states.palette.size());
+    for (const NBTTag& entry : block_states.palette) {
+        if (entry.type != TAG_COMPOUND)
+            throw std::runtime_error("Tried to load a block state palette entry of type " + get_tag_type(entry.type) + ", but palette entries must be compounds");
+        palette.push_back(cache.get(entry));
     }
-    std::optional<std::vector<uint64_t>> data = std::nullopt;
-    if (block_states_tag.contains("data")) {
-        std::vector<long_t> raw_data = block_states_tag.at("data").get<std::vector<long_t>>();
-        data = {raw_data.begin(), raw_data.end()};
-    }
-    return PalettedContainer<BlockState>(palette, data);
+    return PalettedContainer<BlockState>(std::move(palette), std::move(block_states.data));
 }
-PalettedContainer<Biome> load_biomes(const NBTTag& biomes_tag) {
-    NBTTag raw_palette = biomes_tag.at("palette");
+PalettedContainer<Biome> load_biomes(BiomesFields&& biomes) {
     std::vector<Biome> palette;
-    palette.reserve(raw_palette.size());
-    for (std::size_t i = 0; i < raw_palette.size(); ++i) {
-        palette.push_back(Biome(raw_palette[i].at("Name").get<std::string>()));
-    }
-    std::optional<std::vector<uint64_t>> data = std::nullopt;
-    if (biomes_tag.contains("data")) {
-        std::vector<long_t> raw_data = biomes_tag.at("data").get<std::vector<long_t>>();
-        data = {raw_data.begin(), raw_data.end()};
-    }
-    return PalettedContainer<Biome>(palette, data);
-}
-
-// Creates a function that loads this tag into a given chunk.
-std::function<void(Chunk&)> create_chunk_load_task(const NBTTag& chunk_tag) {
-    return [&chunk_tag](Chunk& chunk) {
-        NBTTag sections = chunk_tag.at("sections");
-        for (std::size_t i = 0; i < 24; ++i) {
-            NBTTag section_tag = sections[i];
-            byte_t y = section_tag.at("y").get<byte_t>();
-            chunk.get_section(y) = Section(load_block_states(section_tag.at("block_states")), load_biomes(section_tag.at("biomes")));
+    palette.reserve(biomes.palette.size());
+    for (std::string& name : biomes.palette)
+        palette.push_back(Biome(std::move(name)));
+    return PalettedContainer<Biome>(std::move(palette), std::move(biomes.data));
+}
+
+// Expands the `data` of a `block_states` or `biomes` tag into one palette index per entry.
+void unpack_paletted(const NBTTag& paletted_tag, unsigned min_bits, std::span<uint16_t> out) {
+    const ChunkKeys& keys = chunk_keys();
+    std::size_t palette_size = paletted_tag.at(keys.palette).size();
+    const NBTTag* data = paletted_tag.get_ref<Compound>().find(keys.data);
+    if (!data) {
+        // a palette with a single entry needs no indices
+        if (palette_size > 1)
+            throw std::runtime_error("Tried to unpack the indices of a palette with " + std::to_string(palette_size) + " entries, but there is no data");
+        std::fill(out.begin(), out.end(), 0);
+        return;
+    }
+    unpack_indices(data->span<long_t>(), bits_per_entry(palette_size, min_bits), out);
+}
+
+// Replaces the `data` of a `block_states` or `biomes` tag with `indices`, packed with as few bits as its palette allows.
+void pack_paletted(NBTTag& paletted_tag, unsigned min_bits, std::span<const uint16_t> indices) {
+    const ChunkKeys& keys = chunk_keys();
+    std::size_t palette_size = paletted_tag.at(keys.palette).size();
+    Compound& children = paletted_tag.get_ref<Compound>();
+    for (uint16_t index : indices)
+        if (index >= palette_size)
+            throw std::runtime_error("Tried to pack palette index " + std::to_string(index) + ", but the palette only has " + std::to_string(palette_size) + " entries");
+    if (palette_size <= 1) {
+        children.erase(std::string_view(keys.data));
+        return;
+    }
+    unsigned bits = bits_per_entry(palette_size, min_bits);
+    array_t<long_t> packed(packed_length(indices.size(), bits), children.get_allocator());
+    pack_indices(indices, bits, packed);
+    if (NBTTag* data = children.find(keys.data)) {
+        data->type = TAG_LONGARRAY;
+        data->value = std::move(packed);
+    } else {
+        children.push_back(NBTTag(TAG_LONGARRAY, keys.data, std::move(packed), children.get_allocator()));
+    }
+}
+
+// Decodes the fields of the chunk stored at the start of its sectors. Palette entries are interned in the global table, which `chunk_keys()` uses.
+ChunkFields decode_chunk_fields(std::span<const byte_t> sectors, codec::Decompressor& decompressor) {
+    ChunkData chunk = chunk_data(sectors);
+    add_count(stats_counters().chunks_read, 1);
+    std::span<const byte_t> data = chunk.scheme == NOTHING ? chunk.data : decompressor.decompress(chunk.scheme, chunk.data);
+    PhaseTimer timer(stats::PHASE_PARSE, data.size());
+    return decode_nbt<ChunkFields>(data, nullptr, {}, &SymbolTable::global());
+}
+
+// Creates a function that loads a chunk's fields into the chunk. The function owns the fields.
+std::function<void(Chunk&)> create_chunk_load_task(ChunkFields&& chunk_fields) {
+    // shared, so that copies of the task (which `std::function` requires to be copyable) don't copy the whole chunk
+    auto fields = std::make_shared<ChunkFields>(std::move(chunk_fields));
+    return [fields](Chunk& chunk) {
+        PhaseTimer timer(stats::PHASE_TASK, 0);
+        // most block states recur in many of a chunk's sections
+        BlockStateCache block_states;
+        for (SectionFields& section : fields->sections) {
+            // the sections just above and below the world only hold light
+            if (!section.block_states || !section.biomes) continue;
+            chunk.get_section(section.Y) = Section(load_block_states(std::move(*section.block_states), block_states), load_biomes(std::move(*section.biomes)));
         }
     };
 }
 
 }
 
+/// @brief Expands a section's block states into one palette index per block.
+/// @param block_states_tag The section's `block_states` tag.
+/// @param out Receives the palette index of each block, in the order Minecraft stores them (`y * 256 + z * 16 + x`).
+/// @exception Throws if the tag is malformed, or if its `data` is too short for its palette.
+void unpack_block_states(const NBTTag& block_states_tag, std::span<uint16_t, 4096> out) {
+    internal::unpack_paletted(block_states_tag, 4, out);
+}
+/// @brief Expands a section's biomes into one palette index per 4x4x4 cell.
+/// @param biomes_tag The section's `biomes` tag.
+/// @param out Receives the palette index of each cell, in the order Minecraft stores them (`y * 16 + z * 4 + x`).
+/// @exception Throws if the tag is malformed, or if its `data` is too short for its palette.
+void unpack_biomes(const NBTTag& biomes_tag, std::span<uint16_t, 64> out) {
+    internal::unpack_paletted(biomes_tag, 1, out);
+}
+/// @brief Replaces a section's block states with the given palette indices. The reverse of `unpack_block_states()`.
+/// @param block_states_tag The section's `block_states` tag. Its palette must already hold every state that is used.
+/// @param indices The palette index of each block. `data` is packed with as few bits as the palette allows, and left out if the palette has a single entry.
+/// @exception Throws if the tag is malformed, or if an index is past the end of the palette.
+void pack_block_states(NBTTag& block_states_tag, std::span<const uint16_t, 4096> indices) {
+    internal::pack_paletted(block_states_tag, 4, indices);
+}
+/// @brief Replaces a section's biomes with the given palette indices. The reverse of `unpack_biomes()`.
+/// @param biomes_tag The section's `biomes` tag. Its palette must already hold every biome that is used.
+/// @param indices The palette index of each cell. See `pack_block_states()`.
+/// @exception Throws if the tag is malformed, or if an index is past the end of the palette.
+void pack_biomes(NBTTag& biomes_tag, std::span<const uint16_t, 64> indices) {
+    internal::pack_paletted(biomes_tag, 1, indices);
+}
+
 /// @brief Loads a region file into a level.
+/// The file is read on `threads` threads, which decode just the sections' block states and biomes of each chunk (skipping the rest without building a tree).
+/// Each chunk that is present is then handed to the level as a task, which owns what was decoded and builds the chunk's sections on whichever of the level's workers runs it.
 /// @param level The level to load the chunks into.
-/// @param region_pos The position of the region in the file (`chunk_pos / 32` in both axes).
+/// @param region_pos The position of the region in the world (`chunk_pos / 32` in both axes). Chunks are placed by their position in the file, relative to it.
 /// @param filepath The path to the region file.
-/// @note Does not block. Only creates the tasks.
+/// @param threads The number of threads to parse the file on, including the calling thread. Defaults to one per hardware thread.
+/// @note Blocks until the file has been parsed, but not until the chunks have been loaded.
 /// Use `Level.block()` to ensure that the tasks get finished before these chunks are used.
-void load_region_file(Level& level, ChunkPos region_pos, const std::string& filepath) {
-    std::array<NBTTag, 1024> tags = read_region_file(filepath);
+/// @exception Throws if the file cannot be read, or if any chunk in it is malformed (in which case no tasks are created).
+void load_region_file(Level& level, ChunkPos region_pos, const std::string& filepath, unsigned threads = std::thread::hardware_concurrency()) {
+    RegionFile region(filepath);
+    std::array<std::optional<internal::ChunkFields>, 1024> chunks;
+    internal::parallel_for(1024, threads, [&](std::size_t i) {
+        std::span<const byte_t> sectors = internal::chunk_sectors(region.bytes(), region.header(), i);
+        // chunks that aren't present are left as they are in the level
+        if (!sectors.empty())
+            chunks[i] = internal::decode_chunk_fields(sectors, codec::Decompressor::local());
+    });
     for (std::size_t i = 0; i < 1024; ++i) {
-        ChunkPos pos(tags[i].at("x").get<int_t>(), tags[i].at("z").get<int_t>());
-        level.add_task(pos, internal::create_chunk_load_task(tags[i]));
+        if (!chunks[i]) continue;
+        ChunkPos pos(region_pos.x * 32 + (int)(i % 32), region_pos.z * 32 + (int)(i / 32));
+        level.add_task(pos, internal::create_chunk_load_task(std::move(*chunks[i])));
     }
 }
 
-/// @brief Stores some chunks in a level into a region file.
-/// @param level The level to get the chunks from.
+namespace internal {
+
+// A chunk's new record in a region file, padded to whole sectors (or without any, to remove the chunk), and its index within the region.
+struct SectorRecord {
+    std::size_t index = 0;
+    std::vector<byte_t> sectors;
+    uint_t timestamp = 0;
+};
+
+// Encodes a chunk for `update_region()`. Chunks that aren't compounds get no sectors, and so are removed.
+SectorRecord encode_sectors(ChunkPos pos, const NBTTag& chunk_tag, CompressionScheme scheme, int level, uint_t timestamp) {
+    SectorRecord ret;
+    ret.index = (std::size_t)(pos.x & 31) + (std::size_t)(pos.z & 31) * 32;
+    if (chunk_tag.type != TAG_COMPOUND) return ret;
+    ret.sectors = encode_chunk(chunk_tag, scheme, level);
+    std::size_t sectors = (ret.sectors.size() + 4095) / 4096;
+    if (sectors > 255)
+        throw std::runtime_error("Tried to write chunk (" + std::to_string(pos.x) + ", " + std::to_string(pos.z) + "), but it takes up " + std::to_string(sectors) + " sectors, and region files can only hold chunks of up to 255 sectors");
+    ret.sectors.resize(sectors * 4096, 0);
+    ret.timestamp = timestamp;
+    return ret;
+}
+
+// Writes chunks into a region file, leaving every other chunk in it untouched. The file is opened and its header read once, and it is created if it doesn't exist.
+// Each chunk is written over its old sectors if it still fits in them, and otherwise into the first gap that was already free (or onto the end), so that a chunk
+// never lands in sectors that the header still gives to another. The header is written last, in one go.
+void update_region(const std::string& path, std::span<const SectorRecord> records) {
+    std::size_t total = 0;
+    for (const SectorRecord& record : records)
+        total += record.sectors.size();
+    PhaseTimer timer(stats::PHASE_WRITE, total);
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file) {
+        // start a new region file with an empty header
+        std::ofstream(path, std::ios::binary).write(std::vector<char>(8192, 0).data(), 8192);
+        file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+        if (!file)
+            throw std::runtime_error("Tried to write chunks to region file " + path + ", but it could not be opened");
+    }
+    std::vector<byte_t> header_bytes(8192, 0);
+    file.read((char*)header_bytes.data(), header_bytes.size());
+    file.clear();
+    RegionHeader header = parse_region_header(header_bytes);
+
+    SectorMap map(header);
+    for (const SectorRecord& record : records) {
+        std::size_t sectors = record.sectors.size() / 4096, offset = 0;
+        if (sectors > 0) {
+            if (header.offsets[record.index] >= 2 && sectors <= header.sizes[record.index]) {
+                offset = header.offsets[record.index];
+            } else {
+                offset = map.first_fit(sectors);
+                map.mark(offset, sectors);
+            }
+            if (offset > 0xffffff)
+                throw std::runtime_error("Tried to write chunks to region file " + path + ", but the file is too large to address its sectors");
+            file.seekp(offset * 4096);
+            file.write((const char*)record.sectors.data(), record.sectors.size());
+        }
+        header.offsets[record.index] = (uint_t)offset;
+        header.sizes[record.index] = (byte_t)sectors;
+        header.timestamps[record.index] = record.timestamp;
+    }
+
+    // locations, then timestamps
+    std::array<uint_t, 2048> entries;
+    for (std::size_t i = 0; i < 1024; ++i) {
+        entries[i] = header.offsets[i] << 8 | header.sizes[i];
+        entries[1024 + i] = header.timestamps[i];
+    }
+    store_big_endian(entries.data(), entries.data(), entries.size());
+    file.seekp(0);
+    file.write((const char*)entries.data(), 8192);
+    if (!file)
+        throw std::runtime_error("Tried to write chunks to region file " + path + ", but writing failed");
+}
+
+}
+
+/// @brief Writes a single chunk to a region file, leaving every other chunk in it untouched.
+/// The chunk is written over its old sectors if it still fits in them, and otherwise into the first gap in the file that is big enough (or onto the end).
+/// Only its location and timestamp are updated in the header.
+/// @param path The path to the region file to write the chunk to. It is created if it does not exist.
+/// @param chunk_tag The chunk's NBT data. If it is not of type `TAG_COMPOUND`, the chunk is removed from the region instead.
+/// @param pos The position of the chunk. Only its position within the region (the lower five bits of each axis) is used.
+/// @param scheme The compression scheme to use for the chunk.
+/// @param level The compression level. See `write_region_file()`.
+/// @param timestamp When the chunk was last saved, in seconds since the Unix epoch. Defaults to the current time.
+/// @exception Throws if the compressed chunk is larger than the 255 sectors a region file can hold.
+void write_chunk(const std::string& path, const NBTTag& chunk_tag, ChunkPos pos, CompressionScheme scheme = ZLIB, int level = codec::default_level, std::optional<uint_t> timestamp = std::nullopt) {
+    internal::SectorRecord record = internal::encode_sectors(pos, chunk_tag, scheme, level, timestamp.value_or(internal::current_timestamp()));
+    internal::update_region(path, std::span<const internal::SectorRecord>(&record, 1));
+}
+
+/// @brief The orders that `compact_region_file()` can lay chunks out in.
+enum ChunkOrder {
+    /// @brief By index within the region (`x + z * 32`), the order `write_region_file()` uses. Reading a row of chunks along x reads the file in order.
+    CHUNK_ORDER_ROW_MAJOR,
+    /// @brief Z-order (Morton order): every aligned 2x2, 4x4, 8x8 and 16x16 block of chunks is stored together, so reading an area around a point touches few runs of the file.
+    CHUNK_ORDER_MORTON
+};
+
+/// @brief What `compact_region_file()` did.
+struct CompactionResult {
+    /// @brief The number of present chunks, all of which were kept.
+    std::size_t chunks;
+    /// @brief The size of the file before and after, in 4096-byte sectors (including the header).
+    std::size_t sectors_before, sectors_after;
+};
+
+/// @brief Rewrites a region file with its chunks stored one after another, dropping the gaps that rewriting chunks in place (see `write_chunk()`) leaves behind.
+/// Chunks are copied as they are stored (compressed), without being inflated, and keep their timestamps. The new file is written next to the old one
+/// and then renamed over it, so a crash partway through leaves either the old file or the new one, never a mix.
+/// @param path The path to the region file.
+/// @param order The order to lay the chunks out in. See `ChunkOrder`.
+/// @return How many chunks were kept, and how much smaller the file got.
+/// @exception Throws if the file can't be read or written, or if a chunk's sectors or length are malformed (in which case the file is left untouched).
+/// @note Nothing else may write to the file while it is compacted.
+CompactionResult compact_region_file(const std::string& path, ChunkOrder order = CHUNK_ORDER_MORTON) {
+    std::string temp_path = path + ".compact";
+    CompactionResult ret{0, 0, 2};
+    {
+        RegionFile region(path);
+        ret.sectors_before = (region.bytes().size() + 4095) / 4096;
+        std::array<std::span<const byte_t>, 1024> records;
+        for (std::size_t i = 0; i < 1024; ++i) {
+            std::span<const byte_t> sectors = internal::chunk_sectors(region.bytes(), region.header(), i);
+            if (sectors.empty()) continue;
+            // just the record, without whatever padding (or stale data) follows it in its sectors
+            records[i] = sectors.first(5 + internal::chunk_data(sectors).data.size());
+            ++ret.chunks;
+            ret.sectors_after += (records[i].size() + 4095) / 4096;
+        }
+        try {
+            internal::write_records(temp_path, records, region.header().timestamps, order == CHUNK_ORDER_MORTON ? internal::morton_order() : internal::row_major_order());
+        } catch (...) {
+            std::error_code ignored;
+            std::filesystem::remove(temp_path, ignored);
+            throw;
+        }
+        // the mapping is closed here, before the file under it is replaced
+    }
+    std::filesystem::rename(temp_path, path);
+    return ret;
+}
+
+/// @brief Collects changed chunks, and writes them into the region files of a world.
+/// Chunks are grouped by region as they are added. A flush then only touches the regions that have changed since the last one,
+/// and in each of those only compresses and writes the chunks that changed (over their old sectors where they still fit, see `write_chunk()`),
+/// so saving a large world regularly costs about as much as its changes rather than a full rewrite.
+/// @note All member functions are thread-safe, and chunks can be added while a flush is running (they are written by the next one).
+class RegionWriter {
+public:
+    /// @brief Creates a writer for a world's region directory.
+    /// @param region_dir The directory holding the region files (such as `world/region`). It is created at the first flush if it doesn't exist.
+    /// @param scheme The compression scheme to write chunks with.
+    /// @param level The compression level. See `write_region_file()`.
+    explicit RegionWriter(std::string region_dir, CompressionScheme scheme = ZLIB, int level = codec::default_level)
+        : region_dir(std::move(region_dir)), scheme(scheme), level(level) {}
+
+    /// @brief Queues a chunk to be written at the next flush, replacing any version of it that is already queued.
+    /// @param pos The chunk's position in the world.
+    /// @param chunk_tag The chunk's NBT data. If it is not of type `TAG_COMPOUND`, the chunk is removed from its region instead.
+    void set_chunk(ChunkPos pos, NBTTag chunk_tag);
+    /// @brief Queues a chunk to be written at the next flush, unless it is the same as when it was read.
+    /// @param pos The chunk's position in the world.
+    /// @param chunk_tag The chunk's NBT data. See `set_chunk(ChunkPos, NBTTag)`.
+    /// @param original The chunk as it was read (see `read_region_file_parallel()`).
+    /// @return Whether the chunk was queued. A chunk that hasn't changed is still queued if a different version of it is already waiting, so that the change is undone.
+    bool set_chunk(ChunkPos pos, NBTTag chunk_tag, const StoredChunk& original);
+    /// @brief Queues a chunk to be removed from its region at the next flush.
+    /// @param pos The chunk's position in the world.
+    void remove_chunk(ChunkPos pos);
+
+    /// @brief Gets the number of regions with changes waiting to be written.
+    std::size_t dirty_regions() const;
+    /// @brief Gets the number of chunks waiting to be written (or removed).
+    std::size_t dirty_chunks() const;
+
+    /// @brief Writes every queued change to disk.
+    /// All the queued chunks are compressed at once, and each region file is then opened, and its header read and rewritten, once (several regions at a time).
+    /// Region files are named `r.<x>.<z>.mca`, and are created if they don't exist.
+    /// @param threads The number of threads to compress chunks and write regions on, including the calling thread. Defaults to one per hardware thread.
+    /// @exception If any region throws, the other regions are still written, and the first such exception is rethrown once they all have been.
+    /// The chunks of the regions that failed are queued again (unless a newer version of them has been queued since).
+    void flush(unsigned threads = std::thread::hardware_concurrency());
+
+    /// @brief Gets the file name of a region.
+    /// @param region_pos The region's position in the world (`chunk_pos / 32` in both axes, rounding down).
+    /// @return The region's file name, such as `r.-1.2.mca`.
+    static std::string region_file_name(ChunkPos region_pos);
+
+private:
+    // chunk index within the region -> the chunk's new tag
+    using RegionChanges = std::map<std::size_t, NBTTag>;
+
+    std::string region_dir;
+    CompressionScheme scheme;
+    int level;
+
+    mutable std::mutex mutex;
+    std::map<std::pair<int, int>, RegionChanges> dirty;
+};
+
+void RegionWriter::set_chunk(ChunkPos pos, NBTTag chunk_tag) {
+    // arithmetic shifts round down, so negative chunk positions end up in negative regions
+    std::pair<int, int> region(pos.x >> 5, pos.z >> 5);
+    std::size_t index = (std::size_t)(pos.x & 31) + (std::size_t)(pos.z & 31) * 32;
+    std::lock_guard lock(this->mutex);
+    this->dirty[region].insert_or_assign(index, std::move(chunk_tag));
+}
+bool RegionWriter::set_chunk(ChunkPos pos, NBTTag chunk_tag, const StoredChunk& original) {
+    // hashed before taking the lock, since that's the slow part
+    bool unchanged = original.unchanged(chunk_tag);
+    std::pair<int, int> region(pos.x >> 5, pos.z >> 5);
+    std::size_t index = (std::size_t)(pos.x & 31) + (std::size_t)(pos.z & 31) * 32;
+    std::lock_guard lock(this->mutex);
+    if (unchanged) {
+        auto it = this->dirty.find(region);
+        if (it == this->dirty.end() || !it->second.contains(index))
+            return false;
+    }
+    this->dirty[region].insert_or_assign(index, std::move(chunk_tag));
+    return true;
+}
+void RegionWriter::remove_chunk(ChunkPos pos) {
+    this->set_chunk(pos, NBTTag(TAG_BYTE, "EmptyChunk", (char)0));
+}
+
+std::size_t RegionWriter::dirty_regions() const {
+    std::lock_guard lock(this->mutex);
+    return this->dirty.size();
+}
+std::size_t RegionWriter::dirty_chunks() const {
+    std::lock_guard lock(this->mutex);
+    std::size_t ret = 0;
+    for (const auto& [region, changes] : this->dirty)
+        ret += changes.size();
+    return ret;
+}
+
+void RegionWriter::flush(unsigned threads) {
+    if (this->dirty_regions() == 0) return;
+    // done before taking the changes, so that nothing is lost if it fails
+    std::filesystem::create_directories(this->region_dir);
+    std::vector<std::pair<std::pair<int, int>, RegionChanges>> regions;
+    {
+        std::lock_guard lock(this->mutex);
+        for (auto& [region, changes] : this->dirty)
+            regions.emplace_back(region, std::move(changes));
+        this->dirty.clear();
+    }
+
+    // every chunk of every region is compressed at once, so that a flush of a single region still uses all the threads
+    struct PendingChunk {
+        std::size_t region;
+        internal::SectorRecord* record;
+        ChunkPos pos;
+        const NBTTag* tag;
+    };
+    std::vector<std::vector<internal::SectorRecord>> records(regions.size());
+    std::vector<PendingChunk> pending;
+    for (std::size_t i = 0; i < regions.size(); ++i) {
+        auto& [region, changes] = regions[i];
+        records[i].resize(changes.size());
+        std::size_t j = 0;
+        for (const auto& [index, tag] : changes)
+            pending.push_back({i, &records[i][j++], ChunkPos(region.first * 32 + (int)(index % 32), region.second * 32 + (int)(index / 32)), &tag});
+    }
+    // a failing region mustn't stop the others from being written, so errors are kept here rather than passed to parallel_for
+    std::vector<std::exception_ptr> errors(regions.size());
+    std::mutex errors_mutex;
+    uint_t now = internal::current_timestamp();
+    internal::parallel_for(pending.size(), threads, [&](std::size_t i) {
+        try {
+            *pending[i].record = internal::encode_sectors(pending[i].pos, *pending[i].tag, this->scheme, this->level, now);
+        } catch (...) {
+            std::lock_guard lock(errors_mutex);
+            if (!errors[pending[i].region]) errors[pending[i].region] = std::current_exception();
+        }
+    });
+
+    // then each region file is opened, and its header read and written, once
+    std::exception_ptr error;
+    internal::parallel_for(regions.size(), threads, [&](std::size_t i) {
+        auto& [region, changes] = regions[i];
+        if (!errors[i]) {
+            try {
+                std::string path = (std::filesystem::path(this->region_dir) / region_file_name(ChunkPos(region.first, region.second))).string();
+                internal::update_region(path, records[i]);
+                return;
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+        // the header wasn't written, so none of the region's chunks were: put them all back, without overwriting anything newer
+        std::lock_guard lock(this->mutex);
+        RegionChanges& requeued = this->dirty[region];
+        for (auto& [index, tag] : changes)
+            requeued.try_emplace(index, std::move(tag));
+        if (!error) error = errors[i];
+    });
+    if (error)
+        std::rethrow_exception(error);
+}
+
+std::string RegionWriter::region_file_name(ChunkPos region_pos) {
+    return "r." + std::to_string(region_pos.x) + "." + std::to_string(region_pos.z) + ".mca";
+}
+
+namespace internal {
+
+// Exporting reads chunks back out of a level with these accessors, which mirror the constructors that loading uses. Not every version of mclevel has them,
+// so everything that uses them is a template constrained on them: this header still compiles without them, and only `store_region_file()` and `store_all()` are missing.
+template <typename SectionType> concept ExportableSection = requires(const SectionType& section, std::size_t i) {
+    { section.block_states().palette().begin()->name() } -> std::convertible_to<std::string>;
+    { section.block_states().palette().begin()->properties().begin()->first } -> std::convertible_to<std::string>;
+    { section.block_states().palette().begin()->properties().begin()->second } -> std::convertible_to<std::string>;
+    { section.block_states().get_index(i) } -> std::convertible_to<std::size_t>;
+    { section.biomes().palette().begin()->name() } -> std::convertible_to<std::string>;
+    { section.biomes().get_index(i) } -> std::convertible_to<std::size_t>;
+};
+template <typename LevelType> concept ExportableLevel = requires(LevelType& level, ChunkPos pos) {
+    { level.has_chunk(pos) } -> std::convertible_to<bool>;
+    { *level.chunk_positions().begin() } -> std::convertible_to<ChunkPos>;
+} && ExportableSection<Section>;
+
+template <typename BlockStateType> NBTTag block_state_tag(const BlockStateType& state) {
+    std::vector<NBTTag> children{NBTTag(TAG_STRING, "Name", std::string(state.name()))};
+    const auto& properties = state.properties();
+    if (!properties.empty()) {
+        // sorted, so that the same state is always written the same way (see BlockStateCache)
+        std::vector<std::pair<std::string, std::string>> sorted(properties.begin(), properties.end());
+        std::sort(sorted.begin(), sorted.end());
+        std::vector<NBTTag> values;
+        values.reserve(sorted.size());
+        for (const auto& [key, value] : sorted)
+            values.push_back(NBTTag(TAG_STRING, key, value));
+        children.push_back(NBTTag(TAG_COMPOUND, "Properties", values));
+    }
+    return NBTTag(TAG_COMPOUND, "", children);
+}
+
+// Sets a child of a compound, replacing the one with the same name if there is one.
+void set_child(Compound& children, NBTTag tag) {
+    if (NBTTag* old = children.find(tag.name))
+        *old = std::move(tag);
+    else
+        children.push_back(std::move(tag));
+}
+
+// Replaces the block states and biomes of a section's tag with those of a level's section, keeping the rest of it (such as its light).
+template <typename SectionType> void patch_section(NBTTag& section_tag, const SectionType& section) {
+    Compound& children = section_tag.get_ref<Compound>();
+
+    const auto& block_states = section.block_states();
+    std::vector<NBTTag> block_palette;
+    block_palette.reserve(block_states.palette().size());
+    for (const auto& state : block_states.palette())
+        block_palette.push_back(block_state_tag(state));
+    NBTTag block_states_tag(TAG_COMPOUND, "block_states", std::vector<NBTTag>{NBTTag(TAG_ARRAY, "palette", block_palette)});
+    std::array<uint16_t, 4096> block_indices;
+    for (std::size_t i = 0; i < block_indices.size(); ++i)
+        block_indices[i] = (uint16_t)block_states.get_index(i);
+    pack_block_states(block_states_tag, block_indices);
+    set_child(children, std::move(block_states_tag));
+
+    const auto& biomes = section.biomes();
+    std::vector<NBTTag> biome_palette;
+    biome_palette.reserve(biomes.palette().size());
+    for (const auto& biome : biomes.palette())
+        biome_palette.push_back(NBTTag(TAG_STRING, "", std::string(biome.name())));
+    NBTTag biomes_tag(TAG_COMPOUND, "biomes", std::vector<NBTTag>{NBTTag(TAG_ARRAY, "palette", biome_palette)});
+    std::array<uint16_t, 64> biome_indices;
+    for (std::size_t i = 0; i < biome_indices.size(); ++i)
+        biome_indices[i] = (uint16_t)biomes.get_index(i);
+    pack_biomes(biomes_tag, biome_indices);
+    set_child(children, std::move(biomes_tag));
+}
+
+// Replaces the sections of a chunk's stored tag with a level's, keeping everything else in it (entities, block entities, heightmaps, structures, its data version, ...).
+// Only the sections that loading put into the level are replaced, so the chunk keeps its own height, and the light-only sections just above and below the world are kept as they are.
+template <typename ChunkType> void patch_chunk(NBTTag& chunk_tag, ChunkType& chunk) {
+    for (NBTTag& section_tag : chunk_tag.at("sections").get_ref<array_t<NBTTag>>()) {
+        const Compound& children = section_tag.get_ref<Compound>();
+        if (!children.contains("block_states") || !children.contains("biomes")) continue;
+        int y = (int)(signed char)section_tag.at("Y").get<byte_t>();
+        patch_section(section_tag, chunk.get_section(y));
+    }
+}
+
+// Reads the given chunks of a level's region back from its file, and replaces their sections with the level's (see `patch_chunk()`) on the level's own workers.
+// Returns the chunks that changed, with their positions. Nothing is returned (the call throws instead) if any chunk isn't in the file or can't be read,
+// since a chunk can only be stored over the one it was loaded from.
+template <typename LevelType> std::vector<std::pair<ChunkPos, NBTTag>> export_region(LevelType& level, const std::string& path, std::span<const ChunkPos> positions, unsigned threads) {
+    std::vector<std::pair<ChunkPos, NBTTag>> chunks;
+    chunks.reserve(positions.size());
+    {
+        RegionFile region(path);
+        std::vector<std::optional<NBTTag>> stored(positions.size());
+        parallel_for(positions.size(), threads, [&](std::size_t i) {
+            stored[i] = region.read_chunk(positions[i].x & 31, positions[i].z & 31);
+            if (!stored[i] || stored[i]->type != TAG_COMPOUND)
+                throw std::runtime_error("Tried to store chunk (" + std::to_string(positions[i].x) + ", " + std::to_string(positions[i].z) + ") into region file " + path +
+                                         ", but it isn't there, and chunks can only be stored over the ones they were loaded from");
+        });
+        for (std::size_t i = 0; i < positions.size(); ++i)
+            chunks.emplace_back(positions[i], std::move(*stored[i]));
+    }
+
+    // a plain vector<bool> would be written to from several workers at once
+    std::vector<char> changed(chunks.size(), false);
+    std::mutex mutex;
+    std::exception_ptr error;
+    try {
+        for (std::size_t i = 0; i < chunks.size(); ++i) {
+            level.add_task(chunks[i].first, [&, i](auto& chunk) {
+                try {
+                    NBTTag& tag = chunks[i].second;
+                    // unordered, since the palettes' properties are written sorted, which they may not have been
+                    std::uint64_t before = hash_tag(tag, HASH_UNORDERED);
+                    patch_chunk(tag, chunk);
+                    changed[i] = hash_tag(tag, HASH_UNORDERED) != before;
+                } catch (...) {
+                    std::lock_guard lock(mutex);
+                    if (!error) error = std::current_exception();
+                }
+            });
+        }
+    } catch (...) {
+        // the tasks already given to the level refer to this frame
+        level.block();
+        throw;
+    }
+    level.block();
+    if (error)
+        std::rethrow_exception(error);
+
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < chunks.size(); ++i)
+        if (changed[i])
+            chunks[kept++] = std::move(chunks[i]);
+    chunks.erase(chunks.begin() + (std::ptrdiff_t)kept, chunks.end());
+    return chunks;
+}
+
+}
+
+/// @brief Stores the chunks of one region of a level back into the region file they were loaded from.
+/// Each chunk's stored tag is read back, and only its sections' block states and biomes are replaced with the level's (on the level's workers),
+/// so everything a level doesn't keep (entities, block entities, heightmaps, structures, light, ...) is kept, as are the chunk's height and data version.
+/// Only the chunks that changed are compressed (on several threads) and written, in place where they still fit.
+/// @param level The level to get the chunks from. Chunks of the region that the level doesn't have are left as they are in the file.
 /// @param region_pos The region position in the world (`chunk_pos / 32` in both axes).
-/// @param filepath The path to the file to store the chunks into.
+/// @param filepath The path to the region file.
 /// @param scheme The compression scheme to use for chunks.
-void store_region_file(Level& level, ChunkPos region_pos, const std::string& filepath, CompressionScheme scheme = ZLIB) {
-    /// ...
-    throw std::runtime_error("Unimplemented function store_region_file!");
+/// @param threads The number of threads to read and compress chunks on, including the calling thread. Defaults to one per hardware thread.
+/// @return The number of chunks that were written.
+/// @note Needs a version of mclevel that can read chunks back out of a level (see `internal::ExportableLevel`). Blocks until the file has been written.
+/// @exception Throws if the file can't be read or written, or if a chunk the level has isn't in the file, can't be read from it, or can't be read from the level.
+/// In each of those cases, the file is left as it was.
+template <typename LevelType> requires internal::ExportableLevel<LevelType>
+std::size_t store_region_file(LevelType& level, ChunkPos region_pos, const std::string& filepath, CompressionScheme scheme = ZLIB, unsigned threads = std::thread::hardware_concurrency()) {
+    std::vector<ChunkPos> positions;
+    for (int i = 0; i < 1024; ++i) {
+        ChunkPos pos(region_pos.x * 32 + i % 32, region_pos.z * 32 + i / 32);
+        if (level.has_chunk(pos))
+            positions.push_back(pos);
+    }
+    if (positions.empty()) return 0;
+    std::vector<std::pair<ChunkPos, NBTTag>> chunks = internal::export_region(level, filepath, positions, threads);
+    std::vector<internal::SectorRecord> records(chunks.size());
+    uint_t now = internal::current_timestamp();
+    internal::parallel_for(chunks.size(), threads, [&](std::size_t i) {
+        records[i] = internal::encode_sectors(chunks[i].first, chunks[i].second, scheme, codec::default_level, now);
+    });
+    if (!records.empty())
+        internal::update_region(filepath, records);
+    return records.size();
 }
 
-/// @brief Stores all chunks in a level into a region file.
+/// @brief Stores all chunks in a level back into the region files of the world they were loaded from.
+/// Works through the level one region at a time, as `store_region_file()` does, writing the changed chunks of each with `RegionWriter` before reading the next,
+/// so only one region's chunks are held at once, and regularly saving a world that has barely changed writes next to nothing.
 /// @param level The level to get the chunks from.
-/// @param region_dir_path The path to the directory to store the chunks in.
+/// @param region_dir_path The path to the directory the chunks were loaded from (such as `world/region`).
 /// @param scheme The compression scheme to use for chunks.
-void store_all(Level& level, const std::string& region_dir_path, CompressionScheme scheme = ZLIB) {
-    /// ...
-    throw std::runtime_error("Unimplemented function store_all!");
+/// @param threads The number of threads to read and compress chunks on, including the calling thread. Defaults to one per hardware thread.
+/// @return The number of chunks that were written.
+/// @note See `store_region_file()`.
+/// @exception Throws as `store_region_file()` does. The region that failed is left as it was, but the regions before it have already been written.
+template <typename LevelType> requires internal::ExportableLevel<LevelType>
+std::size_t store_all(LevelType& level, const std::string& region_dir_path, CompressionScheme scheme = ZLIB, unsigned threads = std::thread::hardware_concurrency()) {
+    std::map<std::pair<int, int>, std::vector<ChunkPos>> regions;
+    for (ChunkPos pos : level.chunk_positions())
+        regions[{pos.x >> 5, pos.z >> 5}].push_back(pos);
+    RegionWriter writer(region_dir_path, scheme);
+    std::size_t ret = 0;
+    for (const auto& [region, positions] : regions) {
+        std::string path = (std::filesystem::path(region_dir_path) / RegionWriter::region_file_name(ChunkPos(region.first, region.second))).string();
+        for (auto& [pos, tag] : internal::export_region(level, path, positions, threads)) {
+            writer.set_chunk(pos, std::move(tag));
+            ++ret;
+        }
+        writer.flush(threads);
+    }
+    return ret;
 }
 
-/// @brief Writes a single chunk to a region file.
-/// @param path The path to the region file to write the chunk to.
-/// @param chunk_tag The chunk's NBT data.
-/// @param pos The position of the chunk.
-/// @param scheme The compression scheme to use for the chunk.
-void write_chunk(const std::string& path, const NBTTag& chunk_tag, ChunkPos pos, CompressionScheme scheme = ZLIB) {
-    /// ...
-    throw std::runtime_error("Unimplemented function write_chunk!");
+namespace internal {
+
+// Asks the OS to start reading a whole file into the page cache in the background, where it supports that. Failures are ignored, since this is only a hint.
+void prefetch_file(const std::string& path) {
+#if defined(NBT_HAS_MMAP) && defined(POSIX_FADV_WILLNEED)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    // the pages keep being read in after the file is closed
+    ::close(fd);
+#else
+    (void)path;
+#endif
+}
+
+}
+
+/// @brief A chunk read by `WorldReader`.
+struct WorldChunk {
+    /// @brief The chunk's position in the world.
+    ChunkPos pos;
+    /// @brief When the chunk was last saved, in seconds since the Unix epoch.
+    uint_t timestamp;
+    /// @brief The chunk's NBT data.
+    NBTTag tag;
+};
+
+/// @brief Reads every chunk of every region file in a world's region directory, for jobs that go over a whole world.
+/// Region files are decoded on background threads, which hand their chunks over through a queue of bounded size.
+/// A worker that gets ahead of the consumer waits for room in the queue, so memory use depends on the size of the queue and not on the size of the world.
+/// While a region is being decoded, the OS is asked to start reading the files of the regions a few places after it, so the workers rarely wait on the disk either.
+/// @note Region files are memory-mapped (see `RegionFile`), so the files themselves count towards the page cache rather than the heap.
+class WorldReader {
+public:
+    /// @brief Finds the region files in a directory and starts reading them.
+    /// @param region_dir The directory holding the region files (such as `world/region`). Files that aren't named `r.<x>.<z>.mca` are ignored, as are empty ones.
+    /// @param capacity The most chunks to hold decoded but not yet taken by `next()`.
+    /// @param prefetch How many regions ahead of the ones being decoded to prefetch. 0 turns prefetching off.
+    /// @param threads The number of background threads to decode regions on. Defaults to one per hardware thread.
+    /// @param alloc The allocator to allocate the chunks' strings and arrays with. It is used from every worker at once, so its memory resource must be thread-safe (see `read_region_file_parallel()`).
+    /// @param symbols If not null, the table to intern tag names in.
+    /// @param modified_after If not 0, only chunks saved after this time (in seconds since the Unix epoch) are read, for jobs that only need what has changed since they last ran.
+    /// Other chunks are skipped using the timestamps in their regions' headers, without being decompressed, and region files not modified since then aren't opened at all.
+    /// @exception Throws if `region_dir` is not a directory.
+    explicit WorldReader(const std::string& region_dir, std::size_t capacity = 1024, std::size_t prefetch = 4, unsigned threads = std::thread::hardware_concurrency(),
+                         const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr, uint_t modified_after = 0);
+    WorldReader(const WorldReader&) = delete;
+    WorldReader& operator=(const WorldReader&) = delete;
+    /// @brief Stops the workers (throwing away any chunks that haven't been taken), and waits for them to finish.
+    ~WorldReader();
+
+    /// @brief Takes the next chunk, waiting for one to be decoded if there is none in the queue.
+    /// Regions are started in order of position (by x, then z), and chunks from a region come in the order they are stored in it,
+    /// but with more than one thread, chunks from regions that are being decoded at the same time are interleaved.
+    /// Chunks that are not present are skipped.
+    /// @return The chunk, or nothing once every chunk has been taken.
+    /// @exception If a region file can't be read or a chunk in it is malformed, rethrows the exception (and every later call does the same). The other workers are stopped.
+    std::optional<WorldChunk> next();
+
+    /// @brief Gets the number of region files that were found.
+    std::size_t region_count() const { return this->regions.size(); }
+
+    /// @brief Gets the position of a region from the name of its file. The reverse of `RegionWriter::region_file_name()`.
+    /// @param file_name The file name, such as `r.-1.2.mca`.
+    /// @return The region's position, or nothing if the name is not that of a region file.
+    static std::optional<ChunkPos> parse_region_file_name(std::string_view file_name);
+
+private:
+    struct Region {
+        std::string path;
+        ChunkPos pos;
+    };
+
+    void work();
+    // Decodes every chunk of a region into the queue. Returns false if the reader is stopping.
+    bool read_region(const Region& region);
+
+    std::vector<Region> regions;
+    std::size_t capacity, prefetch;
+    NBTTag::allocator_type alloc;
+    SymbolTable* symbols;
+    uint_t modified_after;
+
+    std::mutex mutex;
+    std::condition_variable not_empty, not_full;
+    std::deque<WorldChunk> queue;
+    std::size_t next_region = 0;
+    // the number of workers that haven't finished yet
+    unsigned running = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::vector<std::thread> workers;
+};
+
+WorldReader::WorldReader(const std::string& region_dir, std::size_t capacity, std::size_t prefetch, unsigned threads, const NBTTag::allocator_type& alloc, SymbolTable* symbols, uint_t modified_after)
+    : capacity(std::max<std::size_t>(capacity, 1)), prefetch(prefetch), alloc(alloc), symbols(symbols), modified_after(modified_after) {
+    if (!std::filesystem::is_directory(region_dir))
+        throw std::runtime_error("Tried to read the region files in " + region_dir + ", but it is not a directory");
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(region_dir)) {
+        if (!entry.is_regular_file()) continue;
+        std::optional<ChunkPos> pos = parse_region_file_name(entry.path().filename().string());
+        // Minecraft leaves empty region files behind for regions it has created but never saved anything to
+        if (!pos || entry.file_size() == 0) continue;
+        if (modified_after > 0) {
+            // a file is written after (or as) any chunk in it is stamped, so one that is older can't hold anything newer
+            auto modified = std::chrono::file_clock::to_sys(entry.last_write_time());
+            if (std::chrono::duration_cast<std::chrono::seconds>(modified.time_since_epoch()).count() < (long long)modified_after) continue;
+        }
+        this->regions.push_back({entry.path().string(), *pos});
+    }
+    std::sort(this->regions.begin(), this->regions.end(), [](const Region& lhs, const Region& rhs) {
+        return lhs.pos.x != rhs.pos.x ? lhs.pos.x < rhs.pos.x : lhs.pos.z < rhs.pos.z;
+    });
+
+    // the first few regions are prefetched here, and every worker then tops the window up as it starts each region
+    for (std::size_t i = 0; i < this->prefetch && i < this->regions.size(); ++i)
+        internal::prefetch_file(this->regions[i].path);
+    std::size_t worker_count = std::min<std::size_t>(std::max(threads, 1u), this->regions.size());
+    this->running = (unsigned)worker_count;
+    this->workers.reserve(worker_count);
+    for (std::size_t i = 0; i < worker_count; ++i)
+        this->workers.emplace_back(&WorldReader::work, this);
+}
+
+WorldReader::~WorldReader() {
+    {
+        std::lock_guard lock(this->mutex);
+        this->stopping = true;
+    }
+    this->not_full.notify_all();
+    for (std::thread& worker : this->workers)
+        worker.join();
+}
+
+std::optional<WorldChunk> WorldReader::next() {
+    std::unique_lock lock(this->mutex);
+    this->not_empty.wait(lock, [&] { return this->error || !this->queue.empty() || this->running == 0; });
+    if (this->error)
+        std::rethrow_exception(this->error);
+    if (this->queue.empty())
+        return std::nullopt;
+    WorldChunk ret = std::move(this->queue.front());
+    this->queue.pop_front();
+    lock.unlock();
+    this->not_full.notify_one();
+    return ret;
+}
+
+std::optional<ChunkPos> WorldReader::parse_region_file_name(std::string_view file_name) {
+    if (!file_name.starts_with("r.") || !file_name.ends_with(".mca")) return std::nullopt;
+    std::string_view coords = file_name.substr(2, file_name.size() - 6);
+    const char* end = coords.data() + coords.size();
+    int x, z;
+    auto [x_end, x_error] = std::from_chars(coords.data(), end, x);
+    if (x_error != std::errc() || x_end == end || *x_end != '.') return std::nullopt;
+    auto [z_end, z_error] = std::from_chars(x_end + 1, end, z);
+    if (z_error != std::errc() || z_end != end) return std::nullopt;
+    return ChunkPos(x, z);
+}
+
+void WorldReader::work() {
+    try {
+        while (true) {
+            std::size_t i;
+            {
+                std::lock_guard lock(this->mutex);
+                if (this->stopping || this->next_region == this->regions.size()) break;
+                i = this->next_region++;
+            }
+            if (this->prefetch > 0 && i + this->prefetch < this->regions.size())
+                internal::prefetch_file(this->regions[i + this->prefetch].path);
+            if (!this->read_region(this->regions[i])) break;
+        }
+    } catch (...) {
+        std::lock_guard lock(this->mutex);
+        if (!this->error) this->error = std::current_exception();
+        this->stopping = true;
+        this->not_full.notify_all();
+    }
+    {
+        std::lock_guard lock(this->mutex);
+        --this->running;
+    }
+    this->not_empty.notify_all();
+}
+
+bool WorldReader::read_region(const Region& region) {
+    RegionFile file(region.path);
+    codec::Decompressor& decompressor = codec::Decompressor::local();
+    for (std::size_t i = 0; i < 1024; ++i) {
+        if (this->modified_after > 0 && file.header().timestamps[i] <= this->modified_after) continue;
+        std::span<const byte_t> sectors = internal::chunk_sectors(file.bytes(), file.header(), i);
+        if (sectors.empty()) continue;
+        // chunks are placed the same way as by load_region_file()
+        WorldChunk chunk{ChunkPos(region.pos.x * 32 + (int)(i % 32), region.pos.z * 32 + (int)(i / 32)), file.header().timestamps[i],
+                         internal::decode_chunk(sectors, this->alloc, this->symbols, decompressor)};
+        std::unique_lock lock(this->mutex);
+        this->not_full.wait(lock, [&] { return this->stopping || this->queue.size() < this->capacity; });
+        if (this->stopping) return false;
+        this->queue.push_back(std::move(chunk));
+        lock.unlock();
+        this->not_empty.notify_one();
+    }
+    return true;
 }
 
 }
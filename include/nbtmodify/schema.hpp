@@ -0,0 +1,389 @@
+#ifndef SCHEMA_HPP
+#define SCHEMA_HPP
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "core.hpp"
+
+// Decoding NBT straight into C++ structs (and encoding them back), for fixed formats where a generic tree would only be walked once and thrown away.
+// A struct lists its fields with NBT_FIELDS, and its compounds are then read in a single pass over the bytes: each key is looked up
+// in a perfect hash table built at compile time, and keys that the struct doesn't have are stepped over without being decoded or allocated.
+//
+// Members map to tags by their type:
+//   bool, char, signed char            TAG_BYTE
+//   short_t, int_t, long_t             TAG_SHORT, TAG_INT, TAG_LONG
+//   float, double                      TAG_FLOAT, TAG_DOUBLE
+//   std::string, string_t              TAG_STRING
+//   std::vector<byte_t>                TAG_BYTEARRAY
+//   std::vector<int_t> / <uint_t>      TAG_INTARRAY (unsigned elements are reinterpreted, as Minecraft does with packed data)
+//   std::vector<long_t> / <ulong_t>    TAG_LONGARRAY
+//   std::vector<T> (any other T)       TAG_ARRAY of T
+//   structs with NBT_FIELDS            TAG_COMPOUND with those keys
+//   std::map / std::unordered_map      TAG_COMPOUND with any keys (which must be std::string), all holding the same type
+//   std::optional<T>                   as T, but may be missing (and is left out when encoding if empty)
+//   NBTTag                             any tag at all, decoded into a generic tree
+
+namespace nbt {
+
+/// @brief Binds an NBT key to a data member of a struct. See `NBT_FIELDS`.
+template <typename T, typename M> struct Field {
+    std::string_view key;
+    M T::* member;
+};
+
+/// @brief Binds an NBT key to a data member of a struct.
+/// `NBT_FIELDS` binds each member to a key with the same name. To use other keys, define `nbt_fields()` by hand instead:
+/// `constexpr auto nbt_fields(const Section*) { return std::make_tuple(nbt::field("Y", &Section::y), nbt::field("biomes", &Section::biomes)); }`
+template <typename T, typename M> constexpr Field<T, M> field(std::string_view key, M T::* member) {
+    return {key, member};
+}
+
+}
+
+#define NBT_INTERNAL_PARENS ()
+// 4^4 rescans, one for each field
+#define NBT_INTERNAL_EXPAND(...) NBT_INTERNAL_EXPAND3(NBT_INTERNAL_EXPAND3(NBT_INTERNAL_EXPAND3(NBT_INTERNAL_EXPAND3(__VA_ARGS__))))
+#define NBT_INTERNAL_EXPAND3(...) NBT_INTERNAL_EXPAND2(NBT_INTERNAL_EXPAND2(NBT_INTERNAL_EXPAND2(NBT_INTERNAL_EXPAND2(__VA_ARGS__))))
+#define NBT_INTERNAL_EXPAND2(...) NBT_INTERNAL_EXPAND1(NBT_INTERNAL_EXPAND1(NBT_INTERNAL_EXPAND1(NBT_INTERNAL_EXPAND1(__VA_ARGS__))))
+#define NBT_INTERNAL_EXPAND1(...) __VA_ARGS__
+#define NBT_INTERNAL_FIELDS(type, member, ...) ::nbt::field(#member, &type::member) __VA_OPT__(, NBT_INTERNAL_FIELDS_AGAIN NBT_INTERNAL_PARENS (type, __VA_ARGS__))
+#define NBT_INTERNAL_FIELDS_AGAIN() NBT_INTERNAL_FIELDS
+
+/// @brief Describes the NBT fields of a struct, each of which is stored under the name of its member. Use at namespace scope, in the struct's own namespace:
+/// `struct ChunkHeader { int_t xPos, zPos; std::string Status; int_t DataVersion; };`
+/// `NBT_FIELDS(ChunkHeader, xPos, zPos, Status, DataVersion)`
+/// The struct can then be used with `decode_nbt()` and `encode_nbt()`, and as a member of other described structs.
+#define NBT_FIELDS(type, ...) \
+    constexpr auto nbt_fields(const type*) { return std::make_tuple(NBT_INTERNAL_EXPAND(NBT_INTERNAL_FIELDS(type, __VA_ARGS__))); }
+
+namespace nbt {
+
+namespace internal {
+
+template <typename T> concept Described = requires { nbt_fields(static_cast<const T*>(nullptr)); };
+
+// What decoding needs besides the bytes: where to put the strings and arrays of any `NBTTag` members.
+struct SchemaContext {
+    NBTTag::allocator_type alloc;
+    SymbolTable* symbols;
+};
+
+constexpr std::uint64_t schema_hash(std::string_view key, std::uint64_t seed) {
+    std::uint64_t hash = 14695981039346656037ull ^ (seed * 0x9e3779b97f4a7c15ull);
+    for (char c : key) {
+        hash ^= (unsigned char)c;
+        hash *= 1099511628211ull;
+    }
+    return hash ^ (hash >> 29);
+}
+
+// A perfect hash table over the keys of a struct's fields: every key has a slot of its own, so a lookup is one hash and one comparison.
+template <std::size_t N> struct KeyTable {
+    static constexpr std::uint16_t empty = 0xffff;
+    // with N^2 slots, a random seed has about an even chance of hashing every key to a different slot
+    static constexpr std::size_t slot_count = std::bit_ceil(N * N < 2 ? std::size_t(2) : N * N);
+
+    std::uint64_t seed = 0;
+    std::array<std::uint16_t, slot_count> slots{};
+
+    // Gets the index of the field with this key, or `empty` if there is none.
+    constexpr std::uint16_t find(std::string_view key, const std::array<std::string_view, N>& keys) const {
+        std::uint16_t index = this->slots[schema_hash(key, this->seed) & (slot_count - 1)];
+        return index != empty && keys[index] == key ? index : empty;
+    }
+};
+
+template <std::size_t N> constexpr KeyTable<N> make_key_table(const std::array<std::string_view, N>& keys) {
+    static_assert(N < KeyTable<N>::empty, "Too many fields in one struct");
+    for (std::uint64_t seed = 0; seed < 100000; ++seed) {
+        KeyTable<N> table;
+        table.seed = seed;
+        for (std::uint16_t& slot : table.slots) slot = KeyTable<N>::empty;
+        bool perfect = true;
+        for (std::size_t i = 0; i < N && perfect; ++i) {
+            std::uint16_t& slot = table.slots[schema_hash(keys[i], seed) & (KeyTable<N>::slot_count - 1)];
+            if (slot != KeyTable<N>::empty)
+                // two keys that are the same collide with every seed
+                perfect = false;
+            else
+                slot = (std::uint16_t)i;
+        }
+        if (perfect) return table;
+    }
+    throw "Couldn't find a perfect hash for the fields of a struct (are two of its keys the same?)";
+}
+
+template <typename T> struct Schema {
+    static constexpr auto fields = nbt_fields(static_cast<const T*>(nullptr));
+    static constexpr std::size_t size = std::tuple_size_v<decltype(fields)>;
+    static constexpr std::array<std::string_view, size> keys = std::apply([](const auto&... field) { return std::array<std::string_view, size>{field.key...}; }, fields);
+    static constexpr KeyTable<size> table = make_key_table(keys);
+};
+
+// Appends `count` bytes to `out`, and returns a writer over them.
+ByteWriter grow(std::vector<byte_t>& out, std::size_t count) {
+    std::size_t start = out.size();
+    out.resize(start + count);
+    return ByteWriter(out.data() + start);
+}
+
+void write_schema_string(std::vector<byte_t>& out, std::string_view text) {
+    if (text.size() > 0xffff)
+        throw std::runtime_error("Tried to encode a string of " + std::to_string(text.size()) + " bytes, but NBT strings can be at most 65535 bytes long");
+    grow(out, 2 + text.size()).write_string(text);
+}
+
+[[noreturn]] void schema_type_error(std::string_view key, byte_t expected, byte_t found, std::size_t at) {
+    throw parse_error("Expected " + (key.empty() ? std::string("an element") : "field " + std::string(key)) + " to be of type " + get_tag_type((Tag)expected)
+                      + ", but found " + get_tag_type((Tag)found) + " at offset " + std::to_string(at), at);
+}
+
+// How a type of member is read and written. `tag` is the type of tag it is stored as, or TAG_END if it can be stored as any type.
+template <typename T> struct SchemaType;
+
+template <typename T> void read_schema_value(ByteReader& reader, byte_t type, std::string_view key, T& out, const SchemaContext& context) {
+    if (SchemaType<T>::tag != TAG_END && type != SchemaType<T>::tag)
+        schema_type_error(key, SchemaType<T>::tag, type, reader.position());
+    SchemaType<T>::read(reader, type, out, context);
+}
+
+template <typename T> Tag schema_tag_of(const T& value) {
+    if constexpr (std::is_same_v<T, NBTTag>)
+        return value.type;
+    else
+        return SchemaType<T>::tag;
+}
+
+template <typename T, Tag Type, typename Wire = T> struct ScalarSchemaType {
+    static constexpr Tag tag = Type;
+    static void read(ByteReader& reader, byte_t, T& out, const SchemaContext&) {
+        if constexpr (std::is_same_v<Wire, float>)
+            out = reader.read_float();
+        else if constexpr (std::is_same_v<Wire, double>)
+            out = reader.read_double();
+        else
+            out = (T)reader.read_int<Wire>();
+    }
+    static void write(std::vector<byte_t>& out, const T& value) {
+        if constexpr (std::is_same_v<Wire, float>)
+            grow(out, 4).write_float(value);
+        else if constexpr (std::is_same_v<Wire, double>)
+            grow(out, 8).write_double(value);
+        else
+            grow(out, sizeof(Wire)).write_int((Wire)value);
+    }
+};
+
+template <> struct SchemaType<bool> : ScalarSchemaType<bool, TAG_BYTE, std::int8_t> {
+    static void read(ByteReader& reader, byte_t, bool& out, const SchemaContext&) { out = reader.read_byte() != 0; }
+};
+template <> struct SchemaType<char> : ScalarSchemaType<char, TAG_BYTE, std::int8_t> {};
+template <> struct SchemaType<signed char> : ScalarSchemaType<signed char, TAG_BYTE, std::int8_t> {};
+template <> struct SchemaType<short_t> : ScalarSchemaType<short_t, TAG_SHORT> {};
+template <> struct SchemaType<int_t> : ScalarSchemaType<int_t, TAG_INT> {};
+template <> struct SchemaType<long_t> : ScalarSchemaType<long_t, TAG_LONG> {};
+template <> struct SchemaType<float> : ScalarSchemaType<float, TAG_FLOAT> {};
+template <> struct SchemaType<double> : ScalarSchemaType<double, TAG_DOUBLE> {};
+
+template <typename String> struct StringSchemaType {
+    static constexpr Tag tag = TAG_STRING;
+    static void read(ByteReader& reader, byte_t, String& out, const SchemaContext&) { out.assign(reader.read_string_view()); }
+    static void write(std::vector<byte_t>& out, const String& value) { write_schema_string(out, value); }
+};
+template <> struct SchemaType<std::string> : StringSchemaType<std::string> {};
+template <> struct SchemaType<string_t> : StringSchemaType<string_t> {};
+
+template <typename Element, Tag Type> struct ArraySchemaType {
+    static constexpr Tag tag = Type;
+    static void read(ByteReader& reader, byte_t, std::vector<Element>& out, const SchemaContext&) {
+        std::size_t length = reader.read_length();
+        // check before allocating, so that a corrupt length can't make us allocate gigabytes
+        reader.require(length * sizeof(Element));
+        out.resize(length);
+        reader.read_ints(out.data(), length);
+    }
+    static void write(std::vector<byte_t>& out, const std::vector<Element>& value) {
+        ByteWriter writer = grow(out, 4 + value.size() * sizeof(Element));
+        writer.write_int((int_t)value.size());
+        writer.write_ints(value.data(), value.size());
+    }
+};
+template <> struct SchemaType<std::vector<byte_t>> : ArraySchemaType<byte_t, TAG_BYTEARRAY> {};
+template <> struct SchemaType<std::vector<int_t>> : ArraySchemaType<int_t, TAG_INTARRAY> {};
+template <> struct SchemaType<std::vector<uint_t>> : ArraySchemaType<uint_t, TAG_INTARRAY> {};
+template <> struct SchemaType<std::vector<long_t>> : ArraySchemaType<long_t, TAG_LONGARRAY> {};
+template <> struct SchemaType<std::vector<ulong_t>> : ArraySchemaType<ulong_t, TAG_LONGARRAY> {};
+
+template <typename T> struct SchemaType<std::vector<T>> {
+    static constexpr Tag tag = TAG_ARRAY;
+    static void read(ByteReader& reader, byte_t, std::vector<T>& out, const SchemaContext& context) {
+        byte_t element_type = reader.read_byte();
+        std::size_t length = reader.read_length();
+        if (length > 0 && SchemaType<T>::tag != TAG_END && element_type != SchemaType<T>::tag)
+            schema_type_error({}, SchemaType<T>::tag, element_type, reader.position());
+        // every element takes up at least a byte
+        reader.require(length);
+        out.clear();
+        out.resize(length);
+        for (T& element : out)
+            SchemaType<T>::read(reader, element_type, element, context);
+    }
+    static void write(std::vector<byte_t>& out, const std::vector<T>& value) {
+        Tag element_type = value.empty() ? TAG_END : schema_tag_of(value.front());
+        ByteWriter writer = grow(out, 5);
+        writer.write_byte(element_type);
+        writer.write_int((int_t)value.size());
+        for (const T& element : value) {
+            if (schema_tag_of(element) != element_type)
+                throw std::runtime_error("Tried to encode a list whose elements are of different types");
+            SchemaType<T>::write(out, element);
+        }
+    }
+};
+
+template <typename T> struct SchemaType<std::optional<T>> {
+    // only makes sense as a member: a missing key leaves it empty
+    static constexpr Tag tag = SchemaType<T>::tag;
+    static void read(ByteReader& reader, byte_t type, std::optional<T>& out, const SchemaContext& context) {
+        SchemaType<T>::read(reader, type, out.emplace(), context);
+    }
+    static void write(std::vector<byte_t>& out, const std::optional<T>& value) {
+        SchemaType<T>::write(out, *value);
+    }
+};
+
+template <typename Map> struct MapSchemaType {
+    using Value = typename Map::mapped_type;
+    static constexpr Tag tag = TAG_COMPOUND;
+    static void read(ByteReader& reader, byte_t, Map& out, const SchemaContext& context) {
+        out.clear();
+        byte_t type = reader.read_byte();
+        while (type != TAG_END) {
+            std::string_view key = reader.read_string_view();
+            read_schema_value(reader, type, key, out[std::string(key)], context);
+            type = reader.read_byte();
+        }
+    }
+    static void write(std::vector<byte_t>& out, const Map& value) {
+        for (const auto& [key, element] : value) {
+            grow(out, 1).write_byte(schema_tag_of(element));
+            write_schema_string(out, key);
+            SchemaType<Value>::write(out, element);
+        }
+        grow(out, 1).write_byte(TAG_END);
+    }
+};
+template <typename T> struct SchemaType<std::map<std::string, T>> : MapSchemaType<std::map<std::string, T>> {};
+template <typename T> struct SchemaType<std::unordered_map<std::string, T>> : MapSchemaType<std::unordered_map<std::string, T>> {};
+
+template <> struct SchemaType<NBTTag> {
+    static constexpr Tag tag = TAG_END;
+    static void read(ByteReader& reader, byte_t type, NBTTag& out, const SchemaContext& context) {
+        out = NBTTag::from_nbt(reader, true, {type}, context.alloc, context.symbols);
+    }
+    static void write(std::vector<byte_t>& out, const NBTTag& value) {
+        ByteWriter writer = grow(out, value.encoded_size(true));
+        value.to_nbt(writer, true);
+    }
+};
+
+template <Described T> struct SchemaType<T> {
+    static constexpr Tag tag = TAG_COMPOUND;
+
+    // one decoder per field, so that a key is dispatched with a single indirect call
+    using FieldReader = void (*)(ByteReader& reader, byte_t type, T& out, const SchemaContext& context);
+    template <std::size_t I> static void read_field(ByteReader& reader, byte_t type, T& out, const SchemaContext& context) {
+        constexpr auto field = std::get<I>(Schema<T>::fields);
+        read_schema_value(reader, type, field.key, out.*(field.member), context);
+    }
+    template <std::size_t... I> static constexpr std::array<FieldReader, sizeof...(I)> make_readers(std::index_sequence<I...>) {
+        return {read_field<I>...};
+    }
+    static constexpr std::array<FieldReader, Schema<T>::size> readers = make_readers(std::make_index_sequence<Schema<T>::size>());
+
+    static void read(ByteReader& reader, byte_t, T& out, const SchemaContext& context) {
+        byte_t type = reader.read_byte();
+        while (type != TAG_END) {
+            std::string_view key = reader.read_string_view();
+            std::uint16_t index = Schema<T>::table.find(key, Schema<T>::keys);
+            if (index == KeyTable<Schema<T>::size>::empty)
+                skip_payload(reader, type);
+            else
+                readers[index](reader, type, out, context);
+            type = reader.read_byte();
+        }
+    }
+
+    static void write(std::vector<byte_t>& out, const T& value) {
+        std::apply([&](const auto&... field) { (write_field(out, field.key, value.*(field.member)), ...); }, Schema<T>::fields);
+        grow(out, 1).write_byte(TAG_END);
+    }
+    template <typename M> static void write_field(std::vector<byte_t>& out, std::string_view key, const M& member) {
+        if constexpr (requires { member.has_value(); }) {
+            if (!member.has_value()) return;
+        }
+        grow(out, 1).write_byte(schema_tag_of(member));
+        write_schema_string(out, key);
+        SchemaType<M>::write(out, member);
+    }
+};
+
+}
+
+/// @brief Decodes NBT data straight into a struct described with `NBT_FIELDS`, without building a tree.
+/// @param bytes The data to decode. It must start with a complete, named compound tag (whose name is ignored), and may continue past it.
+/// @param out The struct to decode into. Fields whose keys are missing from the data keep the values they had, and keys that the struct has no field for are skipped.
+/// @param consumed If not null, receives the number of bytes that made up the tag.
+/// @param alloc The allocator to allocate the strings and arrays of any `NBTTag` fields with.
+/// @param symbols If not null, the table to intern the tag names of any `NBTTag` fields in.
+/// @exception Throws `nbt::truncated_error` or `nbt::parse_error` if the data is malformed, or if a field's tag is not of the type its member is stored as.
+template <internal::Described T> void decode_nbt(std::span<const byte_t> bytes, T& out, std::size_t* consumed = nullptr, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr) {
+    internal::ByteReader reader(bytes);
+    byte_t type = reader.read_byte();
+    reader.read_string_view();
+    internal::read_schema_value(reader, type, {}, out, internal::SchemaContext{alloc, symbols});
+    if (consumed)
+        *consumed = reader.position();
+}
+/// @brief Decodes NBT data straight into a default-constructed struct. See `decode_nbt(std::span<const byte_t>, T&, std::size_t*, const NBTTag::allocator_type&, SymbolTable*)`.
+template <internal::Described T> T decode_nbt(std::span<const byte_t> bytes, std::size_t* consumed = nullptr, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr) {
+    T ret{};
+    decode_nbt(bytes, ret, consumed, alloc, symbols);
+    return ret;
+}
+
+/// @brief Encodes a struct described with `NBT_FIELDS` as a named compound tag, without building a tree.
+/// Fields are written in the order they were described in, and empty `std::optional` fields are left out.
+/// @param value The struct to encode.
+/// @param out The buffer to append the encoded tag to.
+/// @param name The name of the root tag.
+/// @exception Throws if a string is too long to encode, or if a list holds tags of different types.
+template <internal::Described T> void encode_nbt(const T& value, std::vector<byte_t>& out, std::string_view name = "") {
+    internal::grow(out, 1).write_byte(TAG_COMPOUND);
+    internal::write_schema_string(out, name);
+    internal::SchemaType<T>::write(out, value);
+}
+/// @brief Encodes a struct as a named compound tag. See `encode_nbt(const T&, std::vector<byte_t>&, std::string_view)`.
+/// @return The encoded tag.
+template <internal::Described T> std::vector<byte_t> encode_nbt(const T& value, std::string_view name = "") {
+    std::vector<byte_t> ret;
+    encode_nbt(value, ret, name);
+    return ret;
+}
+
+}
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef SHARED_HPP
+#define SHARED_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "core.hpp"
+
+namespace nbt {
+
+/// @brief A tree of tags whose subtrees are shared between copies, and copied only when they are changed (copy-on-write).
+/// Copying a `SharedTag` copies a reference rather than a tree, so it is a cheap way to snapshot a tree or to hand one to several stages at once.
+/// Changing a tag through a non-const member first makes a private copy of it if it is shared, and as each level of the path to it is reached
+/// through non-const members too, an edit copies only the tags between the root and the one changed. Everything beside that path stays shared.
+/// The children of a copied compound or list are not copied themselves: only the references to them are.
+/// @note Reading trees that share tags from several threads at once is safe without locking, as is changing them through separate `SharedTag`s
+/// (e.g. one snapshot per thread). As with any other type, a single `SharedTag` must not be changed by one thread while others use it.
+/// @note A reference or pointer obtained through a const member may be left pointing at the old version of a tag once a non-const member copies it,
+/// so don't hold one across a change.
+/// @note Likewise, don't hold a reference obtained through a non-const member across a copy of any tag above it. Copying the tree only shares its root,
+/// so the referenced tag is still not shared itself, and changing it through the reference would change the copy as well:
+/// `SharedTag& x = s["k"][0]["x"]; SharedTag snap = s; x.edit() = ...;` changes `snap` too. Go through the root again instead (`s["k"][0]["x"].edit() = ...;`),
+/// which copies every shared tag on the way down before anything is changed.
+class SharedTag {
+public:
+    /// @brief Creates an empty tag (of type `TAG_END`).
+    SharedTag();
+    /// @brief Copies a tree into shared form.
+    /// @param tag The root of the tree.
+    explicit SharedTag(const NBTTag& tag);
+    /// @brief Moves a tree into shared form, reusing the memory of its strings and arrays.
+    /// @param tag The root of the tree.
+    explicit SharedTag(NBTTag&& tag);
+    SharedTag(const SharedTag& other) : node(other.node) { retain(this->node); }
+    SharedTag(SharedTag&& other) noexcept : node(std::exchange(other.node, nullptr)) {}
+    SharedTag& operator=(SharedTag other) noexcept {
+        std::swap(this->node, other.node);
+        return *this;
+    }
+    ~SharedTag() { release(this->node); }
+
+    /// @brief Gets the type of the tag.
+    Tag type() const { return this->node->leaf.type; }
+    /// @brief Gets the name of the tag.
+    const Name& name() const { return this->node->leaf.name; }
+    /// @brief Renames the tag (copying it first if it is shared).
+    void rename(Name name) { this->unshare().leaf.name = std::move(name); }
+
+    /// @brief Copies the tree out into an `NBTTag`.
+    /// @param alloc The allocator to allocate the tree's strings and arrays with.
+    /// @return The tree.
+    NBTTag to_tag(const NBTTag::allocator_type& alloc = {}) const;
+    /// @brief Pretty-print this tag. See `NBTTag::to_string(int)`.
+    std::string to_string(int tab_level = 0) const { return this->to_tag().to_string(tab_level); }
+
+    /// @brief Gets the number of children of a compound, or of elements of a list or array.
+    /// @exception Throws if `this.type()` is not one of `TAG_COMPOUND`, `TAG_ARRAY`, `TAG_BYTEARRAY`, `TAG_INTARRAY` or `TAG_LONGARRAY`.
+    std::size_t size() const;
+    /// @brief Returns whether this compound tag contains the given key. Will throw if `this` is not a compound tag.
+    bool contains(std::string_view name) const { return this->find(name) != nullptr; }
+    /// @brief Compound tag element access, without throwing if the element is missing.
+    /// @return The first child with name `name`, or null. Will throw if `this` is not a compound tag.
+    /// @note Children are searched in order, so this takes time linear in the number of children.
+    const SharedTag* find(std::string_view name) const;
+    /// @brief Compound tag element access. Will throw if `this` is not a compound tag, or if no such element exists.
+    const SharedTag& at(std::string_view name) const;
+    /// @brief Array tag element access. Will throw if `this` is not an array tag, or if no such element exists.
+    const SharedTag& operator[](std::size_t index) const;
+    /// @brief Gets the children of a compound or the elements of a list, in order. Will throw if `this` is not a compound or list tag.
+    std::span<const SharedTag> children() const;
+
+    /// @brief Compound tag element access for changing the element (copying this tag first if it is shared). Will throw if `this` is not a compound tag.
+    /// @param name The name of the element to access.
+    /// @return The element with name `name`. Will create it (with value 0b) if no such element exists, as `NBTTag::operator[]` does.
+    SharedTag& operator[](std::string_view name);
+    /// @brief Compound tag element access for changing the element (copying this tag first if it is shared). Will throw if `this` is not a compound tag, or if no such element exists.
+    SharedTag& at(std::string_view name);
+    /// @brief Array tag element access for changing the element (copying this tag first if it is shared). Will throw if `this` is not an array tag, or if no such element exists.
+    SharedTag& operator[](std::size_t index);
+    /// @brief Adds a child to the end of a compound or list (copying this tag first if it is shared). Will throw if `this` is not a compound or list tag.
+    /// @param child The child to add. For a list, it must be of the same type as the list's other elements.
+    /// @return A reference to the added child.
+    SharedTag& push_back(SharedTag child);
+    /// @brief Removes a child of a compound by name (copying this tag first if it is shared). Will throw if `this` is not a compound tag.
+    /// @return Whether there was a child to remove.
+    bool erase(std::string_view name);
+
+    /// @brief Gets the value of this tag. See `NBTTag::get()`. Will throw if `this` is a compound or list tag.
+    template <NbtType T> T get() const { return this->leaf().template get<T>(); }
+    /// @brief Gets the elements of a byte, int or long array tag. See `NBTTag::span()`.
+    template <internal::NbtArrayElement T> std::span<const T> span() const { return this->leaf().template span<T>(); }
+    /// @brief Gets the tag itself, for tags that have no children (scalars, strings and arrays). Will throw for compounds and lists.
+    const NBTTag& leaf() const;
+    /// @brief Gets the tag itself for changing it (copying it first if it is shared), for tags that have no children. Will throw for compounds and lists.
+    /// Changing its type to `TAG_COMPOUND` or `TAG_ARRAY` is not allowed: assign a new `SharedTag` instead.
+    NBTTag& edit();
+
+    /// @brief Returns whether this tag and another are the same shared tag (and not just equal).
+    bool shares_with(const SharedTag& other) const { return this->node == other.node; }
+    /// @brief Gets the number of `SharedTag`s that share this tag, including this one. Only approximate while other threads are copying it.
+    long use_count() const { return this->node->refs.load(std::memory_order_relaxed); }
+
+private:
+    struct Node {
+        // holds the type and name of every tag, and the value of those without children
+        NBTTag leaf;
+        // the children of compounds and lists
+        std::vector<SharedTag> children;
+        // the number of SharedTags that point at this node
+        std::atomic<long> refs{1};
+
+        Node() = default;
+        // copies start out with a count of their own
+        Node(const Node& other) : leaf(other.leaf), children(other.children) {}
+    };
+
+    // Counted by hand rather than with `std::shared_ptr`, so that `unshare()` can check for a count of 1 with acquire ordering:
+    // the releases in `release()` then make every other owner's reads of the node happen before this one changes it.
+    static void retain(Node* node) {
+        if (node) node->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    static void release(Node* node) {
+        if (node && node->refs.fetch_sub(1, std::memory_order_release) == 1) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            delete node;
+        }
+    }
+
+    static Node* make_node(const NBTTag& tag);
+    static Node* make_node(NBTTag&& tag);
+    // Gives this tag a node of its own, if it shares one. Only the node is copied, not its children.
+    Node& unshare();
+    bool has_children() const { return this->type() == TAG_COMPOUND || this->type() == TAG_ARRAY; }
+
+    Node* node;
+};
+
+SharedTag::SharedTag() : node(new Node()) {
+    this->node->leaf.type = TAG_END;
+}
+SharedTag::SharedTag(const NBTTag& tag) : node(make_node(tag)) {}
+SharedTag::SharedTag(NBTTag&& tag) : node(make_node(std::move(tag))) {}
+
+SharedTag::Node* SharedTag::make_node(const NBTTag& tag) {
+    auto ret = std::make_unique<Node>();
+    switch (tag.type) {
+        case TAG_COMPOUND:
+        case TAG_ARRAY: {
+            ret->leaf.type = tag.type;
+            ret->leaf.name = tag.name;
+            const array_t<NBTTag>& children = tag.type == TAG_COMPOUND ? std::get<Compound>(tag.value).as_vector() : std::get<array_t<NBTTag>>(tag.value);
+            ret->children.reserve(children.size());
+            for (const NBTTag& child : children)
+                ret->children.push_back(SharedTag(child));
+            break;
+        }
+        default:
+            ret->leaf = tag;
+    }
+    return ret.release();
+}
+SharedTag::Node* SharedTag::make_node(NBTTag&& tag) {
+    auto ret = std::make_unique<Node>();
+    switch (tag.type) {
+        case TAG_COMPOUND:
+        case TAG_ARRAY: {
+            ret->leaf.type = tag.type;
+            ret->leaf.name = std::move(tag.name);
+            auto move_children = [&](auto& children) {
+                ret->children.reserve(children.size());
+                for (NBTTag& child : children)
+                    ret->children.push_back(SharedTag(std::move(child)));
+            };
+            if (tag.type == TAG_COMPOUND) move_children(std::get<Compound>(tag.value));
+            else move_children(std::get<array_t<NBTTag>>(tag.value));
+            break;
+        }
+        default:
+            ret->leaf = std::move(tag);
+    }
+    return ret.release();
+}
+
+SharedTag::Node& SharedTag::unshare() {
+    // a count of 1 means no other SharedTag can reach the node, so no other thread can be reading it
+    if (this->node->refs.load(std::memory_order_acquire) != 1) {
+        Node* copy = new Node(*this->node);
+        release(this->node);
+        this->node = copy;
+    }
+    return *this->node;
+}
+
+NBTTag SharedTag::to_tag(const NBTTag::allocator_type& alloc) const {
+    switch (this->type()) {
+        case TAG_COMPOUND: {
+            Compound children(alloc);
+            for (const SharedTag& child : this->node->children)
+                children.push_back(child.to_tag(alloc));
+            return NBTTag(TAG_COMPOUND, this->name(), std::move(children), alloc);
+        }
+        case TAG_ARRAY: {
+            array_t<NBTTag> elements(alloc);
+            elements.reserve(this->node->children.size());
+            for (const SharedTag& element : this->node->children)
+                elements.push_back(element.to_tag(alloc));
+            return NBTTag(TAG_ARRAY, this->name(), std::move(elements), alloc);
+        }
+        default:
+            return NBTTag(this->node->leaf, alloc);
+    }
+}
+
+std::size_t SharedTag::size() const {
+    if (this->has_children())
+        return this->node->children.size();
+    return this->node->leaf.size();
+}
+
+const SharedTag* SharedTag::find(std::string_view name) const {
+    if (this->type() != TAG_COMPOUND)
+        throw std::runtime_error("Tried to get value by name " + std::string(name) + " from tag " + this->name() + ", but that tag is not a compound");
+    for (const SharedTag& child : this->node->children)
+        if (child.name() == name) return &child;
+    return nullptr;
+}
+
+const SharedTag& SharedTag::at(std::string_view name) const {
+    const SharedTag* child = this->find(name);
+    if (!child)
+        throw std::runtime_error("Tried to get value by name " + std::string(name) + " from tag " + this->name() + ", but that value does not exist in the compound");
+    return *child;
+}
+
+const SharedTag& SharedTag::operator[](std::size_t index) const {
+    if (this->type() != TAG_ARRAY)
+        throw std::runtime_error("Tried to get value by index " + std::to_string(index) + " from tag " + this->name() + ", but that tag is not an array");
+    if (this->node->children.size() <= index)
+        throw std::runtime_error("Tried to get value by index " + std::to_string(index) + " from tag " + this->name() + " which does not exist");
+    return this->node->children[index];
+}
+
+std::span<const SharedTag> SharedTag::children() const {
+    if (!this->has_children())
+        throw std::runtime_error("Tried to get the children of tag " + this->name() + ", but that tag is not a compound or an array");
+    return this->node->children;
+}
+
+SharedTag& SharedTag::operator[](std::string_view name) {
+    // found first, so that looking up a child that exists doesn't copy anything unless it is then changed
+    if (const SharedTag* child = std::as_const(*this).find(name)) {
+        std::size_t index = (std::size_t)(child - this->node->children.data());
+        return this->unshare().children[index];
+    }
+    return this->unshare().children.emplace_back(NBTTag(TAG_BYTE, name, (char)0));
+}
+
+SharedTag& SharedTag::at(std::string_view name) {
+    std::size_t index = (std::size_t)(&std::as_const(*this).at(name) - this->node->children.data());
+    return this->unshare().children[index];
+}
+
+SharedTag& SharedTag::operator[](std::size_t index) {
+    std::as_const(*this)[index];
+    return this->unshare().children[index];
+}
+
+SharedTag& SharedTag::push_back(SharedTag child) {
+    if (!this->has_children())
+        throw std::runtime_error("Tried to add a child to tag " + this->name() + ", but that tag is not a compound or an array");
+    if (this->type() == TAG_ARRAY && !this->node->children.empty() && this->node->children[0].type() != child.type())
+        throw std::runtime_error("Tried to add a " + get_tag_type(child.type()) + " tag to array tag " + this->name() + ", which holds " + get_tag_type(this->node->children[0].type()) + " tags");
+    return this->unshare().children.emplace_back(std::move(child));
+}
+
+bool SharedTag::erase(std::string_view name) {
+    const SharedTag* child = this->find(name);
+    if (!child) return false;
+    std::size_t index = (std::size_t)(child - this->node->children.data());
+    std::vector<SharedTag>& children = this->unshare().children;
+    children.erase(children.begin() + (std::ptrdiff_t)index);
+    return true;
+}
+
+const NBTTag& SharedTag::leaf() const {
+    if (this->has_children())
+        throw std::runtime_error("Tried to get the value of tag " + this->name() + ", but it is a compound or an array (use its children instead)");
+    return this->node->leaf;
+}
+
+NBTTag& SharedTag::edit() {
+    this->leaf();
+    return this->unshare().leaf;
+}
+
+}
+
+#endif
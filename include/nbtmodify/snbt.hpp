@@ -0,0 +1,505 @@
+#ifndef SNBT_HPP
+#define SNBT_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "core.hpp"
+
+// SNBT ("stringified NBT"), the text form of NBT that Minecraft uses in commands and `/data get`, such as `{Name:"minecraft:stone",Count:1b}`.
+// The writer streams straight into its output, and the parser builds the tree in a single pass over the text.
+
+namespace nbt {
+
+/// @brief How SNBT is laid out.
+enum SNBTStyle {
+    /// @brief Everything on one line, with no spaces: `{a:1,b:[I;1,2]}`.
+    SNBT_COMPACT,
+    /// @brief One compound entry or list element per line, indented by four spaces per level. Byte, int and long arrays stay on one line.
+    SNBT_PRETTY,
+};
+
+namespace internal {
+
+// Characters that may appear in unquoted keys and values.
+bool is_unquoted_char(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '-' || c == '.' || c == '+';
+}
+
+template <typename Out> class SNBTWriter {
+public:
+    SNBTWriter(Out out, SNBTStyle style) : out(out), pretty(style == SNBT_PRETTY) {}
+
+    void write(const NBTTag& tag, int depth);
+
+    Out out;
+
+private:
+    void put(char c) { *this->out++ = c; }
+    void put(std::string_view text) { this->out = std::copy(text.begin(), text.end(), this->out); }
+    // between elements: a comma, and then either nothing or a new line
+    void separator(int depth);
+    void newline(int depth);
+    void key(std::string_view name);
+    void string(std::string_view text);
+    template <typename T> void number(T value, std::string_view suffix);
+    template <typename T> void elements(std::string_view prefix, const array_t<T>& values, std::string_view suffix);
+
+    bool pretty;
+};
+
+template <typename Out> void SNBTWriter<Out>::newline(int depth) {
+    if (!this->pretty) return;
+    this->put('\n');
+    for (int i = 0; i < depth; ++i)
+        this->put("    ");
+}
+
+template <typename Out> void SNBTWriter<Out>::separator(int depth) {
+    this->put(',');
+    this->newline(depth);
+}
+
+template <typename Out> void SNBTWriter<Out>::key(std::string_view name) {
+    if (!name.empty() && std::all_of(name.begin(), name.end(), is_unquoted_char))
+        this->put(name);
+    else
+        this->string(name);
+    this->put(':');
+    if (this->pretty) this->put(' ');
+}
+
+template <typename Out> void SNBTWriter<Out>::string(std::string_view text) {
+    this->put('"');
+    for (char c : text) {
+        switch (c) {
+            case '"': this->put("\\\""); break;
+            case '\\': this->put("\\\\"); break;
+            case '\n': this->put("\\n"); break;
+            case '\r': this->put("\\r"); break;
+            case '\t': this->put("\\t"); break;
+            default: this->put(c);
+        }
+    }
+    this->put('"');
+}
+
+template <typename Out> template <typename T> void SNBTWriter<Out>::number(T value, std::string_view suffix) {
+    if constexpr (std::is_floating_point_v<T>) {
+        // written the way Java prints them; Minecraft itself reads these back as strings, but parse_snbt() accepts them
+        if (std::isnan(value)) {
+            this->put("NaN");
+            this->put(suffix);
+            return;
+        }
+        if (std::isinf(value)) {
+            this->put(value < 0 ? "-Infinity" : "Infinity");
+            this->put(suffix);
+            return;
+        }
+    }
+    // long enough for any integer, and for the shortest round-tripping form of any double
+    char buffer[32];
+    std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    this->put(std::string_view(buffer, result.ptr - buffer));
+    this->put(suffix);
+}
+
+template <typename Out> template <typename T> void SNBTWriter<Out>::elements(std::string_view prefix, const array_t<T>& values, std::string_view suffix) {
+    this->put(prefix);
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        if (i > 0) this->put(this->pretty ? ", " : ",");
+        else if (this->pretty) this->put(' ');
+        if constexpr (std::is_same_v<T, byte_t>)
+            this->number((int)(signed char)values[i], suffix);
+        else
+            this->number(values[i], suffix);
+    }
+    this->put(']');
+}
+
+template <typename Out> void SNBTWriter<Out>::write(const NBTTag& tag, int depth) {
+    switch (tag.type) {
+        case TAG_BYTE: this->number((int)(signed char)std::get<char>(tag.value), "b"); break;
+        case TAG_SHORT: this->number(std::get<short_t>(tag.value), "s"); break;
+        case TAG_INT: this->number(std::get<int_t>(tag.value), ""); break;
+        case TAG_LONG: this->number(std::get<long_t>(tag.value), "L"); break;
+        case TAG_FLOAT: this->number(std::get<float>(tag.value), "f"); break;
+        case TAG_DOUBLE: this->number(std::get<double>(tag.value), "d"); break;
+        case TAG_STRING: this->string(std::get<string_t>(tag.value)); break;
+        case TAG_BYTEARRAY: this->elements("[B;", std::get<array_t<byte_t>>(tag.value), "b"); break;
+        case TAG_INTARRAY: this->elements("[I;", std::get<array_t<int_t>>(tag.value), ""); break;
+        case TAG_LONGARRAY: this->elements("[L;", std::get<array_t<long_t>>(tag.value), "L"); break;
+        case TAG_ARRAY: {
+            const array_t<NBTTag>& elements = std::get<array_t<NBTTag>>(tag.value);
+            this->put('[');
+            if (!elements.empty()) {
+                this->newline(depth + 1);
+                for (std::size_t i = 0; i < elements.size(); ++i) {
+                    if (i > 0) this->separator(depth + 1);
+                    this->write(elements[i], depth + 1);
+                }
+                this->newline(depth);
+            }
+            this->put(']');
+            break;
+        }
+        case TAG_COMPOUND: {
+            const Compound& children = std::get<Compound>(tag.value);
+            this->put('{');
+            if (!children.empty()) {
+                this->newline(depth + 1);
+                bool first = true;
+                for (const NBTTag& child : children) {
+                    if (!first) this->separator(depth + 1);
+                    first = false;
+                    this->key(child.name.str());
+                    this->write(child, depth + 1);
+                }
+                this->newline(depth);
+            }
+            this->put('}');
+            break;
+        }
+        default:
+            throw std::runtime_error("Tried to write tag " + tag.name + " of illegal type " + std::to_string(tag.type) + " as SNBT");
+    }
+}
+
+// A recursive-descent parser over the whole text. Values are built as they are read, so the text is only looked at once.
+class SNBTParser {
+public:
+    SNBTParser(std::string_view text, const NBTTag::allocator_type& alloc, SymbolTable* symbols) : text(text), alloc(alloc), symbols(symbols) {}
+
+    NBTTag parse();
+
+private:
+    // as in Minecraft, so that deeply nested input can't overflow the stack
+    static constexpr std::size_t max_depth = max_nbt_depth;
+
+    NBTTag value(std::size_t depth);
+    NBTTag compound(std::size_t depth);
+    // a list, or a byte, int or long array
+    NBTTag list(std::size_t depth);
+    template <typename T> NBTTag array(Tag type, Tag element_type);
+    // an unquoted value: a number, a boolean, or else a string
+    NBTTag unquoted();
+    std::string quoted();
+    std::string key();
+    std::string_view token();
+
+    void skip_whitespace();
+    bool eat(char c);
+    void expect(char c, const char* where);
+    [[noreturn]] void fail(const std::string& what, std::size_t at) const;
+    NBTTag make(Tag type, NBTTag::DataType value) const { return NBTTag(type, Name(), std::move(value), this->alloc); }
+
+    std::string_view text;
+    std::size_t pos = 0;
+    NBTTag::allocator_type alloc;
+    SymbolTable* symbols;
+};
+
+void SNBTParser::fail(const std::string& what, std::size_t at) const {
+    throw parse_error(what + " at offset " + std::to_string(at) + " of SNBT", at);
+}
+
+void SNBTParser::skip_whitespace() {
+    while (this->pos < this->text.size() && (this->text[this->pos] == ' ' || this->text[this->pos] == '\t' || this->text[this->pos] == '\n' || this->text[this->pos] == '\r'))
+        ++this->pos;
+}
+
+bool SNBTParser::eat(char c) {
+    this->skip_whitespace();
+    if (this->pos < this->text.size() && this->text[this->pos] == c) {
+        ++this->pos;
+        return true;
+    }
+    return false;
+}
+
+void SNBTParser::expect(char c, const char* where) {
+    if (!this->eat(c))
+        this->fail(std::string("Expected '") + c + "' " + where, this->pos);
+}
+
+std::string_view SNBTParser::token() {
+    this->skip_whitespace();
+    std::size_t start = this->pos;
+    while (this->pos < this->text.size() && is_unquoted_char(this->text[this->pos]))
+        ++this->pos;
+    return this->text.substr(start, this->pos - start);
+}
+
+std::string SNBTParser::quoted() {
+    std::size_t start = this->pos;
+    char quote = this->text[this->pos++];
+    std::string ret;
+    while (true) {
+        if (this->pos >= this->text.size())
+            this->fail("Unterminated string", start);
+        char c = this->text[this->pos++];
+        if (c == quote) return ret;
+        if (c != '\\') {
+            ret += c;
+            continue;
+        }
+        if (this->pos >= this->text.size())
+            this->fail("Unterminated string", start);
+        char escaped = this->text[this->pos++];
+        switch (escaped) {
+            case '\\': case '"': case '\'': ret += escaped; break;
+            case 'n': ret += '\n'; break;
+            case 'r': ret += '\r'; break;
+            case 't': ret += '\t'; break;
+            case 'b': ret += '\b'; break;
+            case 'f': ret += '\f'; break;
+            default: this->fail(std::string("Invalid escape sequence '\\") + escaped + "'", this->pos - 2);
+        }
+    }
+}
+
+std::string SNBTParser::key() {
+    this->skip_whitespace();
+    if (this->pos < this->text.size() && (this->text[this->pos] == '"' || this->text[this->pos] == '\''))
+        return this->quoted();
+    std::size_t start = this->pos;
+    std::string_view ret = this->token();
+    if (ret.empty())
+        this->fail("Expected a key", start);
+    return std::string(ret);
+}
+
+NBTTag SNBTParser::parse() {
+    NBTTag ret = this->value(0);
+    this->skip_whitespace();
+    if (this->pos != this->text.size())
+        this->fail("Unexpected text after the end of the value", this->pos);
+    return ret;
+}
+
+NBTTag SNBTParser::value(std::size_t depth) {
+    if (depth > max_depth)
+        this->fail("Tags are nested more than " + std::to_string(max_depth) + " deep", this->pos);
+    this->skip_whitespace();
+    if (this->pos >= this->text.size())
+        this->fail("Expected a value", this->pos);
+    switch (this->text[this->pos]) {
+        case '{': return this->compound(depth);
+        case '[': return this->list(depth);
+        case '"':
+        case '\'':
+            return this->make(TAG_STRING, string_t(this->quoted(), this->alloc));
+        default:
+            return this->unquoted();
+    }
+}
+
+NBTTag SNBTParser::compound(std::size_t depth) {
+    ++this->pos;
+    Compound children(this->alloc);
+    if (!this->eat('}')) {
+        do {
+            std::string name = this->key();
+            this->expect(':', "after a key in a compound");
+            NBTTag child = this->value(depth + 1);
+            child.name = this->symbols ? this->symbols->intern(name) : Name(name);
+            // as in Minecraft, a repeated key replaces the earlier value
+            if (NBTTag* existing = children.find(std::string_view(name)))
+                *existing = std::move(child);
+            else
+                children.push_back(std::move(child));
+        } while (this->eat(','));
+        this->expect('}', "at the end of a compound");
+    }
+    return this->make(TAG_COMPOUND, std::move(children));
+}
+
+NBTTag SNBTParser::list(std::size_t depth) {
+    std::size_t start = this->pos++;
+    if (this->pos + 1 < this->text.size() && this->text[this->pos + 1] == ';') {
+        char prefix = this->text[this->pos];
+        this->pos += 2;
+        switch (prefix) {
+            case 'B': return this->array<byte_t>(TAG_BYTEARRAY, TAG_BYTE);
+            case 'I': return this->array<int_t>(TAG_INTARRAY, TAG_INT);
+            case 'L': return this->array<long_t>(TAG_LONGARRAY, TAG_LONG);
+            default: this->fail(std::string("Invalid array type '") + prefix + "'", start + 1);
+        }
+    }
+    array_t<NBTTag> elements(this->alloc);
+    if (!this->eat(']')) {
+        do {
+            this->skip_whitespace();
+            std::size_t at = this->pos;
+            elements.push_back(this->value(depth + 1));
+            if (elements.back().type != elements.front().type)
+                this->fail("Found an element of type " + get_tag_type(elements.back().type) + " in a list of " + get_tag_type(elements.front().type), at);
+        } while (this->eat(','));
+        this->expect(']', "at the end of a list");
+    }
+    return this->make(TAG_ARRAY, std::move(elements));
+}
+
+template <typename T> NBTTag SNBTParser::array(Tag type, Tag element_type) {
+    array_t<T> elements(this->alloc);
+    if (!this->eat(']')) {
+        do {
+            this->skip_whitespace();
+            std::size_t at = this->pos;
+            NBTTag element = this->unquoted();
+            if (element.type != element_type)
+                this->fail("Found an element of type " + get_tag_type(element.type) + " in a " + get_tag_type(type), at);
+            if constexpr (std::is_same_v<T, byte_t>)
+                elements.push_back((byte_t)std::get<char>(element.value));
+            else
+                elements.push_back(std::get<T>(element.value));
+        } while (this->eat(','));
+        this->expect(']', "at the end of an array");
+    }
+    return this->make(type, std::move(elements));
+}
+
+// [-+]?(0|[1-9][0-9]*)
+bool is_integer_literal(std::string_view text) {
+    if (!text.empty() && (text[0] == '-' || text[0] == '+')) text.remove_prefix(1);
+    if (text.empty() || (text[0] == '0' && text.size() > 1)) return false;
+    return std::all_of(text.begin(), text.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+// [-+]?(digits.digits?|.digits|digits)(e[-+]?digits)?, where the last form (with no '.') is only allowed if `needs_dot` is false
+bool is_decimal_literal(std::string_view text, bool needs_dot) {
+    std::size_t i = 0;
+    auto digits = [&] {
+        std::size_t start = i;
+        while (i < text.size() && text[i] >= '0' && text[i] <= '9') ++i;
+        return i - start;
+    };
+    if (i < text.size() && (text[i] == '-' || text[i] == '+')) ++i;
+    std::size_t mantissa = digits();
+    bool dot = i < text.size() && text[i] == '.';
+    if (dot) {
+        ++i;
+        mantissa += digits();
+    }
+    if (mantissa == 0 || (needs_dot && !dot)) return false;
+    if (i < text.size() && (text[i] == 'e' || text[i] == 'E')) {
+        ++i;
+        if (i < text.size() && (text[i] == '-' || text[i] == '+')) ++i;
+        if (digits() == 0) return false;
+    }
+    return i == text.size();
+}
+
+// NaN, Infinity or -Infinity, which is how the writer writes values that SNBT has no literal for
+std::optional<double> non_finite_literal(std::string_view text) {
+    if (text == "NaN") return std::numeric_limits<double>::quiet_NaN();
+    if (text == "Infinity" || text == "+Infinity") return std::numeric_limits<double>::infinity();
+    if (text == "-Infinity") return -std::numeric_limits<double>::infinity();
+    return std::nullopt;
+}
+
+template <typename T> bool parse_number(std::string_view text, T& out) {
+    // from_chars doesn't take a leading '+'
+    if (!text.empty() && text[0] == '+') text.remove_prefix(1);
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), out);
+    return error == std::errc() && end == text.data() + text.size();
+}
+
+NBTTag SNBTParser::unquoted() {
+    std::size_t start = this->pos;
+    std::string_view text = this->token();
+    if (text.empty())
+        this->fail(this->pos < this->text.size() ? std::string("Unexpected '") + this->text[this->pos] + "'" : std::string("Expected a value"), start);
+    if (text == "true" || text == "false")
+        return this->make(TAG_BYTE, (char)(text == "true"));
+
+    char suffix = (char)std::tolower((unsigned char)text.back());
+    std::string_view body = text.substr(0, text.size() - 1);
+    if ((suffix == 'b' || suffix == 's' || suffix == 'l') && is_integer_literal(body)) {
+        long_t value;
+        if (suffix == 'l' && parse_number(body, value))
+            return this->make(TAG_LONG, value);
+        if (suffix == 's' && parse_number(body, value) && value >= std::numeric_limits<short_t>::min() && value <= std::numeric_limits<short_t>::max())
+            return this->make(TAG_SHORT, (short_t)value);
+        if (suffix == 'b' && parse_number(body, value) && value >= -128 && value <= 127)
+            return this->make(TAG_BYTE, (char)value);
+    }
+    if (suffix == 'f' || suffix == 'd') {
+        if (is_decimal_literal(body, false)) {
+            // floats are parsed as floats, so that they are only rounded once
+            float float_value;
+            double double_value;
+            if (suffix == 'f' && parse_number(body, float_value))
+                return this->make(TAG_FLOAT, float_value);
+            if (suffix == 'd' && parse_number(body, double_value))
+                return this->make(TAG_DOUBLE, double_value);
+        } else if (std::optional<double> value = non_finite_literal(body)) {
+            if (suffix == 'f')
+                return this->make(TAG_FLOAT, (float)*value);
+            return this->make(TAG_DOUBLE, *value);
+        }
+    }
+    if (is_integer_literal(text)) {
+        int_t value;
+        if (parse_number(text, value))
+            return this->make(TAG_INT, value);
+    }
+    if (is_decimal_literal(text, true)) {
+        double value;
+        if (parse_number(text, value))
+            return this->make(TAG_DOUBLE, value);
+    }
+    // anything else (including numbers that are out of range for their type) is a string, as in Minecraft
+    return this->make(TAG_STRING, string_t(text, this->alloc));
+}
+
+}
+
+/// @brief Writes a tag as SNBT.
+/// @param out The output iterator to write the characters to.
+/// @param tag The tag to write. Its own name is not written (SNBT has no place for it), but its children's are.
+/// @param style The layout to use. See `SNBTStyle`.
+/// @return The iterator after the last character written.
+/// @note Numbers are written in their shortest form that reads back to the same value. Non-finite floats and doubles are written as `NaN`, `Infinity` and `-Infinity`
+/// (with their suffix), which `parse_snbt()` reads back, but Minecraft reads as strings.
+/// @exception Throws if the tree contains a tag of an illegal type.
+template <std::output_iterator<char> Out> Out write_snbt(Out out, const NBTTag& tag, SNBTStyle style = SNBT_COMPACT) {
+    internal::SNBTWriter<Out> writer(out, style);
+    writer.write(tag, 0);
+    return writer.out;
+}
+/// @brief Writes a tag as SNBT to a stream. See `write_snbt(Out, const NBTTag&, SNBTStyle)`.
+void write_snbt(std::ostream& stream, const NBTTag& tag, SNBTStyle style = SNBT_COMPACT) {
+    write_snbt(std::ostreambuf_iterator<char>(stream), tag, style);
+}
+/// @brief Writes a tag as an SNBT string. See `write_snbt(Out, const NBTTag&, SNBTStyle)`.
+std::string to_snbt(const NBTTag& tag, SNBTStyle style = SNBT_COMPACT) {
+    std::string ret;
+    write_snbt(std::back_inserter(ret), tag, style);
+    return ret;
+}
+
+/// @brief Parses SNBT, such as the output of `to_snbt()` or the NBT arguments of Minecraft's commands.
+/// Accepts everything Minecraft's own parser (before 1.21.5) does: quoted and unquoted keys and strings, number suffixes in either case,
+/// `true` and `false` (as bytes), and typed arrays (`[B;...]`, `[I;...]`, `[L;...]`). Unquoted values that aren't numbers are read as strings.
+/// @param text The text to parse. It must hold exactly one value, with optional whitespace around it.
+/// @param alloc The allocator to allocate the tree's strings and arrays with.
+/// @param symbols If not null, the table to intern the names of the tree's tags in.
+/// @return The parsed tag. Its own name is empty.
+/// @exception Throws `nbt::parse_error` (with the offset of the problem in the text) if the text is malformed, if a list mixes types, or if tags are nested more than 512 deep.
+NBTTag parse_snbt(std::string_view text, const NBTTag::allocator_type& alloc = {}, SymbolTable* symbols = nullptr) {
+    return internal::SNBTParser(text, alloc, symbols).parse();
+}
+
+}
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+
+// Counters for where the time goes when reading and writing NBT data: on the disk, inflating, parsing, and so on.
+//
+// They are compiled out unless NBT_ENABLE_STATS is defined before including the library. With it defined, every phase adds its time
+// and sizes to process-wide counters (which any thread may update at once), and is reported to a callback if one has been installed.
+// Without it, the timers are empty and cost nothing, and `stats::snapshot()` always returns zeros.
+
+namespace nbt {
+
+namespace stats {
+
+#if defined(NBT_ENABLE_STATS)
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+/// @brief A phase of reading or writing NBT data.
+enum Phase {
+    /// @brief Reading files into memory. Region files are memory-mapped instead, and only the mapping is counted here:
+    /// their pages are read in as they are first touched, which mostly shows up under `PHASE_INFLATE`.
+    PHASE_READ,
+    /// @brief Writing files.
+    PHASE_WRITE,
+    /// @brief Decompressing. Bytes in are compressed, and bytes out are decompressed.
+    PHASE_INFLATE,
+    /// @brief Compressing. Bytes in are uncompressed, and bytes out are compressed.
+    PHASE_DEFLATE,
+    /// @brief Parsing NBT data into trees. Bytes in are the bytes parsed.
+    PHASE_PARSE,
+    /// @brief Serialising trees into NBT data. Bytes out are the bytes written.
+    PHASE_SERIALIZE,
+    /// @brief Running the tasks that `load_region_file()` gives a level. Counts no bytes.
+    PHASE_TASK,
+    PHASE_COUNT
+};
+
+/// @brief Gets the name of a phase, such as `"inflate"`.
+const char* phase_name(Phase phase) {
+    static constexpr std::array<const char*, PHASE_COUNT> names = {"read", "write", "inflate", "deflate", "parse", "serialize", "task"};
+    return phase < PHASE_COUNT ? names[phase] : "unknown";
+}
+
+/// @brief The totals for one phase.
+struct PhaseStats {
+    std::uint64_t calls = 0;
+    std::uint64_t nanoseconds = 0;
+    std::uint64_t bytes_in = 0;
+    std::uint64_t bytes_out = 0;
+
+    /// @brief Gets the ratio of bytes in to bytes out, e.g. the compression ratio for `PHASE_DEFLATE`. 0 if no bytes went out.
+    double ratio() const { return this->bytes_out ? (double)this->bytes_in / (double)this->bytes_out : 0; }
+};
+
+/// @brief The totals for every phase, and for the chunks and allocations they involved.
+struct Stats {
+    std::array<PhaseStats, PHASE_COUNT> phases{};
+    /// @brief The number of chunks decoded from, and encoded for, region files.
+    std::uint64_t chunks_read = 0, chunks_written = 0;
+    /// @brief The number of allocations made through `CountingResource`s, and the bytes they asked for.
+    std::uint64_t allocations = 0, allocated_bytes = 0;
+
+    const PhaseStats& operator[](Phase phase) const { return this->phases[phase]; }
+};
+
+/// @brief A single timed phase, as passed to a callback.
+struct Event {
+    Phase phase;
+    std::uint64_t nanoseconds;
+    std::uint64_t bytes_in;
+    std::uint64_t bytes_out;
+};
+
+/// @brief A function to be called at the end of every timed phase, on the thread that ran it.
+/// It may be called from several threads at once.
+using Callback = void (*)(const Event& event);
+
+}
+
+namespace internal {
+
+struct StatsCounters {
+    struct Phase {
+        std::atomic<std::uint64_t> calls{0}, nanoseconds{0}, bytes_in{0}, bytes_out{0};
+    };
+    std::array<Phase, stats::PHASE_COUNT> phases;
+    std::atomic<std::uint64_t> chunks_read{0}, chunks_written{0}, allocations{0}, allocated_bytes{0};
+    std::atomic<stats::Callback> callback{nullptr};
+};
+
+StatsCounters& stats_counters() {
+    static StatsCounters counters;
+    return counters;
+}
+
+// A monotonic clock, so that timings aren't thrown off by changes to the system clock.
+std::uint64_t current_time_nanos() {
+    return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The counters are only summed, and never read to make decisions, so relaxed ordering is enough.
+void add_count(std::atomic<std::uint64_t>& counter, std::uint64_t amount) {
+    if constexpr (stats::enabled)
+        counter.fetch_add(amount, std::memory_order_relaxed);
+}
+
+void record_phase(stats::Phase phase, std::uint64_t nanoseconds, std::uint64_t bytes_in, std::uint64_t bytes_out) {
+    if constexpr (stats::enabled) {
+        StatsCounters::Phase& counters = stats_counters().phases[phase];
+        add_count(counters.calls, 1);
+        add_count(counters.nanoseconds, nanoseconds);
+        add_count(counters.bytes_in, bytes_in);
+        add_count(counters.bytes_out, bytes_out);
+        if (stats::Callback callback = stats_counters().callback.load(std::memory_order_acquire))
+            callback(stats::Event{phase, nanoseconds, bytes_in, bytes_out});
+    }
+}
+
+// Times a phase from its construction to its destruction (so a phase that throws is still counted, with whatever sizes were set by then).
+class PhaseTimer {
+public:
+    PhaseTimer(stats::Phase phase, std::uint64_t bytes_in) : bytes_in(bytes_in), phase(phase) {
+        if constexpr (stats::enabled)
+            this->start = current_time_nanos();
+    }
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+    ~PhaseTimer() {
+        if constexpr (stats::enabled)
+            record_phase(this->phase, current_time_nanos() - this->start, this->bytes_in, this->bytes_out);
+    }
+
+    std::uint64_t bytes_in, bytes_out = 0;
+
+private:
+    stats::Phase phase;
+    std::uint64_t start = 0;
+};
+
+}
+
+namespace stats {
+
+/// @brief Gets the totals counted since the program started (or since `reset()`).
+/// @note Phases that are still running on other threads are not included. The counters are read one at a time, so while other threads are working
+/// the totals may not be consistent with one another (e.g. a phase's calls and its time may be one call apart).
+Stats snapshot() {
+    Stats ret;
+    if constexpr (enabled) {
+        internal::StatsCounters& counters = internal::stats_counters();
+        for (std::size_t i = 0; i < PHASE_COUNT; ++i) {
+            ret.phases[i].calls = counters.phases[i].calls.load(std::memory_order_relaxed);
+            ret.phases[i].nanoseconds = counters.phases[i].nanoseconds.load(std::memory_order_relaxed);
+            ret.phases[i].bytes_in = counters.phases[i].bytes_in.load(std::memory_order_relaxed);
+            ret.phases[i].bytes_out = counters.phases[i].bytes_out.load(std::memory_order_relaxed);
+        }
+        ret.chunks_read = counters.chunks_read.load(std::memory_order_relaxed);
+        ret.chunks_written = counters.chunks_written.load(std::memory_order_relaxed);
+        ret.allocations = counters.allocations.load(std::memory_order_relaxed);
+        ret.allocated_bytes = counters.allocated_bytes.load(std::memory_order_relaxed);
+    }
+    return ret;
+}
+
+/// @brief Sets every counter back to 0.
+void reset() {
+    internal::StatsCounters& counters = internal::stats_counters();
+    for (internal::StatsCounters::Phase& phase : counters.phases) {
+        phase.calls = 0;
+        phase.nanoseconds = 0;
+        phase.bytes_in = 0;
+        phase.bytes_out = 0;
+    }
+    counters.chunks_read = 0;
+    counters.chunks_written = 0;
+    counters.allocations = 0;
+    counters.allocated_bytes = 0;
+}
+
+/// @brief Installs a function to be called at the end of every timed phase, replacing any installed before.
+/// @param callback The function, or null to stop calling one. See `Callback`.
+/// @note Has no effect unless `NBT_ENABLE_STATS` is defined.
+void set_callback(Callback callback) {
+    internal::stats_counters().callback.store(callback, std::memory_order_release);
+}
+
+/// @brief A memory resource that counts the allocations made through it, and passes them on to another resource.
+/// Give it to the allocator that a region or file is parsed with to count allocations per chunk.
+/// Its own counts are always kept; with `NBT_ENABLE_STATS` defined, they are also added to `Stats::allocations` and `Stats::allocated_bytes`.
+class CountingResource : public std::pmr::memory_resource {
+public:
+    /// @param upstream The resource to allocate from. It must outlive this one.
+    explicit CountingResource(std::pmr::memory_resource* upstream = std::pmr::get_default_resource()) : upstream(upstream) {}
+
+    /// @brief Gets the number of allocations made so far.
+    std::uint64_t allocations() const { return this->allocation_count.load(std::memory_order_relaxed); }
+    /// @brief Gets the number of bytes asked for so far (not taking deallocations off).
+    std::uint64_t allocated_bytes() const { return this->byte_count.load(std::memory_order_relaxed); }
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        void* ret = this->upstream->allocate(bytes, alignment);
+        this->allocation_count.fetch_add(1, std::memory_order_relaxed);
+        this->byte_count.fetch_add(bytes, std::memory_order_relaxed);
+        internal::add_count(internal::stats_counters().allocations, 1);
+        internal::add_count(internal::stats_counters().allocated_bytes, bytes);
+        return ret;
+    }
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+        this->upstream->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    std::pmr::memory_resource* upstream;
+    std::atomic<std::uint64_t> allocation_count{0}, byte_count{0};
+};
+
+}
+
+}
+
+#endif
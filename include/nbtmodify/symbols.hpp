@@ -0,0 +1,208 @@
+#ifndef SYMBOLS_HPP
+#define SYMBOLS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+// Tag names, and the tables they can be interned in.
+// The same few dozen keys ("Name", "palette", "data", ...) make up nearly every name in a world,
+// so interning them means a tree holds one pointer per name instead of one string.
+
+namespace nbt {
+
+class SymbolTable;
+
+namespace internal {
+
+// The text of an interned name, along with its hash. Symbols belong to their table.
+struct Symbol {
+    std::string text;
+    std::size_t hash;
+    const SymbolTable* table;
+};
+
+std::size_t hash_name(std::string_view text) {
+    return std::hash<std::string_view>()(text);
+}
+
+}
+
+/// @brief The name of a tag.
+/// A name is either owned (it holds a private copy of its text) or interned (it is a handle to text kept in a `SymbolTable`).
+/// Either way, its hash is computed once, when it is created, and two names interned in the same table are compared by handle.
+/// Owned names keep their text inline, so short ones (which nearly all tag names are) allocate nothing.
+/// @note An interned name must not outlive the table it was interned in.
+class Name {
+public:
+    Name() = default;
+    /// @brief Creates an owned name.
+    explicit Name(std::string_view text);
+    Name(const Name& other) = default;
+    Name(Name&& other) noexcept = default;
+    Name& operator=(const Name& other) = default;
+    Name& operator=(Name&& other) noexcept = default;
+    /// @brief Replaces this name with an owned copy of `text`.
+    Name& operator=(std::string_view text);
+
+    /// @brief Gets the text of this name.
+    const std::string& str() const;
+    operator const std::string&() const { return this->str(); }
+    operator std::string_view() const { return this->str(); }
+    const char* c_str() const { return this->str().c_str(); }
+    std::size_t size() const { return this->str().size(); }
+    bool empty() const { return this->str().empty(); }
+    /// @brief Gets the hash of this name. Equal to `std::hash<std::string_view>` of its text.
+    std::size_t hash() const;
+    /// @brief Returns whether this name is a handle into a `SymbolTable`.
+    bool is_interned() const { return this->symbol != nullptr; }
+
+    friend bool operator==(const Name& lhs, const Name& rhs);
+    friend bool operator==(const Name& lhs, std::string_view rhs) { return lhs.str() == rhs; }
+
+private:
+    friend class SymbolTable;
+    explicit Name(const internal::Symbol* symbol) : symbol(symbol) {}
+
+    // the symbol of an interned name, or null for an owned one
+    const internal::Symbol* symbol = nullptr;
+    // the text and hash of an owned name (the empty name, which every list element has, is owned)
+    std::string text;
+    std::size_t text_hash = empty_hash();
+
+    static std::size_t empty_hash() {
+        static const std::size_t hash = internal::hash_name(std::string_view());
+        return hash;
+    }
+};
+
+/// @brief A thread-safe table of interned names.
+/// Names already in the table (which, once a few chunks have been read, is nearly all of them) are found under a shared lock,
+/// and each thread also caches the names it has interned recently, so hot keys usually skip the lock altogether.
+/// @note Names are never removed. The table must outlive every name interned in it.
+class SymbolTable {
+public:
+    SymbolTable() : id(next_id++) {}
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+
+    /// @brief Interns a name.
+    /// @param text The text of the name.
+    /// @return A handle to the name. Every call with the same text returns the same handle.
+    Name intern(std::string_view text);
+    /// @brief Gets the number of names in this table.
+    std::size_t size() const;
+
+    /// @brief Gets a table shared by the whole program. It is never destroyed, so names interned in it are always valid.
+    static SymbolTable& global();
+
+private:
+    // identifies the table in the thread-local caches (unlike its address, this is never reused by a later table)
+    static inline std::atomic<std::uint64_t> next_id = 1;
+    const std::uint64_t id;
+
+    mutable std::shared_mutex mutex;
+    // keys view into the symbols' text
+    std::unordered_map<std::string_view, std::unique_ptr<internal::Symbol>> symbols;
+};
+
+Name::Name(std::string_view text) : text(text), text_hash(internal::hash_name(text)) {}
+Name& Name::operator=(std::string_view text) {
+    return *this = Name(text);
+}
+
+const std::string& Name::str() const {
+    return this->symbol ? this->symbol->text : this->text;
+}
+std::size_t Name::hash() const {
+    return this->symbol ? this->symbol->hash : this->text_hash;
+}
+
+bool operator==(const Name& lhs, const Name& rhs) {
+    if (lhs.is_interned() && rhs.is_interned()) {
+        if (lhs.symbol == rhs.symbol) return true;
+        // a table holds each name once, so different handles from the same table are different names
+        if (lhs.symbol->table == rhs.symbol->table) return false;
+    }
+    return lhs.hash() == rhs.hash() && lhs.str() == rhs.str();
+}
+
+std::string operator+(const std::string& lhs, const Name& rhs) {
+    return lhs + rhs.str();
+}
+std::string operator+(const char* lhs, const Name& rhs) {
+    return lhs + rhs.str();
+}
+std::string operator+(const Name& lhs, const std::string& rhs) {
+    return lhs.str() + rhs;
+}
+std::string operator+(const Name& lhs, const char* rhs) {
+    return lhs.str() + rhs;
+}
+std::ostream& operator<<(std::ostream& stream, const Name& name) {
+    return stream << name.str();
+}
+
+Name SymbolTable::intern(std::string_view text) {
+    if (text.empty()) return Name();
+    std::size_t hash = internal::hash_name(text);
+
+    struct CacheEntry {
+        std::uint64_t table_id = 0;
+        const internal::Symbol* symbol = nullptr;
+    };
+    thread_local std::array<CacheEntry, 256> cache;
+    CacheEntry& cached = cache[hash & (cache.size() - 1)];
+    // only look at the symbol if it came from this table, since it may belong to a table that no longer exists
+    if (cached.table_id == this->id && cached.symbol->hash == hash && cached.symbol->text == text)
+        return Name(cached.symbol);
+
+    const internal::Symbol* symbol;
+    {
+        std::shared_lock lock(this->mutex);
+        auto it = this->symbols.find(text);
+        symbol = it != this->symbols.end() ? it->second.get() : nullptr;
+    }
+    if (!symbol) {
+        std::unique_lock lock(this->mutex);
+        // another thread may have added it in the meantime
+        auto it = this->symbols.find(text);
+        if (it == this->symbols.end()) {
+            auto owned = std::make_unique<internal::Symbol>(internal::Symbol{std::string(text), hash, this});
+            std::string_view key = owned->text;
+            it = this->symbols.emplace(key, std::move(owned)).first;
+        }
+        symbol = it->second.get();
+    }
+    cached = {this->id, symbol};
+    return Name(symbol);
+}
+
+std::size_t SymbolTable::size() const {
+    std::shared_lock lock(this->mutex);
+    return this->symbols.size();
+}
+
+SymbolTable& SymbolTable::global() {
+    // deliberately leaked, so that names interned in it stay valid while other statics are destroyed
+    static SymbolTable* table = new SymbolTable();
+    return *table;
+}
+
+}
+
+template <> struct std::hash<nbt::Name> {
+    std::size_t operator()(const nbt::Name& name) const { return name.hash(); }
+};
+
+#endif
@@ -0,0 +1,617 @@
+#ifndef TAPE_HPP
+#define TAPE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "core.hpp"
+
+namespace nbt {
+
+class NBTNode;
+
+/// @brief A parsed tree of NBT data, stored flat: every tag is a fixed-size node on one tape, in the order the tags appear in the data.
+/// A node records its type, where its name is, its number of children (or elements), and where the next node after its subtree is,
+/// so a subtree can be stepped over in constant time. Scalars are kept in their nodes, and names, strings and arrays are kept together in one payload buffer.
+/// Parsing a tree this way makes a handful of allocations rather than one (or more) per tag, and going over it walks memory in order.
+/// @note A document can't be modified. To edit one, convert it with `to_tag()`, and convert the result back with `from_tag()` if need be.
+/// @note Nodes are indexed with 32-bit offsets, so a document can hold up to 2^32 - 1 tags, and up to 4 GiB of names, strings and arrays.
+class NBTDocument {
+public:
+    NBTDocument() = default;
+
+    /// @brief Parses the named tag at the start of a buffer.
+    /// @param bytes The buffer to read from. It must start with a complete, named tag, and may continue past it.
+    /// @param consumed If not null, receives the number of bytes that made up the tag.
+    /// @return The parsed document.
+    /// @exception Throws `nbt::truncated_error` if the buffer ends before the tag does, and `nbt::parse_error` if the tag is otherwise malformed.
+    static NBTDocument from_nbt(std::span<const byte_t> bytes, std::size_t* consumed = nullptr);
+    /// @brief Copies a tree into a document.
+    /// @param tag The root of the tree.
+    /// @return The document.
+    /// @exception Throws if the tree can't be encoded (e.g. if a list has elements of different types).
+    static NBTDocument from_tag(const NBTTag& tag);
+
+    /// @brief Gets the root tag. Will throw if the document is empty.
+    NBTNode root() const;
+    /// @brief Gets whether the document holds no tags (i.e. it was default-constructed).
+    bool empty() const { return this->nodes.empty(); }
+    /// @brief Gets the number of tags in the document, counting every element of every list.
+    std::size_t node_count() const { return this->nodes.size(); }
+
+    /// @brief Encodes the document back into NBT data.
+    /// @return The encoded tag. The buffer is allocated once, at exactly the right size.
+    std::vector<byte_t> to_nbt() const;
+
+private:
+    friend class NBTNode;
+
+    struct Node {
+        Tag type;
+        // the type of the elements of a list
+        Tag element_type;
+        ushort_t name_length;
+        uint_t name_offset;
+        // the number of children of a compound, or of elements of a list or array, or the length of a string
+        uint_t size;
+        // the index of the first node after this one's subtree
+        uint_t next;
+        // the bits of a scalar, or the offset of a string's or array's contents in `payload`
+        ulong_t value;
+    };
+
+    // Stores bytes in the payload buffer, aligned for any element type, and returns their offset. With null `data`, only makes room for them.
+    std::size_t store(const void* data, std::size_t size);
+    uint_t add_node(Tag type, std::string_view name);
+    void parse(internal::ByteReader& reader, Tag type, std::string_view name);
+    void add_tag(const NBTTag& tag, bool with_name);
+    void finish(uint_t index);
+    std::size_t encoded_size(uint_t index, bool suppress_header) const;
+    void encode(internal::ByteWriter& writer, uint_t index, bool suppress_header) const;
+
+    std::vector<Node> nodes;
+    // kept in 8-byte words, so that long arrays can be viewed in place
+    std::vector<ulong_t> payload;
+    std::size_t payload_size = 0;
+};
+
+/// @brief A tag in an `NBTDocument`. Cheap to copy: it refers to the document, which must outlive it.
+class NBTNode {
+public:
+    NBTNode() = default;
+
+    /// @brief Gets the type of the tag.
+    Tag type() const { return this->node().type; }
+    /// @brief Gets the name of the tag (empty for elements of lists).
+    std::string_view name() const;
+    /// @brief For lists, gets the type of the elements. `TAG_END` for other tags.
+    Tag element_type() const { return this->node().element_type; }
+
+    /// @brief Gets the number of children of a compound, or of elements of a list or array.
+    /// @exception Throws if `this.type()` is not `TAG_COMPOUND`, `TAG_ARRAY`, `TAG_BYTEARRAY`, `TAG_INTARRAY` or `TAG_LONGARRAY`.
+    std::size_t size() const;
+    /// @brief Gets the number of nodes in this tag's subtree, including itself.
+    std::size_t subtree_size() const { return this->node().next - this->index; }
+
+    /// @brief Compound tag element access. Will throw if `this` is not a compound tag.
+    /// @param name The name of the element to access.
+    /// @return The first element with name `name`. Will throw if no such element exists.
+    /// @note Children are searched in order, stepping over each one's subtree, so this takes time linear in the number of children (but not in their size).
+    NBTNode at(std::string_view name) const;
+    NBTNode operator[](std::string_view name) const { return this->at(name); }
+    /// @brief Compound tag element access, without throwing if the element is missing.
+    /// @return The first element with name `name`, or nothing. Will throw if `this` is not a compound tag.
+    std::optional<NBTNode> find(std::string_view name) const;
+    /// @brief Returns whether this compound tag contains the given key. Will throw if `this` is not a compound tag.
+    bool contains(std::string_view name) const { return this->find(name).has_value(); }
+    /// @brief Array tag element access. Will throw if `this` is not an array tag, or if there is no such element.
+    /// @note Constant time for lists of scalars, strings and arrays. Lists of compounds and lists have to be stepped through up to `index`.
+    NBTNode operator[](std::size_t index) const;
+
+    /// @brief Gets the value of a scalar tag (`byte_t`, `short_t`, `int_t`, `long_t`, `float` or `double`). Will throw if the tag is not of that type.
+    template <NbtType T> T get() const;
+    /// @brief Gets the value of a string tag, as a view into the document. Will throw if the tag is not a string.
+    std::string_view get_string() const;
+    /// @brief Gets the elements of a byte, int or long array tag, as a view into the document. Will throw if the tag is not an array of `T`.
+    template <internal::NbtArrayElement T> std::span<const T> span() const;
+
+    /// @brief Iterates over the children of a compound or the elements of a list, in order.
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = NBTNode;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = NBTNode;
+
+        iterator() = default;
+        NBTNode operator*() const { return NBTNode(this->document, this->index); }
+        iterator& operator++() {
+            this->index = this->document->nodes[this->index].next;
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator ret = *this;
+            ++*this;
+            return ret;
+        }
+        bool operator==(const iterator& other) const { return this->index == other.index; }
+
+    private:
+        friend class NBTNode;
+        iterator(const NBTDocument* document, uint_t index) : document(document), index(index) {}
+
+        const NBTDocument* document = nullptr;
+        uint_t index = 0;
+    };
+    /// @brief Gets an iterator to the first child. Will throw if `this` is not a compound or list tag.
+    iterator begin() const;
+    iterator end() const;
+
+    /// @brief Decodes this tag (and all of its children) into an `NBTTag`.
+    /// @param alloc The allocator to allocate the tag's strings and arrays with.
+    /// @return The decoded tag.
+    NBTTag to_tag(const NBTTag::allocator_type& alloc = {}) const;
+    /// @brief Pretty-print this tag. See `NBTTag::to_string(int)`.
+    std::string to_string(int tab_level = 0) const;
+
+private:
+    friend class NBTDocument;
+    NBTNode(const NBTDocument* document, uint_t index) : document(document), index(index) {}
+
+    const NBTDocument::Node& node() const { return this->document->nodes[this->index]; }
+    void require_children(const char* operation) const;
+    template <typename T> const T* payload() const {
+        return reinterpret_cast<const T*>(reinterpret_cast<const byte_t*>(this->document->payload.data()) + this->node().value);
+    }
+
+    const NBTDocument* document = nullptr;
+    uint_t index = 0;
+};
+
+std::size_t NBTDocument::store(const void* data, std::size_t size) {
+    // values start on a word boundary (names may have been packed in just before)
+    std::size_t offset = this->payload.size() * sizeof(ulong_t);
+    this->payload_size = offset + size;
+    if (this->payload_size > 0xffffffff)
+        throw std::runtime_error("Tried to add a value of " + std::to_string(size) + " bytes to a document whose names and values are too large to index");
+    this->payload.resize((this->payload_size + sizeof(ulong_t) - 1) / sizeof(ulong_t));
+    if (data && size > 0)
+        std::memcpy(reinterpret_cast<byte_t*>(this->payload.data()) + offset, data, size);
+    return offset;
+}
+
+uint_t NBTDocument::add_node(Tag type, std::string_view name) {
+    if (this->nodes.size() >= 0xffffffff)
+        throw std::runtime_error("Tried to add a tag to a document that already holds " + std::to_string(this->nodes.size()) + " tags, which is as many as it can hold");
+    if (name.size() > 0xffff)
+        throw std::runtime_error("Tried to add a tag named " + std::string(name.substr(0, 32)) + "... to a document, but its name is too long to encode");
+    std::size_t name_offset = 0;
+    if (!name.empty()) {
+        name_offset = this->payload_size;
+        this->payload.resize((this->payload_size + name.size() + sizeof(ulong_t) - 1) / sizeof(ulong_t));
+        std::memcpy(reinterpret_cast<byte_t*>(this->payload.data()) + name_offset, name.data(), name.size());
+        // names have no alignment requirement, so they are packed together
+        this->payload_size += name.size();
+        if (this->payload_size > 0xffffffff)
+            throw std::runtime_error("Tried to add a tag named " + std::string(name.substr(0, 32)) + " to a document whose names and values are too large to index");
+    }
+    this->nodes.push_back(Node{type, TAG_END, (ushort_t)name.size(), (uint_t)name_offset, 0, 0, 0});
+    return (uint_t)(this->nodes.size() - 1);
+}
+
+void NBTDocument::finish(uint_t index) {
+    this->nodes[index].next = (uint_t)this->nodes.size();
+}
+
+void NBTDocument::parse(internal::ByteReader& reader, Tag type, std::string_view name) {
+    std::size_t start = reader.position();
+    uint_t index = this->add_node(type, name);
+    // `nodes` may grow while the children are parsed, so the node is looked up again rather than held by reference
+    switch (type) {
+        case TAG_BYTE:
+            this->nodes[index].value = reader.read_byte();
+            break;
+        case TAG_SHORT:
+            this->nodes[index].value = (ushort_t)reader.read_int<short_t>();
+            break;
+        case TAG_INT:
+        case TAG_FLOAT:
+            this->nodes[index].value = reader.read_int<uint_t>();
+            break;
+        case TAG_LONG:
+        case TAG_DOUBLE:
+            this->nodes[index].value = reader.read_int<ulong_t>();
+            break;
+        case TAG_STRING: {
+            std::string_view value = reader.read_string_view();
+            this->nodes[index].size = (uint_t)value.size();
+            this->nodes[index].value = this->store(value.data(), value.size());
+            break;
+        }
+        case TAG_BYTEARRAY: {
+            std::size_t length = reader.read_length();
+            this->nodes[index].size = (uint_t)length;
+            this->nodes[index].value = this->store(reader.take(length), length);
+            break;
+        }
+        case TAG_INTARRAY:
+        case TAG_LONGARRAY: {
+            std::size_t length = reader.read_length();
+            std::size_t element_size = type == TAG_INTARRAY ? sizeof(int_t) : sizeof(long_t);
+            const byte_t* data = reader.take(length * element_size);
+            std::size_t offset = this->store(nullptr, length * element_size);
+            // swapped in place, once, so that views of the array need no conversion
+            byte_t* out = reinterpret_cast<byte_t*>(this->payload.data()) + offset;
+            if (type == TAG_INTARRAY)
+                internal::load_big_endian(reinterpret_cast<int_t*>(out), data, length);
+            else
+                internal::load_big_endian(reinterpret_cast<long_t*>(out), data, length);
+            this->nodes[index].size = (uint_t)length;
+            this->nodes[index].value = offset;
+            break;
+        }
+        case TAG_ARRAY: {
+            auto nesting = reader.nest();
+            Tag element_type = static_cast<Tag>(reader.read_byte());
+            std::size_t length = reader.read_length();
+            // every element takes up at least a byte (except for TAG_END lists, which must be empty anyway)
+            reader.require(length);
+            this->nodes[index].element_type = element_type;
+            this->nodes[index].size = (uint_t)length;
+            this->nodes.reserve(this->nodes.size() + length);
+            for (std::size_t i = 0; i < length; ++i)
+                this->parse(reader, element_type, {});
+            break;
+        }
+        case TAG_COMPOUND: {
+            auto nesting = reader.nest();
+            uint_t count = 0;
+            byte_t next_type = reader.read_byte();
+            while (next_type != TAG_END) {
+                std::string_view child_name = reader.read_string_view();
+                this->parse(reader, static_cast<Tag>(next_type), child_name);
+                ++count;
+                next_type = reader.read_byte();
+            }
+            this->nodes[index].size = count;
+            break;
+        }
+        default:
+            throw parse_error("Found illegal type " + std::to_string(type) + " at offset " + std::to_string(start), start);
+    }
+    this->finish(index);
+}
+
+NBTDocument NBTDocument::from_nbt(std::span<const byte_t> bytes, std::size_t* consumed) {
+    internal::PhaseTimer timer(stats::PHASE_PARSE, 0);
+    internal::ByteReader reader(bytes);
+    NBTDocument ret;
+    // a rough guess that saves most of the reallocation: tags in typical data average well over 8 bytes each
+    ret.nodes.reserve(bytes.size() / 16);
+    Tag type = static_cast<Tag>(reader.read_byte());
+    std::string_view name = reader.read_string_view();
+    ret.parse(reader, type, name);
+    if (consumed)
+        *consumed = reader.position();
+    timer.bytes_in = reader.position();
+    return ret;
+}
+
+void NBTDocument::add_tag(const NBTTag& tag, bool with_name) {
+    uint_t index = this->add_node(tag.type, with_name ? std::string_view(tag.name) : std::string_view());
+    switch (tag.type) {
+        case TAG_BYTE:
+            this->nodes[index].value = (byte_t)std::get<char>(tag.value);
+            break;
+        case TAG_SHORT:
+            this->nodes[index].value = (ushort_t)std::get<short_t>(tag.value);
+            break;
+        case TAG_INT:
+            this->nodes[index].value = (uint_t)std::get<int_t>(tag.value);
+            break;
+        case TAG_LONG:
+            this->nodes[index].value = (ulong_t)std::get<long_t>(tag.value);
+            break;
+        case TAG_FLOAT:
+            this->nodes[index].value = std::bit_cast<uint_t>(std::get<float>(tag.value));
+            break;
+        case TAG_DOUBLE:
+            this->nodes[index].value = std::bit_cast<ulong_t>(std::get<double>(tag.value));
+            break;
+        case TAG_STRING: {
+            const string_t& value = std::get<string_t>(tag.value);
+            if (value.size() > 0xffff)
+                throw std::runtime_error("Tried to add string tag " + tag.name + " to a document, but its value is too long to encode");
+            this->nodes[index].size = (uint_t)value.size();
+            this->nodes[index].value = this->store(value.data(), value.size());
+            break;
+        }
+        case TAG_BYTEARRAY: {
+            const array_t<byte_t>& value = std::get<array_t<byte_t>>(tag.value);
+            this->nodes[index].size = (uint_t)value.size();
+            this->nodes[index].value = this->store(value.data(), value.size());
+            break;
+        }
+        case TAG_INTARRAY: {
+            const array_t<int_t>& value = std::get<array_t<int_t>>(tag.value);
+            this->nodes[index].size = (uint_t)value.size();
+            this->nodes[index].value = this->store(value.data(), value.size() * sizeof(int_t));
+            break;
+        }
+        case TAG_LONGARRAY: {
+            const array_t<long_t>& value = std::get<array_t<long_t>>(tag.value);
+            this->nodes[index].size = (uint_t)value.size();
+            this->nodes[index].value = this->store(value.data(), value.size() * sizeof(long_t));
+            break;
+        }
+        case TAG_ARRAY: {
+            const array_t<NBTTag>& value = std::get<array_t<NBTTag>>(tag.value);
+            Tag element_type = value.empty() ? TAG_END : value[0].type;
+            this->nodes[index].element_type = element_type;
+            this->nodes[index].size = (uint_t)value.size();
+            for (const NBTTag& element : value) {
+                if (element.type != element_type)
+                    throw std::runtime_error("Tried to add array tag " + tag.name + " to a document, but it has elements of different types");
+                this->add_tag(element, false);
+            }
+            break;
+        }
+        case TAG_COMPOUND: {
+            const Compound& value = std::get<Compound>(tag.value);
+            this->nodes[index].size = (uint_t)value.size();
+            for (const NBTTag& child : value)
+                this->add_tag(child, true);
+            break;
+        }
+        default:
+            throw std::runtime_error("Tried to add tag " + tag.name + " of illegal type " + std::to_string(tag.type) + " to a document");
+    }
+    this->finish(index);
+}
+
+NBTDocument NBTDocument::from_tag(const NBTTag& tag) {
+    NBTDocument ret;
+    ret.add_tag(tag, true);
+    return ret;
+}
+
+NBTNode NBTDocument::root() const {
+    if (this->nodes.empty())
+        throw std::runtime_error("Tried to get the root of an empty document");
+    return NBTNode(this, 0);
+}
+
+std::size_t NBTDocument::encoded_size(uint_t index, bool suppress_header) const {
+    const Node& node = this->nodes[index];
+    std::size_t size = suppress_header ? 0 : 3 + node.name_length;
+    switch (node.type) {
+        case TAG_STRING: return size + 2 + node.size;
+        case TAG_BYTEARRAY: return size + 4 + node.size;
+        case TAG_INTARRAY: return size + 4 + node.size * sizeof(int_t);
+        case TAG_LONGARRAY: return size + 4 + node.size * sizeof(long_t);
+        case TAG_ARRAY: {
+            size += 5;
+            if (std::size_t element_size = internal::fixed_payload_size(node.element_type))
+                return size + node.size * element_size;
+            for (uint_t child = index + 1; child < node.next; child = this->nodes[child].next)
+                size += this->encoded_size(child, true);
+            return size;
+        }
+        case TAG_COMPOUND: {
+            for (uint_t child = index + 1; child < node.next; child = this->nodes[child].next)
+                size += this->encoded_size(child, false);
+            return size + 1;
+        }
+        default:
+            return size + internal::fixed_payload_size(node.type);
+    }
+}
+
+void NBTDocument::encode(internal::ByteWriter& writer, uint_t index, bool suppress_header) const {
+    const Node& node = this->nodes[index];
+    const byte_t* payload = reinterpret_cast<const byte_t*>(this->payload.data());
+    if (!suppress_header) {
+        writer.write_byte(node.type);
+        writer.write_int(node.name_length);
+        writer.write_bytes(payload + node.name_offset, node.name_length);
+    }
+    switch (node.type) {
+        case TAG_BYTE: writer.write_byte((byte_t)node.value); break;
+        case TAG_SHORT: writer.write_int((ushort_t)node.value); break;
+        case TAG_INT:
+        case TAG_FLOAT: writer.write_int((uint_t)node.value); break;
+        case TAG_LONG:
+        case TAG_DOUBLE: writer.write_int(node.value); break;
+        case TAG_STRING:
+            writer.write_int((ushort_t)node.size);
+            writer.write_bytes(payload + node.value, node.size);
+            break;
+        case TAG_BYTEARRAY:
+            writer.write_int((int_t)node.size);
+            writer.write_bytes(payload + node.value, node.size);
+            break;
+        case TAG_INTARRAY:
+            writer.write_int((int_t)node.size);
+            writer.write_ints(reinterpret_cast<const int_t*>(payload + node.value), node.size);
+            break;
+        case TAG_LONGARRAY:
+            writer.write_int((int_t)node.size);
+            writer.write_ints(reinterpret_cast<const long_t*>(payload + node.value), node.size);
+            break;
+        case TAG_ARRAY:
+            writer.write_byte(node.element_type);
+            writer.write_int((int_t)node.size);
+            for (uint_t child = index + 1; child < node.next; child = this->nodes[child].next)
+                this->encode(writer, child, true);
+            break;
+        case TAG_COMPOUND:
+            for (uint_t child = index + 1; child < node.next; child = this->nodes[child].next)
+                this->encode(writer, child, false);
+            writer.write_byte(TAG_END);
+            break;
+        default:
+            break;
+    }
+}
+
+std::vector<byte_t> NBTDocument::to_nbt() const {
+    if (this->nodes.empty())
+        throw std::runtime_error("Tried to encode an empty document");
+    std::vector<byte_t> ret(this->encoded_size(0, false));
+    internal::PhaseTimer timer(stats::PHASE_SERIALIZE, 0);
+    internal::ByteWriter writer(ret.data());
+    this->encode(writer, 0, false);
+    timer.bytes_out = ret.size();
+    return ret;
+}
+
+std::string_view NBTNode::name() const {
+    const NBTDocument::Node& node = this->node();
+    return std::string_view(reinterpret_cast<const char*>(this->document->payload.data()) + node.name_offset, node.name_length);
+}
+
+std::size_t NBTNode::size() const {
+    switch (this->type()) {
+        case TAG_BYTEARRAY:
+        case TAG_INTARRAY:
+        case TAG_LONGARRAY:
+        case TAG_ARRAY:
+        case TAG_COMPOUND:
+            return this->node().size;
+        default:
+            throw std::runtime_error("Tried to use size() on non-array tag " + std::string(this->name()));
+    }
+}
+
+void NBTNode::require_children(const char* operation) const {
+    if (this->type() != TAG_COMPOUND && this->type() != TAG_ARRAY)
+        throw std::runtime_error(std::string("Tried to ") + operation + " tag " + std::string(this->name()) + ", but that tag is not a compound or an array");
+}
+
+std::optional<NBTNode> NBTNode::find(std::string_view name) const {
+    if (this->type() != TAG_COMPOUND)
+        throw std::runtime_error("Tried to get value by name " + std::string(name) + " from tag " + std::string(this->name()) + ", but that tag is not a compound");
+    for (NBTNode child : *this)
+        if (child.name() == name) return child;
+    return std::nullopt;
+}
+
+NBTNode NBTNode::at(std::string_view name) const {
+    std::optional<NBTNode> child = this->find(name);
+    if (!child)
+        throw std::runtime_error("Tried to get value by name " + std::string(name) + " from tag " + std::string(this->name()) + ", but that value does not exist in the compound");
+    return *child;
+}
+
+NBTNode NBTNode::operator[](std::size_t index) const {
+    if (this->type() != TAG_ARRAY)
+        throw std::runtime_error("Tried to get value by index " + std::to_string(index) + " from tag " + std::string(this->name()) + ", but that tag is not an array");
+    if (this->node().size <= index)
+        throw std::runtime_error("Tried to get value by index " + std::to_string(index) + " from tag " + std::string(this->name()) + " which does not exist");
+    // elements without children take up one node each
+    if (this->element_type() != TAG_COMPOUND && this->element_type() != TAG_ARRAY)
+        return NBTNode(this->document, this->index + 1 + (uint_t)index);
+    iterator it = this->begin();
+    std::advance(it, index);
+    return *it;
+}
+
+template <NbtType T> T NBTNode::get() const {
+    using traits = internal::tag_traits<T>;
+    static_assert(internal::fixed_payload_size(traits::tag) != 0, "NBTNode::get() is only for scalars; use get_string() or span() for strings and arrays");
+    if (this->type() != traits::tag)
+        throw std::runtime_error(std::string("Tried to extract ") + traits::name + " from non-" + traits::name + " tag " + std::string(this->name()));
+    ulong_t value = this->node().value;
+    if constexpr (std::is_same_v<T, float>)
+        return std::bit_cast<float>((uint_t)value);
+    else if constexpr (std::is_same_v<T, double>)
+        return std::bit_cast<double>(value);
+    else
+        return (T)value;
+}
+
+std::string_view NBTNode::get_string() const {
+    if (this->type() != TAG_STRING)
+        throw std::runtime_error("Tried to extract string from non-string tag " + std::string(this->name()));
+    return std::string_view(this->payload<char>(), this->node().size);
+}
+
+template <internal::NbtArrayElement T> std::span<const T> NBTNode::span() const {
+    using traits = internal::tag_traits<array_t<T>>;
+    if (this->type() != traits::tag)
+        throw std::runtime_error(std::string("Tried to extract ") + traits::name + " from non-" + traits::name + " tag " + std::string(this->name()));
+    return std::span<const T>(this->payload<T>(), this->node().size);
+}
+
+NBTNode::iterator NBTNode::begin() const {
+    this->require_children("iterate over");
+    return iterator(this->document, this->index + 1);
+}
+NBTNode::iterator NBTNode::end() const {
+    this->require_children("iterate over");
+    return iterator(this->document, this->node().next);
+}
+
+NBTTag NBTNode::to_tag(const NBTTag::allocator_type& alloc) const {
+    NBTTag ret(alloc);
+    ret.type = this->type();
+    ret.name = this->name();
+    switch (this->type()) {
+        case TAG_BYTE: ret.value = (char)this->get<byte_t>(); break;
+        case TAG_SHORT: ret.value = this->get<short_t>(); break;
+        case TAG_INT: ret.value = this->get<int_t>(); break;
+        case TAG_LONG: ret.value = this->get<long_t>(); break;
+        case TAG_FLOAT: ret.value = this->get<float>(); break;
+        case TAG_DOUBLE: ret.value = this->get<double>(); break;
+        case TAG_STRING: ret.value = string_t(this->get_string(), alloc); break;
+        case TAG_BYTEARRAY: {
+            std::span<const byte_t> value = this->span<byte_t>();
+            ret.value = array_t<byte_t>(value.begin(), value.end(), alloc);
+            break;
+        }
+        case TAG_INTARRAY: {
+            std::span<const int_t> value = this->span<int_t>();
+            ret.value = array_t<int_t>(value.begin(), value.end(), alloc);
+            break;
+        }
+        case TAG_LONGARRAY: {
+            std::span<const long_t> value = this->span<long_t>();
+            ret.value = array_t<long_t>(value.begin(), value.end(), alloc);
+            break;
+        }
+        case TAG_ARRAY: {
+            array_t<NBTTag> values(alloc);
+            values.reserve(this->node().size);
+            for (NBTNode element : *this)
+                values.push_back(element.to_tag(alloc));
+            ret.value = std::move(values);
+            break;
+        }
+        case TAG_COMPOUND: {
+            Compound values(alloc);
+            for (NBTNode child : *this)
+                values.push_back(child.to_tag(alloc));
+            ret.value = std::move(values);
+            break;
+        }
+        default:
+            break;
+    }
+    return ret;
+}
+
+std::string NBTNode::to_string(int tab_level) const {
+    return this->to_tag().to_string(tab_level);
+}
+
+}
+
+#endif
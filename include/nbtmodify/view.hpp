@@ -0,0 +1,248 @@
+#ifndef VIEW_HPP
+#define VIEW_HPP
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <memory>
+#include <mutex>
+
+#include "core.hpp"
+
+namespace nbt {
+
+/// @brief A read-only view of a tag inside a buffer of NBT data.
+/// Nothing is decoded up front: compounds and lists record where their children are the first time they
+/// are accessed, and values are only decoded when `get()` (or `to_tag()`) is called.
+/// Views of children share their parent's record of them, so a child is only indexed once however many times it is looked up
+/// (`view["sections"][i]` in a loop indexes `sections` once), and compounds with more than a handful of children are searched by name in logarithmic time.
+/// @note The view does not own its data. The buffer it was created from must outlive it (and every view obtained from it).
+/// @note Views (and copies of them) can be used from several threads at once: each record of children is built exactly once, with `std::call_once`.
+struct NBTView {
+    Tag type;
+    std::string_view name;
+
+    NBTView() : type(TAG_END), name(), payload(), table() {}
+    /// @brief Creates a view of the named tag at the start of a buffer.
+    /// @param bytes The buffer to view. It must start with a complete, named tag, and may continue past it.
+    /// @param consumed If not null, receives the number of bytes that made up the tag. Computing it requires walking the whole tag (without decoding it).
+    /// @return A view of the tag.
+    /// @exception Throws `nbt::truncated_error` or `nbt::parse_error` if the header of the tag is malformed.
+    /// Errors further into the tag are only reported when that part of the tag is accessed.
+    static NBTView from_nbt(std::span<const byte_t> bytes, std::size_t* consumed = nullptr);
+    /// @brief Decodes the viewed tag (and all of its children) into an `NBTTag`.
+    /// @param alloc The allocator to allocate the tag's strings and arrays with.
+    /// @return The decoded tag.
+    NBTTag to_tag(const NBTTag::allocator_type& alloc = {}) const;
+    /// @brief Pretty-print this tag. See `NBTTag::to_string(int)`.
+    std::string to_string(int tab_level = 0) const;
+    /// @brief Compound tag element access. Will throw if `this` is not a compound tag.
+    /// @param name The name of the element to access.
+    /// @return A view of the element with name `name`. Will throw if no such element exists.
+    /// @note Views are read-only, so unlike `NBTTag::operator[]`, this does not create missing elements.
+    NBTView operator[](std::string_view name) const;
+    /// @brief Compound tag element access. Will throw if `this` is not a compound tag.
+    /// @param name The name of the element to access.
+    /// @return A view of the element with name `name`. Will throw if no such element exists.
+    NBTView at(std::string_view name) const;
+    /// @brief Array tag element access. Will throw if `this` is not an array tag.
+    /// @param index The index of the element to access.
+    /// @return A view of the element with index `index`. Will throw if no such element exists.
+    NBTView operator[](std::size_t index) const;
+    /// @brief Decodes the value of this tag. See `NBTTag::get()`.
+    template <NbtType T> T get() const;
+    /// @brief Gets the size of this array tag.
+    /// @return The number of elements in this array tag.
+    /// @exception Throws if `this.type` is not one of `TAG_BYTEARRAY`, `TAG_INTARRAY`, `TAG_LONGARRAY`, or `TAG_ARRAY`.
+    std::size_t size() const;
+    /// @brief Returns whether this compound tag contains the given key.
+    /// @param key The key.
+    /// @return Whether this tag contains the key.
+    /// @exception Throws if `this.type` is not `TAG_COMPOUND`.
+    bool contains(std::string_view key) const;
+
+private:
+    struct Table;
+    struct Child {
+        Tag type;
+        std::string_view name;
+        std::span<const byte_t> payload;
+        // the child's own table, made along with its parent's (only for compounds and lists)
+        std::shared_ptr<Table> table;
+    };
+    // The children of a compound or list, shared by every view of it. Filled in once, by the first view to need them.
+    struct Table {
+        std::once_flag filled;
+        std::vector<Child> children;
+        // the positions of a large compound's children, sorted by name (and then by position, so that the first of several with the same name is found)
+        std::vector<uint_t> by_name;
+    };
+
+    // compounds up to this size are searched linearly, as `Compound` does
+    static constexpr std::size_t sorted_threshold = 8;
+
+    NBTView(Tag type, std::string_view name, std::span<const byte_t> payload, std::shared_ptr<Table> table)
+        : type(type), name(name), payload(payload), table(std::move(table)) {}
+
+    // Creates an empty table for a tag of the given type, or none if tags of that type have no children.
+    static std::shared_ptr<Table> make_table(Tag type);
+    // Records the position of every child of this compound or list, if that hasn't been done yet.
+    const std::vector<Child>& index() const;
+    void fill(Table& table) const;
+    const Child* find(std::string_view key) const;
+    // Makes a view of one of this tag's children, sharing its table.
+    static NBTView view_of(const Child& child);
+
+    // Starts with this tag's payload. May run past its end until the tag has been indexed by its parent.
+    std::span<const byte_t> payload;
+    // null for tags that aren't compounds or lists
+    std::shared_ptr<Table> table;
+};
+
+NBTView NBTView::from_nbt(std::span<const byte_t> bytes, std::size_t* consumed) {
+    internal::ByteReader reader(bytes);
+    Tag type = static_cast<Tag>(reader.read_byte());
+    ushort_t name_length = reader.read_int<ushort_t>();
+    std::string_view name((const char*)reader.take(name_length), name_length);
+    std::size_t payload_start = reader.position();
+    std::span<const byte_t> payload = bytes.subspan(payload_start);
+    if (consumed) {
+        internal::skip_payload(reader, type);
+        *consumed = reader.position();
+        payload = bytes.subspan(payload_start, reader.position() - payload_start);
+    }
+    return NBTView(type, name, payload, make_table(type));
+}
+
+std::shared_ptr<NBTView::Table> NBTView::make_table(Tag type) {
+    return type == TAG_COMPOUND || type == TAG_ARRAY ? std::make_shared<Table>() : nullptr;
+}
+
+const std::vector<NBTView::Child>& NBTView::index() const {
+    if (!this->table)
+        throw std::runtime_error("Tried to index children of tag " + std::string(this->name) + ", but that tag is not a compound or an array");
+    // if filling throws, the next call tries again
+    std::call_once(this->table->filled, [&] { this->fill(*this->table); });
+    return this->table->children;
+}
+
+void NBTView::fill(Table& table) const {
+    std::vector<Child> children;
+    internal::ByteReader reader(this->payload);
+    switch (this->type) {
+        case TAG_COMPOUND: {
+            byte_t next_type = reader.read_byte();
+            while (next_type != TAG_END) {
+                ushort_t name_length = reader.read_int<ushort_t>();
+                std::string_view child_name((const char*)reader.take(name_length), name_length);
+                std::size_t start = reader.position();
+                internal::skip_payload(reader, next_type);
+                children.push_back({static_cast<Tag>(next_type), child_name, this->payload.subspan(start, reader.position() - start), make_table(static_cast<Tag>(next_type))});
+                next_type = reader.read_byte();
+            }
+            break;
+        }
+        case TAG_ARRAY: {
+            byte_t element_type = reader.read_byte();
+            std::size_t length = reader.read_length();
+            // every element takes up at least a byte
+            reader.require(length);
+            children.reserve(length);
+            for (std::size_t i = 0; i < length; ++i) {
+                std::size_t start = reader.position();
+                internal::skip_payload(reader, element_type);
+                children.push_back({static_cast<Tag>(element_type), std::string_view(), this->payload.subspan(start, reader.position() - start), make_table(static_cast<Tag>(element_type))});
+            }
+            break;
+        }
+        default:
+            throw std::runtime_error("Tried to index children of tag " + std::string(this->name) + ", but that tag is not a compound or an array");
+    }
+    table.children = std::move(children);
+    if (this->type == TAG_COMPOUND && table.children.size() > sorted_threshold) {
+        const std::vector<Child>& entries = table.children;
+        table.by_name.resize(entries.size());
+        for (std::size_t i = 0; i < entries.size(); ++i)
+            table.by_name[i] = (uint_t)i;
+        std::stable_sort(table.by_name.begin(), table.by_name.end(), [&](uint_t lhs, uint_t rhs) { return entries[lhs].name < entries[rhs].name; });
+    }
+}
+
+const NBTView::Child* NBTView::find(std::string_view key) const {
+    if (this->type != TAG_COMPOUND)
+        throw std::runtime_error("Tried to get value by name " + std::string(key) + " from tag " + std::string(this->name) + ", but that tag is not a compound");
+    const std::vector<Child>& children = this->index();
+    if (this->table->by_name.empty()) {
+        for (const Child& child : children)
+            if (child.name == key) return &child;
+        return nullptr;
+    }
+    const std::vector<uint_t>& by_name = this->table->by_name;
+    auto it = std::lower_bound(by_name.begin(), by_name.end(), key, [&](uint_t i, std::string_view k) { return children[i].name < k; });
+    return it != by_name.end() && children[*it].name == key ? &children[*it] : nullptr;
+}
+
+NBTView NBTView::view_of(const Child& child) {
+    return NBTView(child.type, child.name, child.payload, child.table);
+}
+
+NBTTag NBTView::to_tag(const NBTTag::allocator_type& alloc) const {
+    internal::ByteReader reader(this->payload);
+    NBTTag ret = NBTTag::from_nbt(reader, true, {this->type}, alloc);
+    ret.name = this->name;
+    return ret;
+}
+
+std::string NBTView::to_string(int tab_level) const {
+    return this->to_tag().to_string(tab_level);
+}
+
+NBTView NBTView::operator[](std::string_view name) const {
+    return this->at(name);
+}
+NBTView NBTView::at(std::string_view name) const {
+    const Child* child = this->find(name);
+    if (!child)
+        throw std::runtime_error("Tried to get value by name " + std::string(name) + " from tag " + std::string(this->name) + ", but that value does not exist in the compound");
+    return view_of(*child);
+}
+NBTView NBTView::operator[](std::size_t index) const {
+    if (this->type != TAG_ARRAY)
+        throw std::runtime_error("Tried to get value by index " + std::to_string(index) + " from tag " + std::string(this->name) + ", but that tag is not an array");
+    const std::vector<Child>& elements = this->index();
+    if (elements.size() <= index)
+        throw std::runtime_error("Tried to get value by index " + std::to_string(index) + " from tag " + std::string(this->name) + " which does not exist");
+    return view_of(elements[index]);
+}
+
+template <NbtType T> T NBTView::get() const {
+    // scalars, strings and primitive arrays are cheap enough to decode on their own
+    return this->to_tag().template get<T>();
+}
+
+std::size_t NBTView::size() const {
+    internal::ByteReader reader(this->payload);
+    switch (this->type) {
+        case TAG_BYTEARRAY:
+        case TAG_INTARRAY:
+        case TAG_LONGARRAY:
+            return reader.read_length();
+        case TAG_ARRAY:
+            reader.read_byte();
+            return reader.read_length();
+        default:
+            throw std::runtime_error("Tried to use size() on non-array tag " + std::string(this->name));
+    }
+}
+
+bool NBTView::contains(std::string_view key) const {
+    if (this->type != TAG_COMPOUND)
+        throw std::runtime_error("Tried to use contains() on non-compound tag " + std::string(this->name));
+    return this->find(key) != nullptr;
+}
+
+}
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef VISITOR_HPP
+#define VISITOR_HPP
+
+#include <string>
+#include <string_view>
+#include <span>
+#include <variant>
+
+#include "core.hpp"
+
+// Event-driven (SAX-style) parsing, for jobs that only need to look at part of the data and never need a tree.
+// Nothing is allocated: names, strings and arrays are handed to the visitor as views into the buffer being parsed,
+// and subtrees the visitor isn't interested in are stepped over using their length prefixes.
+
+namespace nbt {
+
+/// @brief What a visitor wants the parser to do next. Returned by every `NBTVisitor` callback.
+enum Visit {
+    /// @brief Carry on parsing.
+    VISIT_CONTINUE,
+    /// @brief From `begin_compound()` or `begin_list()`: skip over the tag's contents (its end callback is then not called).
+    /// From any other callback: skip over the rest of the enclosing compound or list (whose end callback is still called).
+    VISIT_SKIP,
+    /// @brief Stop parsing straight away. No further callbacks are made.
+    VISIT_STOP,
+};
+
+/// @brief The value of a byte, short, int, long, float or double tag.
+using Scalar = std::variant<char, short_t, int_t, long_t, float, double>;
+
+/// @brief The payload of a byte, int or long array tag, still encoded as it is in the buffer.
+struct ArrayRef {
+    /// @brief `TAG_BYTEARRAY`, `TAG_INTARRAY` or `TAG_LONGARRAY`.
+    Tag type;
+    /// @brief The number of elements.
+    std::size_t size;
+    /// @brief The (big-endian) elements.
+    std::span<const byte_t> bytes;
+
+    /// @brief Decodes one element.
+    /// @tparam T The array's element type (`byte_t`, `int_t` or `long_t`).
+    /// @param index The index of the element.
+    /// @return The element.
+    /// @exception Throws if `T` is not the array's element type, or if the index is out of range.
+    template <internal::NbtArrayElement T> T at(std::size_t index) const;
+    /// @brief Decodes every element.
+    /// @tparam T The array's element type (`byte_t`, `int_t` or `long_t`).
+    /// @param out Where to decode the elements to. Must hold at least `size` elements.
+    /// @exception Throws if `T` is not the array's element type, or if `out` is too small.
+    template <internal::NbtArrayElement T> void copy_to(std::span<T> out) const;
+};
+
+/// @brief The callbacks made by `visit_nbt()`, each of which does nothing and carries on.
+/// Derive from this and hide the callbacks you are interested in; `visit_nbt()` calls them on the derived type directly, so they don't need to be virtual.
+/// Names are empty for list elements. Every `std::string_view` and `ArrayRef` points into the buffer being parsed.
+/// @note Callbacks are made in the order tags appear in the data. A compound's (or list's) children are reported between its begin and end callbacks.
+struct NBTVisitor {
+    /// @brief Called at the start of a compound tag (with its name), before any of its children.
+    Visit begin_compound(std::string_view) { return VISIT_CONTINUE; }
+    /// @brief Called after the last child of a compound tag.
+    Visit end_compound() { return VISIT_CONTINUE; }
+    /// @brief Called at the start of a list tag (with its name, element type and size), before any of its elements.
+    Visit begin_list(std::string_view, Tag, std::size_t) { return VISIT_CONTINUE; }
+    /// @brief Called after the last element of a list tag.
+    Visit end_list() { return VISIT_CONTINUE; }
+    /// @brief Called for each byte, short, int, long, float or double tag, with its name, type and value. The type says which member of the value is set.
+    Visit scalar(std::string_view, Tag, const Scalar&) { return VISIT_CONTINUE; }
+    /// @brief Called for each string tag, with its name and value. The value is not converted from Java's modified UTF-8.
+    Visit string(std::string_view, std::string_view) { return VISIT_CONTINUE; }
+    /// @brief Called for each byte, int or long array tag, with its name and payload. The elements are only decoded if the visitor asks for them.
+    Visit array(std::string_view, const ArrayRef&) { return VISIT_CONTINUE; }
+};
+
+template <internal::NbtArrayElement T> T ArrayRef::at(std::size_t index) const {
+    if (internal::tag_traits<array_t<T>>::tag != this->type)
+        throw std::runtime_error("Tried to read an element of a " + get_tag_type(this->type) + " tag as a " + internal::tag_traits<array_t<T>>::name + " element");
+    if (index >= this->size)
+        throw std::runtime_error("Tried to read element " + std::to_string(index) + " of an array with " + std::to_string(this->size) + " elements");
+    T ret;
+    internal::load_big_endian(&ret, this->bytes.data() + index * sizeof(T), 1);
+    return ret;
+}
+
+template <internal::NbtArrayElement T> void ArrayRef::copy_to(std::span<T> out) const {
+    if (internal::tag_traits<array_t<T>>::tag != this->type)
+        throw std::runtime_error("Tried to read the elements of a " + get_tag_type(this->type) + " tag as " + internal::tag_traits<array_t<T>>::name + " elements");
+    if (out.size() < this->size)
+        throw std::runtime_error("Tried to read " + std::to_string(this->size) + " array elements into a buffer of " + std::to_string(out.size()));
+    internal::load_big_endian(out.data(), this->bytes.data(), this->size);
+}
+
+namespace internal {
+
+// Visits the payload of a tag whose type and name have already been read.
+// Returns `VISIT_SKIP` if the visitor asked to skip the rest of the enclosing tag.
+template <typename Visitor> Visit visit_payload(ByteReader& reader, byte_t type, std::string_view name, Visitor& visitor) {
+    switch (type) {
+        case TAG_BYTE:
+            return visitor.scalar(name, TAG_BYTE, Scalar((char)reader.read_byte()));
+        case TAG_SHORT:
+            return visitor.scalar(name, TAG_SHORT, Scalar(reader.read_int<short_t>()));
+        case TAG_INT:
+            return visitor.scalar(name, TAG_INT, Scalar(reader.read_int<int_t>()));
+        case TAG_LONG:
+            return visitor.scalar(name, TAG_LONG, Scalar(reader.read_int<long_t>()));
+        case TAG_FLOAT:
+            return visitor.scalar(name, TAG_FLOAT, Scalar(reader.read_float()));
+        case TAG_DOUBLE:
+            return visitor.scalar(name, TAG_DOUBLE, Scalar(reader.read_double()));
+        case TAG_STRING:
+            return visitor.string(name, reader.read_string_view());
+        case TAG_BYTEARRAY:
+        case TAG_INTARRAY:
+        case TAG_LONGARRAY: {
+            std::size_t length = reader.read_length();
+            std::size_t element_size = type == TAG_BYTEARRAY ? 1 : type == TAG_INTARRAY ? sizeof(int_t) : sizeof(long_t);
+            const byte_t* data = reader.take(length * element_size);
+            return visitor.array(name, ArrayRef{static_cast<Tag>(type), length, std::span<const byte_t>(data, length * element_size)});
+        }
+        case TAG_ARRAY: {
+            auto nesting = reader.nest();
+            byte_t element_type = reader.read_byte();
+            std::size_t length = reader.read_length();
+            Visit action = visitor.begin_list(name, static_cast<Tag>(element_type), length);
+            if (action == VISIT_STOP) return VISIT_STOP;
+            if (action == VISIT_SKIP) {
+                skip_elements(reader, element_type, length);
+                return VISIT_CONTINUE;
+            }
+            for (std::size_t i = 0; i < length; ++i) {
+                Visit result = visit_payload(reader, element_type, std::string_view(), visitor);
+                if (result == VISIT_STOP) return VISIT_STOP;
+                if (result == VISIT_SKIP) {
+                    skip_elements(reader, element_type, length - i - 1);
+                    break;
+                }
+            }
+            return visitor.end_list();
+        }
+        case TAG_COMPOUND: {
+            Visit action = visitor.begin_compound(name);
+            if (action == VISIT_STOP) return VISIT_STOP;
+            if (action == VISIT_SKIP) {
+                skip_payload(reader, TAG_COMPOUND);
+                return VISIT_CONTINUE;
+            }
+            bool skip_rest = false;
+            {
+                auto nesting = reader.nest();
+                byte_t next_type = reader.read_byte();
+                while (next_type != TAG_END) {
+                    std::string_view child_name = reader.read_string_view();
+                    Visit result = visit_payload(reader, next_type, child_name, visitor);
+                    if (result == VISIT_STOP) return VISIT_STOP;
+                    if (result == VISIT_SKIP) {
+                        skip_rest = true;
+                        break;
+                    }
+                    next_type = reader.read_byte();
+                }
+            }
+            // the reader is at the next entry, which is just where skipping a compound's payload starts from (and which counts this level again)
+            if (skip_rest)
+                skip_payload(reader, TAG_COMPOUND);
+            return visitor.end_compound();
+        }
+        default: {
+            std::size_t at = reader.position();
+            throw parse_error("Found illegal type " + std::to_string(type) + " at offset " + std::to_string(at), at);
+        }
+    }
+}
+
+}
+
+/// @brief Parses NBT data without building a tree, reporting each tag to a visitor as it is reached.
+/// @param bytes The data to parse. It must start with a complete, named tag, and may continue past it.
+/// @param visitor The visitor to report tags to. See `NBTVisitor`.
+/// @param consumed If not null and the whole tag was parsed, receives the number of bytes that made it up.
+/// @return True if the whole tag was parsed, or false if the visitor stopped the parse.
+/// @exception Throws `nbt::truncated_error` or `nbt::parse_error` if the data is malformed (even if, had it not been, the visitor would have skipped that part).
+/// Anything thrown by the visitor is passed on.
+template <typename Visitor> bool visit_nbt(std::span<const byte_t> bytes, Visitor&& visitor, std::size_t* consumed = nullptr) {
+    internal::ByteReader reader(bytes);
+    byte_t type = reader.read_byte();
+    std::string_view name = reader.read_string_view();
+    if (internal::visit_payload(reader, type, name, visitor) == VISIT_STOP)
+        return false;
+    if (consumed)
+        *consumed = reader.position();
+    return true;
+}
+
+/// @brief Decompresses gzip-compressed NBT data, and then parses it with `visit_nbt()`.
+/// @param data The compressed data.
+/// @param visitor The visitor to report tags to. See `NBTVisitor`.
+/// @param decompressor The decompressor to decompress the data with. Defaults to the calling thread's.
+/// The visitor must not use it, since the views the visitor is given point into its buffer.
+/// @return True if the whole tag was parsed, or false if the visitor stopped the parse.
+template <typename Visitor> bool visit_nbt_gzip(std::span<const byte_t> data, Visitor&& visitor, codec::Decompressor& decompressor = codec::Decompressor::local()) {
+    return visit_nbt(decompressor.decompress(GZIP, data), visitor);
+}
+/// @brief Decompresses zlib-compressed NBT data, and then parses it with `visit_nbt()`. See `visit_nbt_gzip()`.
+template <typename Visitor> bool visit_nbt_zlib(std::span<const byte_t> data, Visitor&& visitor, codec::Decompressor& decompressor = codec::Decompressor::local()) {
+    return visit_nbt(decompressor.decompress(ZLIB, data), visitor);
+}
+
+}
+
+#endif